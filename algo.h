@@ -1,22 +1,60 @@
 #ifndef _ALGO_H_
 #define _ALGO_H_
 
-template <typename Iterator, typename T>
-Iterator find(Iterator begin, Iterator end, const T& value)
+/*
+ * a segmented iterator walks a sequence stored as a row of contiguous
+ * segments, like the buffers of a deque. its increment has to check for
+ * the end of the segment on every step, so the algorithms below split
+ * [first, last) into segments and run a plain pointer loop over each.
+ *
+ * a container opts in by specializing this with is_segmented_iterator
+ * set to __true_type and:
+ *   segment_iterator, local_iterator
+ *   segment(it), local(it)   the segment of it and its place inside
+ *   begin(seg), end(seg)     bounds of one segment
+ *   compose(seg, local)      back to an iterator, local != end(seg)
+ */
+template <typename Iterator>
+struct __segmented_iterator_traits
 {
-    while (begin != end && *begin != value)
-        ++begin;
-    return begin;
-}
+	typedef __false_type is_segmented_iterator;
+};
 
 template <typename InputIterator, typename T>
-T accumulate(InputIterator first, InputIterator last, T init)
+T __accumulate(InputIterator first, InputIterator last, T init, __false_type)
 {
 	for (; first != last; ++first)
 		init = init + *first;
 	return init;
 }
 
+template <typename SegmentedIterator, typename T>
+T __accumulate(SegmentedIterator first, SegmentedIterator last, T init,
+               __true_type)
+{
+	typedef __segmented_iterator_traits<SegmentedIterator> traits;
+	typename traits::segment_iterator sfirst = traits::segment(first);
+	typename traits::segment_iterator slast = traits::segment(last);
+	if (sfirst == slast)
+		return __accumulate(traits::local(first), traits::local(last), init,
+		                    __false_type());
+	init = __accumulate(traits::local(first), traits::end(sfirst), init,
+	                    __false_type());
+	for (++sfirst; sfirst != slast; ++sfirst)
+		init = __accumulate(traits::begin(sfirst), traits::end(sfirst), init,
+		                    __false_type());
+	return __accumulate(traits::begin(slast), traits::local(last), init,
+	                    __false_type());
+}
+
+template <typename InputIterator, typename T>
+inline T accumulate(InputIterator first, InputIterator last, T init)
+{
+	typedef typename __segmented_iterator_traits<InputIterator>::
+			is_segmented_iterator segmented;
+	return __accumulate(first, last, init, segmented());
+}
+
 template <typename InputIterator, typename T, typename BinaryOperation>
 T accumulate(InputIterator first, InputIterator last, T init,
 		     BinaryOperation binary_op)
@@ -92,7 +130,7 @@ T inner_product(InputIterator1 first1, InputIterator1 last1,
 	return init;
 }				
 
-template <typename InputIterator, typename OutputIterator>
+template <typename InputIterator, typename OutputIterator, typename T>
 OutputIterator __partial_sum(InputIterator first, InputIterator last,
                              OutputIterator result, T*)
 {
@@ -207,7 +245,7 @@ OutputIterator set_difference(InputIterator1 first1, InputIterator1 last1,
 /* sorted range as a precondition */
 /* Result = (S1 - S2) U (S2 - S1) */
 template <typename InputIterator1, typename InputIterator2, typename OutputIterator>
-OutputIterator set_difference(InputIterator1 first1, InputIterator1 last1,
+OutputIterator set_symmetric_difference(InputIterator1 first1, InputIterator1 last1,
                               InputIterator2 first2, InputIterator2 last2,
 						      OutputIterator result)
 {
@@ -276,12 +314,48 @@ count_if(InputIterator first, InputIterator last, Predicate pred)
 }
 
 template <typename InputIterator, typename T>
-InputIterator find(InputIterator first, InputIterator last, const T& value)
+InputIterator __find(InputIterator first, InputIterator last, const T& value,
+                     __false_type)
 {
 	while (first != last && *first != value) ++first;
 	return first;
 }
 
+template <typename SegmentedIterator, typename T>
+SegmentedIterator __find(SegmentedIterator first, SegmentedIterator last,
+                         const T& value, __true_type)
+{
+	typedef __segmented_iterator_traits<SegmentedIterator> traits;
+	typedef typename traits::local_iterator local_iterator;
+	typename traits::segment_iterator sfirst = traits::segment(first);
+	typename traits::segment_iterator slast = traits::segment(last);
+	local_iterator lfirst = traits::local(first);
+	if (sfirst != slast) {
+		local_iterator end = traits::end(sfirst);
+		local_iterator i = __find(lfirst, end, value, __false_type());
+		if (i != end)
+			return traits::compose(sfirst, i);
+		for (++sfirst; sfirst != slast; ++sfirst) {
+			end = traits::end(sfirst);
+			i = __find(traits::begin(sfirst), end, value, __false_type());
+			if (i != end)
+				return traits::compose(sfirst, i);
+		}
+		lfirst = traits::begin(slast);
+	}
+	/* local(last) when value is not there, which composes to last */
+	return traits::compose(slast, __find(lfirst, traits::local(last), value,
+	                                     __false_type()));
+}
+
+template <typename InputIterator, typename T>
+inline InputIterator find(InputIterator first, InputIterator last, const T& value)
+{
+	typedef typename __segmented_iterator_traits<InputIterator>::
+			is_segmented_iterator segmented;
+	return __find(first, last, value, segmented());
+}
+
 template <typename InputIterator, typename Predicate>
 InputIterator find_if(InputIterator first, InputIterator last, Predicate pred)
 {
@@ -370,13 +444,40 @@ InputIterator find_first_of(InputIterator first1, InputIterator last1,
 }	
 
 template <typename InputIterator, typename Function>
-Function for_each(InputIterator first, InputIterator last, Function f)
+Function __for_each(InputIterator first, InputIterator last, Function f,
+                    __false_type)
 {
 	for (; first != last; ++first)
 		f(*first);
 	return f;
 }
 
+template <typename SegmentedIterator, typename Function>
+Function __for_each(SegmentedIterator first, SegmentedIterator last,
+                    Function f, __true_type)
+{
+	typedef __segmented_iterator_traits<SegmentedIterator> traits;
+	typename traits::segment_iterator sfirst = traits::segment(first);
+	typename traits::segment_iterator slast = traits::segment(last);
+	if (sfirst == slast)
+		return __for_each(traits::local(first), traits::local(last), f,
+		                  __false_type());
+	f = __for_each(traits::local(first), traits::end(sfirst), f, __false_type());
+	for (++sfirst; sfirst != slast; ++sfirst)
+		f = __for_each(traits::begin(sfirst), traits::end(sfirst), f,
+		               __false_type());
+	return __for_each(traits::begin(slast), traits::local(last), f,
+	                  __false_type());
+}
+
+template <typename InputIterator, typename Function>
+inline Function for_each(InputIterator first, InputIterator last, Function f)
+{
+	typedef typename __segmented_iterator_traits<InputIterator>::
+			is_segmented_iterator segmented;
+	return __for_each(first, last, f, segmented());
+}
+
 template <typename ForwardIterator, typename Generator>
 void generate(ForwardIterator first, ForwardIterator last, Generator gen)
 {
@@ -515,12 +616,42 @@ struct __copy_dispatch<const T*, T*>
 };
 
 template <typename InputIterator, typename OutputIterator>
-inline OutputIterator copy(InputIterator first, InputIterator last, OutputIterator result)
+inline OutputIterator __copy_segmented(InputIterator first, InputIterator last,
+                                       OutputIterator result, __false_type)
 {
 	return __copy_dispatch<InputIterator, OutputIterator>() 
 			(first, last, result);
 }
 
+/* each source segment is a pointer range, so it can reach __copy_t */
+template <typename SegmentedIterator, typename OutputIterator>
+OutputIterator __copy_segmented(SegmentedIterator first, SegmentedIterator last,
+                                OutputIterator result, __true_type)
+{
+	typedef __segmented_iterator_traits<SegmentedIterator> traits;
+	typedef typename traits::local_iterator local_iterator;
+	typename traits::segment_iterator sfirst = traits::segment(first);
+	typename traits::segment_iterator slast = traits::segment(last);
+	if (sfirst == slast)
+		return __copy_dispatch<local_iterator, OutputIterator>()
+				(traits::local(first), traits::local(last), result);
+	result = __copy_dispatch<local_iterator, OutputIterator>()
+			(traits::local(first), traits::end(sfirst), result);
+	for (++sfirst; sfirst != slast; ++sfirst)
+		result = __copy_dispatch<local_iterator, OutputIterator>()
+				(traits::begin(sfirst), traits::end(sfirst), result);
+	return __copy_dispatch<local_iterator, OutputIterator>()
+			(traits::begin(slast), traits::local(last), result);
+}
+
+template <typename InputIterator, typename OutputIterator>
+inline OutputIterator copy(InputIterator first, InputIterator last, OutputIterator result)
+{
+	typedef typename __segmented_iterator_traits<InputIterator>::
+			is_segmented_iterator segmented;
+	return __copy_segmented(first, last, result, segmented());
+}
+
 inline char* copy(const char* first, const char* last, char* result)
 {
 	memmove(result, first, last - first);
@@ -533,6 +664,39 @@ inline wchar_t* copy(const wchar_t* first, const wchar_t* last, wchar_t* result)
 	return result + (last - first);
 }
 
+template <typename ForwardIterator, typename T>
+void __fill(ForwardIterator first, ForwardIterator last, const T& value,
+            __false_type)
+{
+	for (; first != last; ++first)
+		*first = value;
+}
+
+template <typename SegmentedIterator, typename T>
+void __fill(SegmentedIterator first, SegmentedIterator last, const T& value,
+            __true_type)
+{
+	typedef __segmented_iterator_traits<SegmentedIterator> traits;
+	typename traits::segment_iterator sfirst = traits::segment(first);
+	typename traits::segment_iterator slast = traits::segment(last);
+	if (sfirst == slast) {
+		__fill(traits::local(first), traits::local(last), value, __false_type());
+		return;
+	}
+	__fill(traits::local(first), traits::end(sfirst), value, __false_type());
+	for (++sfirst; sfirst != slast; ++sfirst)
+		__fill(traits::begin(sfirst), traits::end(sfirst), value, __false_type());
+	__fill(traits::begin(slast), traits::local(last), value, __false_type());
+}
+
+template <typename ForwardIterator, typename T>
+inline void fill(ForwardIterator first, ForwardIterator last, const T& value)
+{
+	typedef typename __segmented_iterator_traits<ForwardIterator>::
+			is_segmented_iterator segmented;
+	__fill(first, last, value, segmented());
+}
+
 template <typename InputIterator1, typename InputIterator2, typename OutputIterator>
 OutputIterator merge(InputIterator1 first1, InputIterator1 last1,
                      InputIterator2 first2, InputIterator2 last2,
@@ -581,7 +745,7 @@ ForwardIterator min_element(ForwardIterator first, ForwardIterator last)
 }
 
 template <typename ForwardIterator, typename Compare>
-ForwardIterator min_element(ForwardIterator first, ForwardIterator lastm
+ForwardIterator min_element(ForwardIterator first, ForwardIterator last,
                             Compare comp)
 {
 	if (first == last) return first;
@@ -818,7 +982,7 @@ OutputIterator rotate_copy(ForwardIterator first, ForwardIterator middle,
 }
 
 template <typename ForwardIterator1, typename ForwardIterator2>
-inline ForwardIterator search(ForwardIterator1 first1, ForwardIterator1 last1,
+inline ForwardIterator1 search(ForwardIterator1 first1, ForwardIterator1 last1,
                               ForwardIterator2 first2, ForwardIterator2 last2)
 {
 	return __search(first1, last1, first2, last2, distance_type(first1),
@@ -1035,6 +1199,7 @@ inline void __linear_insert(RandomAccessIterator first,
 	}
 }
 
+template <typename RandomAccessIterator, typename T>
 void __unguarded_linear_insert(RandomAccessIterator last, T value)
 {
 	RandomAccessIterator next = last;
@@ -0,0 +1,489 @@
+#ifndef _ALLOC_IMPL_H_
+#define _ALLOC_IMPL_H_
+
+#include <cstdlib>
+#include <new>
+#include <mutex>
+#include <atomic>
+
+/* first level allocator: straight to malloc, big blocks only */
+class __malloc_alloc {
+public:
+	static void* allocate(size_t n)
+	{
+		void* result = malloc(n);
+		if (result == 0)
+			throw bad_alloc();
+		return result;
+	}
+
+	static void deallocate(void* p, size_t /* n */)
+	{ free(p); }
+};
+
+/* typed interface used by the containers: node counts instead of bytes */
+template <typename T, typename Alloc>
+class simple_alloc {
+public:
+	static T* allocate(size_t n)
+	{ return n == 0 ? 0 : (T*) Alloc::allocate(n * sizeof(T)); }
+
+	static T* allocate()
+	{ return (T*) Alloc::allocate(sizeof(T)); }
+
+	static void deallocate(T* p, size_t n)
+	{ if (n != 0) Alloc::deallocate(p, n * sizeof(T)); }
+
+	static void deallocate(T* p)
+	{ Alloc::deallocate(p, sizeof(T)); }
+};
+
+enum { __ALIGN = 8 };
+enum { __MAX_BYTES = 128 };
+enum { __NFREELISTS = __MAX_BYTES / __ALIGN };
+enum { __NOBJS = 20 };  /* nodes carved from the pool per refill */
+
+/*
+ * second level allocator: one free list per 8 byte size class up to 128
+ * bytes, which covers the nodes of list, rb_tree and hashtable. an empty
+ * list is refilled with a slab of __NOBJS nodes cut from a big chunk, so
+ * malloc is called once per slab instead of once per node. freed nodes go
+ * back to their list and are never returned to the system.
+ * bigger requests go to __malloc_alloc.
+ */
+template <bool threads, int inst>
+class __pool_alloc {
+private:
+	union obj {
+		union obj* free_list_link;
+		char client_data[1];
+	};
+
+	static obj* volatile free_list[__NFREELISTS];
+	static char* start_free;
+	static char* end_free;
+	static size_t heap_size;
+	static mutex lock;
+
+	static size_t round_up(size_t bytes)
+	{ return (bytes + __ALIGN - 1) & ~size_t(__ALIGN - 1); }
+
+	static size_t freelist_index(size_t bytes)
+	{ return (bytes + __ALIGN - 1) / __ALIGN - 1; }
+
+	static void* refill(size_t n);
+	static char* chunk_alloc(size_t size, int& nobjs);
+
+	/* the lock is taken only when threads is true */
+	struct pool_lock {
+		pool_lock() { if (threads) lock.lock(); }
+		~pool_lock() { if (threads) lock.unlock(); }
+	};
+
+public:
+	static void* allocate(size_t n)
+	{
+		if (n > size_t(__MAX_BYTES))
+			return __malloc_alloc::allocate(n);
+
+		obj* volatile* my_free_list = free_list + freelist_index(n);
+		pool_lock guard;
+		obj* result = *my_free_list;
+		if (result == 0)
+			return refill(round_up(n));
+		*my_free_list = result->free_list_link;
+		return result;
+	}
+
+	static void deallocate(void* p, size_t n)
+	{
+		if (n > size_t(__MAX_BYTES)) {
+			__malloc_alloc::deallocate(p, n);
+			return;
+		}
+
+		obj* q = (obj*) p;
+		obj* volatile* my_free_list = free_list + freelist_index(n);
+		pool_lock guard;
+		q->free_list_link = *my_free_list;
+		*my_free_list = q;
+	}
+
+	/*
+	 * take up to count nodes of size n under a single lock, chained through
+	 * their first word. count is set to the number actually handed out.
+	 */
+	static void* allocate_batch(size_t n, int& count)
+	{
+		obj* volatile* my_free_list = free_list + freelist_index(n);
+		pool_lock guard;
+		obj* head = *my_free_list;
+		if (head == 0) {
+			int nobjs = count;
+			char* chunk = chunk_alloc(round_up(n), nobjs);
+			for (int i = 0; i < nobjs; ++i)
+				((obj*) (chunk + i * round_up(n)))->free_list_link =
+					i + 1 < nobjs ? (obj*) (chunk + (i + 1) * round_up(n)) : 0;
+			count = nobjs;
+			return chunk;
+		}
+		obj* tail = head;
+		int got = 1;
+		while (got < count && tail->free_list_link) {
+			tail = tail->free_list_link;
+			++got;
+		}
+		*my_free_list = tail->free_list_link;
+		tail->free_list_link = 0;
+		count = got;
+		return head;
+	}
+
+	/* give back a chain built by allocate_batch, tail is its last node */
+	static void deallocate_batch(void* head, void* tail, size_t n)
+	{
+		obj* volatile* my_free_list = free_list + freelist_index(n);
+		pool_lock guard;
+		((obj*) tail)->free_list_link = *my_free_list;
+		*my_free_list = (obj*) head;
+	}
+
+	/* bytes taken from the system so far, for memory accounting */
+	static size_t heap_bytes() { return heap_size; }
+};
+
+template <bool threads, int inst>
+typename __pool_alloc<threads, inst>::obj* volatile
+__pool_alloc<threads, inst>::free_list[__NFREELISTS] = { 0 };
+
+template <bool threads, int inst>
+char* __pool_alloc<threads, inst>::start_free = 0;
+
+template <bool threads, int inst>
+char* __pool_alloc<threads, inst>::end_free = 0;
+
+template <bool threads, int inst>
+size_t __pool_alloc<threads, inst>::heap_size = 0;
+
+template <bool threads, int inst>
+mutex __pool_alloc<threads, inst>::lock;
+
+/* called with the lock held, n is already rounded up */
+template <bool threads, int inst>
+void* __pool_alloc<threads, inst>::refill(size_t n)
+{
+	int nobjs = __NOBJS;
+	char* chunk = chunk_alloc(n, nobjs);
+	if (nobjs == 1)
+		return chunk;
+
+	obj* volatile* my_free_list = free_list + freelist_index(n);
+	obj* result = (obj*) chunk;
+	obj* next_obj = (obj*) (chunk + n);
+	*my_free_list = next_obj;
+	for (int i = 1; ; ++i) {
+		obj* current_obj = next_obj;
+		next_obj = (obj*) ((char*) next_obj + n);
+		if (nobjs - 1 == i) {
+			current_obj->free_list_link = 0;
+			break;
+		}
+		current_obj->free_list_link = next_obj;
+	}
+	return result;
+}
+
+template <bool threads, int inst>
+char* __pool_alloc<threads, inst>::chunk_alloc(size_t size, int& nobjs)
+{
+	size_t total_bytes = size * nobjs;
+	size_t bytes_left = end_free - start_free;
+
+	if (bytes_left >= total_bytes) {
+		char* result = start_free;
+		start_free += total_bytes;
+		return result;
+	} else if (bytes_left >= size) {
+		nobjs = int(bytes_left / size);
+		char* result = start_free;
+		start_free += size * nobjs;
+		return result;
+	}
+
+	/* give the tail of the old chunk to its free list, then grow */
+	if (bytes_left > 0) {
+		obj* volatile* my_free_list = free_list + freelist_index(bytes_left);
+		((obj*) start_free)->free_list_link = *my_free_list;
+		*my_free_list = (obj*) start_free;
+	}
+	size_t bytes_to_get = 2 * total_bytes + round_up(heap_size >> 4);
+	start_free = (char*) __malloc_alloc::allocate(bytes_to_get);
+	heap_size += bytes_to_get;
+	end_free = start_free + bytes_to_get;
+	return chunk_alloc(size, nobjs);
+}
+
+/* counters of __thread_cache_alloc, each thread adds its share in batches */
+struct __alloc_stats {
+	size_t hits;        /* allocations served from a thread cache */
+	size_t refills;     /* batches taken from the central pool */
+	size_t returns;     /* batches given back to the central pool */
+	size_t bytes_held;  /* bytes sitting in thread caches */
+};
+
+/*
+ * per thread cache in front of the central __pool_alloc: allocate and
+ * deallocate touch only the calling thread's free lists, no lock and no
+ * shared cache line. an empty list takes __NOBJS nodes from the central
+ * pool under one lock, a list longer than 2 * __NOBJS gives __NOBJS back.
+ * a thread hands its whole cache back when it exits, and whatever it frees
+ * or allocates after that goes straight to the central pool.
+ */
+template <int inst>
+class __thread_cache_alloc {
+private:
+	typedef __pool_alloc<true, inst> central;
+
+	struct free_node {
+		free_node* next;
+	};
+
+	struct thread_cache {
+		free_node* list[__NFREELISTS];
+		int length[__NFREELISTS];
+		size_t hits;        /* not yet added to the shared counters */
+		size_t held_delta;  /* modulo 2^n, may stand for a decrease */
+
+		thread_cache() : hits(0), held_delta(0)
+		{
+			for (int i = 0; i < __NFREELISTS; ++i) {
+				list[i] = 0;
+				length[i] = 0;
+			}
+		}
+
+		~thread_cache()
+		{
+			for (int i = 0; i < __NFREELISTS; ++i)
+				if (list[i])
+					give_back(*this, i, length[i]);
+			flush(*this);
+			cache_gone = true;
+		}
+	};
+
+	/*
+	 * set once the calling thread's cache is destroyed. a plain bool has
+	 * no destructor, so it can still be read afterwards, eg. by static
+	 * containers freeing their nodes at exit.
+	 */
+	static thread_local bool cache_gone;
+
+	static atomic<size_t> hits;
+	static atomic<size_t> refills;
+	static atomic<size_t> returns;
+	static atomic<size_t> bytes_held;
+
+	static size_t class_size(int i) { return size_t(i + 1) * __ALIGN; }
+
+	static size_t freelist_index(size_t bytes)
+	{ return (bytes + __ALIGN - 1) / __ALIGN - 1; }
+
+	/* 0 once the thread is past its cache, then the central pool is used */
+	static thread_cache* cache()
+	{
+		if (cache_gone)
+			return 0;
+		static thread_local thread_cache c;
+		return &c;
+	}
+
+	static void flush(thread_cache& c)
+	{
+		hits.fetch_add(c.hits, memory_order_relaxed);
+		bytes_held.fetch_add(c.held_delta, memory_order_relaxed);
+		c.hits = 0;
+		c.held_delta = 0;
+	}
+
+	/* move the first count nodes of list i to the central pool */
+	static void give_back(thread_cache& c, int i, int count)
+	{
+		free_node* head = c.list[i];
+		free_node* tail = head;
+		for (int k = 1; k < count; ++k)
+			tail = tail->next;
+		c.list[i] = tail->next;
+		c.length[i] -= count;
+		central::deallocate_batch(head, tail, class_size(i));
+		returns.fetch_add(1, memory_order_relaxed);
+		c.held_delta -= count * class_size(i);
+		flush(c);
+	}
+
+	static void* refill(thread_cache& c, int i)
+	{
+		int count = __NOBJS;
+		free_node* head = (free_node*) central::allocate_batch(class_size(i), count);
+		c.list[i] = head->next;
+		c.length[i] = count - 1;
+		refills.fetch_add(1, memory_order_relaxed);
+		c.held_delta += (count - 1) * class_size(i);
+		flush(c);
+		return head;
+	}
+
+public:
+	static void* allocate(size_t n)
+	{
+		if (n > size_t(__MAX_BYTES))
+			return __malloc_alloc::allocate(n);
+
+		thread_cache* tc = cache();
+		if (tc == 0)
+			return central::allocate(n);
+		thread_cache& c = *tc;
+		const int i = int(freelist_index(n));
+		free_node* result = c.list[i];
+		if (result == 0)
+			return refill(c, i);
+		c.list[i] = result->next;
+		--c.length[i];
+		++c.hits;
+		c.held_delta -= class_size(i);
+		return result;
+	}
+
+	static void deallocate(void* p, size_t n)
+	{
+		if (n > size_t(__MAX_BYTES)) {
+			__malloc_alloc::deallocate(p, n);
+			return;
+		}
+
+		thread_cache* tc = cache();
+		if (tc == 0) {
+			central::deallocate(p, n);
+			return;
+		}
+		thread_cache& c = *tc;
+		const int i = int(freelist_index(n));
+		free_node* q = (free_node*) p;
+		q->next = c.list[i];
+		c.list[i] = q;
+		c.held_delta += class_size(i);
+		if (++c.length[i] > 2 * __NOBJS)
+			give_back(c, i, __NOBJS);
+	}
+
+	/* hits and bytes_held lag behind by what threads have not flushed yet */
+	static __alloc_stats stats()
+	{
+		__alloc_stats result;
+		result.hits = hits.load(memory_order_relaxed);
+		result.refills = refills.load(memory_order_relaxed);
+		result.returns = returns.load(memory_order_relaxed);
+		result.bytes_held = bytes_held.load(memory_order_relaxed);
+		return result;
+	}
+};
+
+template <int inst>
+atomic<size_t> __thread_cache_alloc<inst>::hits(0);
+
+template <int inst>
+atomic<size_t> __thread_cache_alloc<inst>::refills(0);
+
+template <int inst>
+atomic<size_t> __thread_cache_alloc<inst>::returns(0);
+
+template <int inst>
+atomic<size_t> __thread_cache_alloc<inst>::bytes_held(0);
+
+template <int inst>
+thread_local bool __thread_cache_alloc<inst>::cache_gone = false;
+
+typedef __thread_cache_alloc<0> alloc;
+
+enum { __ARENA_BLOCK = 64 * 1024 };
+
+/*
+ * arena: nodes are cut from big blocks with a bump pointer and deallocate
+ * does nothing. release() hands every block back at once. to drop a
+ * container without visiting its nodes, call its forget_nodes() (the
+ * values must need no destructor), let it be destroyed, which then finds
+ * no node to walk, and release() last: a container still reads its arena
+ * memory until it is gone. use a distinct inst per group of containers
+ * that die together.
+ *
+ * the bump pointer is shared by every user of one inst and has no lock:
+ * an arena instance belongs to a single thread, give each thread its own
+ * inst when several build containers at once.
+ */
+template <int inst>
+class __arena_alloc {
+private:
+	struct block {
+		block* next;
+	};
+
+	static block* blocks;
+	static char* start_free;
+	static char* end_free;
+	static size_t heap_size;
+
+	static size_t round_up(size_t bytes)
+	{ return (bytes + __ALIGN - 1) & ~size_t(__ALIGN - 1); }
+
+	static void grow(size_t n)
+	{
+		size_t bytes = round_up(sizeof(block)) + (n > size_t(__ARENA_BLOCK) ?
+		                                          n : size_t(__ARENA_BLOCK));
+		block* b = (block*) __malloc_alloc::allocate(bytes);
+		b->next = blocks;
+		blocks = b;
+		start_free = (char*) b + round_up(sizeof(block));
+		end_free = (char*) b + bytes;
+		heap_size += bytes;
+	}
+
+public:
+	static void* allocate(size_t n)
+	{
+		n = round_up(n);
+		if (size_t(end_free - start_free) < n)
+			grow(n);
+		char* result = start_free;
+		start_free += n;
+		return result;
+	}
+
+	static void deallocate(void* /* p */, size_t /* n */) {}
+
+	static void release()
+	{
+		while (blocks) {
+			block* next = blocks->next;
+			__malloc_alloc::deallocate(blocks, 0);
+			blocks = next;
+		}
+		start_free = end_free = 0;
+		heap_size = 0;
+	}
+
+	static size_t heap_bytes() { return heap_size; }
+};
+
+template <int inst>
+typename __arena_alloc<inst>::block* __arena_alloc<inst>::blocks = 0;
+
+template <int inst>
+char* __arena_alloc<inst>::start_free = 0;
+
+template <int inst>
+char* __arena_alloc<inst>::end_free = 0;
+
+template <int inst>
+size_t __arena_alloc<inst>::heap_size = 0;
+
+#endif
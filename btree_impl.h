@@ -0,0 +1,477 @@
+#ifndef _BTREE_IMPL_H_
+#define _BTREE_IMPL_H_
+
+/*
+ * B-tree with the interface of rb_tree: values are kept inline in nodes of
+ * about __btree_node_bytes, so a node is a few cache lines and a range
+ * scan walks arrays instead of chasing one pointer per value.
+ * every value lives in exactly one node, leaves have no child array.
+ *
+ * unlike rb_tree, an insert moves values: along their node to make room,
+ * and into a new node when one splits. so any insert invalidates every
+ * iterator, pointer and reference into the tree except the iterator it
+ * returns.
+ */
+const size_t __btree_node_bytes = 256;
+
+template <typename Value>
+struct __btree_slots {
+	enum {
+		fit = (__btree_node_bytes - 2 * sizeof(void*)) / sizeof(Value),
+		value = fit < 3 ? 3 : (fit > 255 ? 255 : int(fit))
+	};
+};
+
+template <typename Value, int Slots>
+struct __btree_node {
+	typedef __btree_node* node_ptr;
+
+	node_ptr parent;
+	unsigned short position;  /* index in parent->children */
+	unsigned short count;     /* number of values */
+	bool leaf;
+	alignas(Value) unsigned char storage[Slots * sizeof(Value)];
+
+	Value* value(int i) { return (Value*) storage + i; }
+	node_ptr& child(int i);
+};
+
+template <typename Value, int Slots>
+struct __btree_internal_node : public __btree_node<Value, Slots> {
+	__btree_node<Value, Slots>* children[Slots + 1];
+};
+
+template <typename Value, int Slots>
+inline __btree_node<Value, Slots>*& __btree_node<Value, Slots>::child(int i)
+{
+	return ((__btree_internal_node<Value, Slots>*) this)->children[i];
+}
+
+template <typename Value, typename Ref, typename Ptr, int Slots>
+struct __btree_iterator {
+	typedef Value value_type;
+	typedef Ref reference;
+	typedef Ptr pointer;
+	typedef bidirectional_iterator_tag iterator_category;
+	typedef ptrdiff_t difference_type;
+	typedef __btree_iterator<Value, Value&, Value*, Slots> iterator;
+	typedef __btree_iterator<Value, const Value&, const Value*, Slots> const_iterator;
+	typedef __btree_iterator<Value, Ref, Ptr, Slots> self;
+	typedef __btree_node<Value, Slots>* node_ptr;
+
+	node_ptr node;
+	int position;
+
+	__btree_iterator() {}
+	__btree_iterator(node_ptr x, int i) : node(x), position(i) {}
+	__btree_iterator(const iterator& it) : node(it.node), position(it.position) {}
+
+	reference operator*() const { return *node->value(position); }
+	pointer operator->() const { return &(operator*()); }
+
+	/* move to the bigger value */
+	void increment()
+	{
+		if (node->leaf) {
+			if (++position < node->count)
+				return;
+			/* climb while we are past the last value, end stays in the leaf */
+			self save = *this;
+			while (position == node->count && node->parent) {
+				position = node->position;
+				node = node->parent;
+			}
+			if (position == node->count)
+				*this = save;
+		} else {
+			node = node->child(position + 1);
+			while (!node->leaf)
+				node = node->child(0);
+			position = 0;
+		}
+	}
+
+	/* move to the smaller value */
+	void decrement()
+	{
+		if (node->leaf) {
+			if (--position >= 0)
+				return;
+			self save = *this;
+			while (position < 0 && node->parent) {
+				position = node->position - 1;
+				node = node->parent;
+			}
+			if (position < 0)
+				*this = save;
+		} else {
+			node = node->child(position);
+			while (!node->leaf)
+				node = node->child(node->count);
+			position = node->count - 1;
+		}
+	}
+
+	self& operator++() { increment(); return *this; }
+	self operator++(int)
+	{
+		self tmp = *this;
+		increment();
+		return tmp;
+	}
+
+	self& operator--() { decrement(); return *this; }
+	self operator--(int)
+	{
+		self tmp = *this;
+		decrement();
+		return tmp;
+	}
+
+	bool operator==(const self& x) const
+	{ return node == x.node && position == x.position; }
+	bool operator!=(const self& x) const { return !(*this == x); }
+};
+
+template <typename Key, typename Value, typename KeyOfValue, typename Compare,
+		  typename Alloc = alloc>
+class btree {
+public:
+	enum { slots = __btree_slots<Value>::value };
+
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef value_type* pointer;
+	typedef const value_type* const_pointer;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef __btree_iterator<value_type, reference, pointer, slots> iterator;
+	typedef __btree_iterator<value_type, const_reference, const_pointer, slots>
+			const_iterator;
+protected:
+	typedef __btree_node<Value, slots> node;
+	typedef __btree_internal_node<Value, slots> internal_node;
+	typedef node* node_ptr;
+	typedef simple_alloc<node, Alloc> leaf_allocator;
+	typedef simple_alloc<internal_node, Alloc> internal_allocator;
+
+	node_ptr root;
+	node_ptr leftmost;
+	node_ptr rightmost;
+	size_type node_count;  /* number of values, named as in rb_tree */
+	Compare key_compare;
+
+	static const Key& key(node_ptr x, int i)
+	{ return KeyOfValue() (*x->value(i)); }
+
+	node_ptr new_node(bool leaf)
+	{
+		node_ptr x = leaf ? leaf_allocator::allocate()
+		                  : (node_ptr) internal_allocator::allocate();
+		x->parent = 0;
+		x->position = 0;
+		x->count = 0;
+		x->leaf = leaf;
+		return x;
+	}
+
+	void delete_node(node_ptr x)
+	{
+		for (int i = 0; i < x->count; ++i)
+			destroy(x->value(i));
+		if (x->leaf)
+			leaf_allocator::deallocate(x);
+		else
+			internal_allocator::deallocate((internal_node*) x);
+	}
+
+	void set_child(node_ptr x, int i, node_ptr c)
+	{
+		x->child(i) = c;
+		c->parent = x;
+		c->position = (unsigned short) i;
+	}
+
+	/* first i in x with !(key_i < k) */
+	int lower_bound_in(node_ptr x, const Key& k) const
+	{
+		int first = 0, len = x->count;
+		while (len > 0) {
+			int half = len >> 1;
+			if (key_compare(key(x, first + half), k)) {
+				first += half + 1;
+				len -= half + 1;
+			} else {
+				len = half;
+			}
+		}
+		return first;
+	}
+
+	/* first i in x with k < key_i */
+	int upper_bound_in(node_ptr x, const Key& k) const
+	{
+		int first = 0, len = x->count;
+		while (len > 0) {
+			int half = len >> 1;
+			if (!key_compare(k, key(x, first + half))) {
+				first += half + 1;
+				len -= half + 1;
+			} else {
+				len = half;
+			}
+		}
+		return first;
+	}
+
+	void insert_value(node_ptr x, int i, const Value& v);
+	void split_child(node_ptr x, int i);
+	void split_root_if_full();
+	void erase_subtree(node_ptr x);
+
+public:
+	btree(const Compare& comp = Compare())
+		: node_count(0), key_compare(comp)
+	{ root = leftmost = rightmost = new_node(true); }
+
+	btree(const btree& x)
+		: node_count(0), key_compare(x.key_compare)
+	{
+		root = leftmost = rightmost = new_node(true);
+		__STL_TRY {
+			for (const_iterator it = x.begin(); it != x.end(); ++it)
+				insert_equal(*it);
+		}
+		__STL_UNWIND(erase_subtree(root));
+	}
+
+	~btree() { erase_subtree(root); }
+
+	btree& operator=(const btree& x)
+	{
+		if (this != &x) {
+			clear();
+			key_compare = x.key_compare;
+			for (const_iterator it = x.begin(); it != x.end(); ++it)
+				insert_equal(*it);
+		}
+		return *this;
+	}
+
+	Compare key_comp() const { return key_compare; }
+	iterator begin() { return iterator(leftmost, 0); }
+	const_iterator begin() const { return const_iterator(leftmost, 0); }
+	iterator end() { return iterator(rightmost, rightmost->count); }
+	const_iterator end() const { return const_iterator(rightmost, rightmost->count); }
+	bool empty() const { return node_count == 0; }
+	size_type size() const { return node_count; }
+	size_type max_size() const { return size_type(-1); }
+
+	void clear()
+	{
+		erase_subtree(root);
+		root = leftmost = rightmost = new_node(true);
+		node_count = 0;
+	}
+
+	pair<iterator, bool> insert_unique(const value_type& v);
+	iterator insert_equal(const value_type& v);
+
+	iterator lower_bound(const key_type& k);
+	iterator upper_bound(const key_type& k);
+
+	iterator find(const key_type& k)
+	{
+		iterator j = lower_bound(k);
+		return (j == end() || key_compare(k, KeyOfValue() (*j))) ? end() : j;
+	}
+
+	size_type count(const key_type& k)
+	{
+		size_type n = 0;
+		for (iterator j = lower_bound(k), e = upper_bound(k); j != e; ++j)
+			++n;
+		return n;
+	}
+};
+
+/* put v at i in x which is not full, values and children at >= i move right */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void btree<Key, Value, KeyOfValue, Compare, Alloc>::
+	insert_value(node_ptr x, int i, const Value& v)
+{
+	const int n = x->count;
+	if (i == n) {
+		construct(x->value(n), v);
+	} else {
+		construct(x->value(n), *x->value(n - 1));
+		int j = n - 1;
+		__STL_TRY {
+			for (; j > i; --j)
+				*x->value(j) = *x->value(j - 1);
+			*x->value(i) = v;
+		}
+		/* values above j moved up one: move them back, then drop the copy at n */
+		__STL_UNWIND(for (int k = j + 1; k < n; ++k)
+		                 *x->value(k) = *x->value(k + 1);
+		             destroy(x->value(n)));
+	}
+	if (!x->leaf)
+		for (int j = n; j > i; --j)
+			set_child(x, j + 1, x->child(j));
+	x->count = (unsigned short) (n + 1);
+}
+
+/*
+ * x->child(i) is full: its middle value goes up into x at i and its upper
+ * half becomes a new sibling at i + 1. y is only cut down once the middle
+ * value is in x, so a throwing copy or assignment leaves the tree as it was.
+ */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void btree<Key, Value, KeyOfValue, Compare, Alloc>::split_child(node_ptr x, int i)
+{
+	node_ptr y = x->child(i);
+	node_ptr z = new_node(y->leaf);
+	const int mid = slots / 2;
+
+	__STL_TRY {
+		for (int j = mid + 1; j < slots; ++j) {
+			construct(z->value(j - mid - 1), *y->value(j));
+			++z->count;
+		}
+		insert_value(x, i, *y->value(mid));
+	}
+	__STL_UNWIND(delete_node(z));
+
+	for (int j = mid; j < slots; ++j)
+		destroy(y->value(j));
+	if (!y->leaf)
+		for (int j = mid + 1; j <= slots; ++j)
+			set_child(z, j - mid - 1, y->child(j));
+	y->count = (unsigned short) mid;
+	set_child(x, i + 1, z);
+
+	if (y == rightmost)
+		rightmost = z;
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void btree<Key, Value, KeyOfValue, Compare, Alloc>::split_root_if_full()
+{
+	if (root->count < slots)
+		return;
+	node_ptr r = new_node(false);
+	set_child(r, 0, root);
+	root = r;
+	__STL_TRY {
+		split_child(r, 0);
+	}
+	__STL_UNWIND(root = r->child(0);
+	             root->parent = 0;
+	             delete_node(r));
+}
+
+/* full nodes are split on the way down, so the leaf always has room */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+pair<typename btree<Key, Value, KeyOfValue, Compare, Alloc>::iterator, bool>
+btree<Key, Value, KeyOfValue, Compare, Alloc>::insert_unique(const Value& v)
+{
+	const Key& k = KeyOfValue() (v);
+	split_root_if_full();
+	node_ptr x = root;
+	for (;;) {
+		int i = lower_bound_in(x, k);
+		if (i < x->count && !key_compare(k, key(x, i)))
+			return pair<iterator, bool>(iterator(x, i), false);
+		if (x->leaf) {
+			insert_value(x, i, v);
+			++node_count;
+			return pair<iterator, bool>(iterator(x, i), true);
+		}
+		if (x->child(i)->count == slots) {
+			split_child(x, i);
+			if (key_compare(key(x, i), k))
+				++i;
+			else if (!key_compare(k, key(x, i)))
+				return pair<iterator, bool>(iterator(x, i), false);
+		}
+		x = x->child(i);
+	}
+}
+
+/* equal values keep insertion order: the new one goes after them */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename btree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
+btree<Key, Value, KeyOfValue, Compare, Alloc>::insert_equal(const Value& v)
+{
+	const Key& k = KeyOfValue() (v);
+	split_root_if_full();
+	node_ptr x = root;
+	for (;;) {
+		int i = upper_bound_in(x, k);
+		if (x->leaf) {
+			insert_value(x, i, v);
+			++node_count;
+			return iterator(x, i);
+		}
+		if (x->child(i)->count == slots) {
+			split_child(x, i);
+			if (!key_compare(k, key(x, i)))
+				++i;
+		}
+		x = x->child(i);
+	}
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename btree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
+btree<Key, Value, KeyOfValue, Compare, Alloc>::lower_bound(const Key& k)
+{
+	iterator result = end();
+	node_ptr x = root;
+	for (;;) {
+		int i = lower_bound_in(x, k);
+		if (i < x->count)
+			result = iterator(x, i);
+		if (x->leaf)
+			return result;
+		x = x->child(i);
+	}
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename btree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
+btree<Key, Value, KeyOfValue, Compare, Alloc>::upper_bound(const Key& k)
+{
+	iterator result = end();
+	node_ptr x = root;
+	for (;;) {
+		int i = upper_bound_in(x, k);
+		if (i < x->count)
+			result = iterator(x, i);
+		if (x->leaf)
+			return result;
+		x = x->child(i);
+	}
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void btree<Key, Value, KeyOfValue, Compare, Alloc>::erase_subtree(node_ptr x)
+{
+	if (!x->leaf)
+		for (int i = 0; i <= x->count; ++i)
+			erase_subtree(x->child(i));
+	delete_node(x);
+}
+
+#endif
@@ -0,0 +1,416 @@
+#ifndef _COMPACT_RB_TREE_IMPL_H_
+#define _COMPACT_RB_TREE_IMPL_H_
+
+#include "rb_tree_impl.h"
+
+/*
+ * red-black tree whose nodes keep the color in the low bit of the parent
+ * pointer, nodes are at least pointer aligned so the bit is always free.
+ * a node is three words plus the value instead of four. rotations and
+ * rebalancing are the rb_tree helpers, reaching this layout through the
+ * accessor overloads below.
+ *
+ * links stay full pointers, 32-bit ones would not pay here: links relative
+ * to the node only reach +-16GB, which neither malloc nor the thread
+ * caches keep nodes within, and indices into a node pool need the pool
+ * base in every helper and iterator, and a pool that grows by moving
+ * would break the references insert hands out.
+ */
+struct __rb_tree_compact_node_base
+{
+	typedef __rb_tree_compact_node_base* base_ptr;
+
+	uintptr_t parent_color;  /* parent | color */
+	base_ptr left;
+	base_ptr right;
+
+	static base_ptr minimum(base_ptr x)
+	{
+		while (x->left != 0) x = x->left;
+		return x;
+	}
+
+	static base_ptr maximum(base_ptr x)
+	{
+		while (x->right != 0) x = x->right;
+		return x;
+	}
+};
+
+inline __rb_tree_compact_node_base*
+__rb_tree_parent(__rb_tree_compact_node_base* x)
+{
+	return (__rb_tree_compact_node_base*) (x->parent_color & ~uintptr_t(1));
+}
+
+inline void __rb_tree_set_parent(__rb_tree_compact_node_base* x,
+                                 __rb_tree_compact_node_base* p)
+{
+	x->parent_color = uintptr_t(p) | (x->parent_color & 1);
+}
+
+inline __rb_tree_color_type __rb_tree_color(__rb_tree_compact_node_base* x)
+{
+	return __rb_tree_color_type(x->parent_color & 1);
+}
+
+inline void __rb_tree_set_color(__rb_tree_compact_node_base* x,
+                                __rb_tree_color_type c)
+{
+	x->parent_color = (x->parent_color & ~uintptr_t(1)) | uintptr_t(c);
+}
+
+/* compact nodes carry no augmentation */
+inline void __rb_tree_augment(__rb_tree_compact_node_base*,
+                              __rb_tree_compact_node_base*) {}
+
+inline void __rb_tree_augment_path(__rb_tree_compact_node_base*,
+            __rb_tree_compact_node_base*, __rb_tree_compact_node_base*) {}
+
+template <typename Value>
+struct __compact_rb_tree_node : public __rb_tree_compact_node_base
+{
+	Value value_field;
+};
+
+struct __compact_rb_tree_base_iterator
+{
+	typedef __rb_tree_compact_node_base::base_ptr base_ptr;
+	typedef bidirectional_iterator_tag iterator_category;
+	typedef ptrdiff_t difference_type;
+
+	base_ptr node;
+
+	/* move to the bigger node */
+	void increment()
+	{
+		if (node->right != 0) {
+			node = node->right;
+			while (node->left != 0)
+				node = node->left;
+		} else {
+			base_ptr y = __rb_tree_parent(node);
+			while (node == y->right) {
+				node = y;
+				y = __rb_tree_parent(y);
+			}
+			if (node->right != y)
+				node = y;
+		}
+	}
+
+	/* move to the smaller node */
+	void decrement()
+	{
+		if (__rb_tree_color(node) == __rb_tree_red &&
+				__rb_tree_parent(__rb_tree_parent(node)) == node) {  /* header */
+			node = node->right;
+		} else if (node->left != 0) {
+			base_ptr y = node->left;
+			while (y->right != 0)
+				y = y->right;
+			node = y;
+		} else {
+			base_ptr y = __rb_tree_parent(node);
+			while (node == y->left) {
+				node = y;
+				y = __rb_tree_parent(y);
+			}
+			node = y;
+		}
+	}
+};
+
+inline bool operator==(const __compact_rb_tree_base_iterator& x,
+                       const __compact_rb_tree_base_iterator& y)
+{ return x.node == y.node; }
+
+inline bool operator!=(const __compact_rb_tree_base_iterator& x,
+                       const __compact_rb_tree_base_iterator& y)
+{ return x.node != y.node; }
+
+template <typename Value, typename Ref, typename Ptr>
+struct __compact_rb_tree_iterator : public __compact_rb_tree_base_iterator
+{
+	typedef Value value_type;
+	typedef Ref reference;
+	typedef Ptr pointer;
+	typedef __compact_rb_tree_iterator<Value, Value&, Value*> iterator;
+	typedef __compact_rb_tree_iterator<Value, const Value&, const Value*>
+			const_iterator;
+	typedef __compact_rb_tree_iterator<Value, Ref, Ptr> self;
+	typedef __compact_rb_tree_node<Value>* link_type;
+
+	__compact_rb_tree_iterator() {}
+	__compact_rb_tree_iterator(base_ptr x) { node = x; }
+	__compact_rb_tree_iterator(const iterator& it) { node = it.node; }
+
+	reference operator*() const { return link_type(node)->value_field; }
+	pointer operator->() const { return &(operator*()); }
+
+	self& operator++() { increment(); return *this; }
+	self operator++(int) {
+		self tmp = *this;
+		increment();
+		return tmp;
+	}
+
+	self& operator--() { decrement(); return *this; }
+	self operator--(int) {
+		self tmp = *this;
+		decrement();
+		return tmp;
+	}
+};
+
+/*
+ * the header is laid out like a node: its parent word holds the root
+ * (with the header's own red color bit), left is leftmost, right is
+ * rightmost. the root therefore cannot be handed out by reference, the
+ * helpers get a copy which is stored back with set_root.
+ */
+template <typename Key, typename Value, typename KeyOfValue, typename Compare,
+		  typename Alloc = alloc>
+class compact_rb_tree {
+protected:
+	typedef __rb_tree_compact_node_base* base_ptr;
+	typedef __compact_rb_tree_node<Value> rb_tree_node;
+	typedef simple_alloc<rb_tree_node, Alloc> rb_tree_node_allocator;
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef value_type* pointer;
+	typedef const value_type* const_pointer;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
+	typedef rb_tree_node* link_type;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef __compact_rb_tree_iterator<value_type, reference, pointer> iterator;
+protected:
+	link_type create_node(const value_type& x)
+	{
+		link_type tmp = rb_tree_node_allocator::allocate();
+		__STL_TRY {
+			construct(&tmp->value_field, x);
+		}
+		__STL_UNWIND(rb_tree_node_allocator::deallocate(tmp));
+		return tmp;
+	}
+
+	void destroy_node(link_type p)
+	{
+		destroy(&p->value_field);
+		rb_tree_node_allocator::deallocate(p);
+	}
+
+	size_type node_count;
+	base_ptr header;
+	Compare key_compare;
+
+	base_ptr root() const { return __rb_tree_parent(header); }
+	void set_root(base_ptr x) { __rb_tree_set_parent(header, x); }
+	base_ptr& leftmost() const { return header->left; }
+	base_ptr& rightmost() const { return header->right; }
+
+	static const Key& key(base_ptr x)
+	{ return KeyOfValue() (link_type(x)->value_field); }
+
+	iterator __insert(base_ptr x, base_ptr y, const value_type& v);
+	void __erase(base_ptr x);
+
+	compact_rb_tree(const compact_rb_tree&);
+	compact_rb_tree& operator=(const compact_rb_tree&);
+
+public:
+	compact_rb_tree(const Compare& comp = Compare())
+		: node_count(0), key_compare(comp)
+	{
+		header = rb_tree_node_allocator::allocate();
+		header->parent_color = 0;
+		__rb_tree_set_color(header, __rb_tree_red);
+		leftmost() = header;
+		rightmost() = header;
+	}
+
+	~compact_rb_tree()
+	{
+		clear();
+		rb_tree_node_allocator::deallocate((link_type) header);
+	}
+
+	Compare key_comp() const { return key_compare; }
+	iterator begin() { return leftmost(); }
+	iterator end() { return header; }
+	bool empty() const { return node_count == 0; }
+	size_type size() const { return node_count; }
+	size_type max_size() const { return size_type(-1); }
+
+	void clear()
+	{
+		if (node_count != 0) {
+			__erase(root());
+			set_root(0);
+			leftmost() = header;
+			rightmost() = header;
+			node_count = 0;
+		}
+	}
+
+	pair<iterator, bool> insert_unique(const value_type& v);
+	iterator insert_equal(const value_type& v);
+
+	void erase(iterator position)
+	{
+		base_ptr r = root();
+		link_type y = (link_type) __rb_tree_rebalance_for_erase(position.node,
+				r, leftmost(), rightmost());
+		set_root(r);
+		destroy_node(y);
+		--node_count;
+	}
+
+	size_type erase(const key_type& k)
+	{
+		iterator first = lower_bound(k);
+		iterator last = upper_bound(k);
+		size_type n = 0;
+		while (first != last) {
+			erase(first++);
+			++n;
+		}
+		return n;
+	}
+
+	iterator lower_bound(const key_type& k)
+	{
+		base_ptr y = header;
+		base_ptr x = root();
+		while (x != 0) {
+			bool less = key_compare(key(x), k);
+			y = less ? y : x;
+			x = less ? x->right : x->left;
+		}
+		return iterator(y);
+	}
+
+	iterator upper_bound(const key_type& k)
+	{
+		base_ptr y = header;
+		base_ptr x = root();
+		while (x != 0) {
+			bool greater = key_compare(k, key(x));
+			y = greater ? x : y;
+			x = greater ? x->left : x->right;
+		}
+		return iterator(y);
+	}
+
+	iterator find(const key_type& k)
+	{
+		iterator j = lower_bound(k);
+		return (j == end() || key_compare(k, key(j.node))) ? end() : j;
+	}
+
+	size_type count(const key_type& k)
+	{
+		size_type n = 0;
+		for (iterator first = lower_bound(k), last = upper_bound(k);
+				first != last; ++first)
+			++n;
+		return n;
+	}
+
+	pair<iterator, iterator> equal_range(const key_type& k)
+	{ return pair<iterator, iterator>(lower_bound(k), upper_bound(k)); }
+};
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
+compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	__insert(base_ptr x, base_ptr y, const Value& v)
+{
+	base_ptr z = create_node(v);
+
+	if (y == header || x != 0 || key_compare(KeyOfValue() (v), key(y))) {
+		y->left = z;
+		if (y == header) {
+			set_root(z);
+			rightmost() = z;
+		} else if (y == leftmost()) {
+			leftmost() = z;
+		}
+	} else {
+		y->right = z;
+		if (y == rightmost())
+			rightmost() = z;
+	}
+	z->parent_color = 0;
+	__rb_tree_set_parent(z, y);
+	z->left = 0;
+	z->right = 0;
+
+	base_ptr r = root();
+	__rb_tree_rebalance(z, r);
+	set_root(r);
+	++node_count;
+	return iterator(z);
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
+compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::insert_equal(const Value& v)
+{
+	base_ptr y = header;
+	base_ptr x = root();
+	while (x != 0) {
+		y = x;
+		x = key_compare(KeyOfValue() (v), key(x)) ? x->left : x->right;
+	}
+	return __insert(x, y, v);
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+pair<typename compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::iterator, bool>
+compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::insert_unique(const Value& v)
+{
+	base_ptr y = header;
+	base_ptr x = root();
+	bool comp = true;
+
+	while (x != 0) {
+		y = x;
+		comp = key_compare(KeyOfValue() (v), key(x));
+		x = comp ? x->left : x->right;
+	}
+
+	iterator j = iterator(y);
+	if (comp) {
+		if (j == begin())
+			return pair<iterator, bool>(__insert(x, y, v), true);
+		else
+			--j;
+	}
+	if (key_compare(key(j.node), KeyOfValue() (v)))
+		return pair<iterator, bool>(__insert(x, y, v), true);
+
+	return pair<iterator, bool>(j, false);
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void compact_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::__erase(base_ptr x)
+{
+	/* erase without rebalancing */
+	while (x != 0) {
+		__erase(x->right);
+		base_ptr y = x->left;
+		destroy_node((link_type) x);
+		x = y;
+	}
+}
+
+#endif
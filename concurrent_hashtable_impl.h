@@ -0,0 +1,167 @@
+#ifndef _CONCURRENT_HASHTABLE_IMPL_H_
+#define _CONCURRENT_HASHTABLE_IMPL_H_
+
+#include <shared_mutex>
+#include <mutex>
+
+#include "hashtable_impl.h"
+
+const size_t __concurrent_hashtable_shards = 64;
+/* shared with the other concurrent headers, whichever comes first */
+#ifndef __STL_CACHE_LINE_SIZE
+#define __STL_CACHE_LINE_SIZE 64
+const size_t __cache_line_size = __STL_CACHE_LINE_SIZE;
+#endif
+
+/*
+ * hashtable split into shards, each one is a plain hashtable guarded by its
+ * own reader/writer lock. the shard is chosen by the high bits of the hash
+ * code and the same code is handed down to the shard, so a key is hashed
+ * only once. readers of different shards never touch the same cache line
+ * and readers of the same shard only share its lock word.
+ *
+ * results are returned by copy: an iterator into a shard would be left
+ * dangling as soon as the lock is released.
+ */
+template <typename Value, typename Key, typename HashFcn,
+		  typename ExtractKey, typename EqualKey, typename Alloc = alloc,
+		  typename BucketPolicy = __hashtable_prime_policy>
+class concurrent_hashtable {
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef HashFcn hasher;
+	typedef EqualKey key_equal;
+	typedef size_t size_type;
+private:
+	typedef hashtable<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc,
+			BucketPolicy> table;
+	typedef shared_lock<shared_mutex> read_lock;
+	typedef unique_lock<shared_mutex> write_lock;
+
+	/*
+	 * the shard tables never turn on incremental rehash, so find never
+	 * writes to a table while only the shared lock is held.
+	 */
+	struct shard {
+		mutable shared_mutex lock;
+		table tab;
+		char pad[__cache_line_size];  /* keep next shard's lock off this line */
+
+		shard(size_type n, const HashFcn& hf, const EqualKey& eql)
+			: tab(n, hf, eql) {}
+	};
+	typedef simple_alloc<shard, Alloc> shard_allocator;
+
+	hasher hash;
+	ExtractKey get_key;
+	shard* shards;
+	size_type num_shards;  /* power of 2 */
+	int shard_shift;
+
+	shard& shard_of(size_type h) const
+	{
+		const size_t k = sizeof(size_t) == 8 ? size_t(0x9E3779B97F4A7C15ULL)
+		                                     : size_t(0x9E3779B9UL);
+		return shard_shift == int(sizeof(size_t) * 8) ? shards[0]
+				: shards[(h * k) >> shard_shift];
+	}
+
+	concurrent_hashtable(const concurrent_hashtable&);
+	concurrent_hashtable& operator=(const concurrent_hashtable&);
+
+public:
+	concurrent_hashtable(size_type n, const HashFcn& hf, const EqualKey& eql,
+	                     size_type shard_hint = __concurrent_hashtable_shards)
+		: hash(hf), get_key(ExtractKey()), num_shards(1),
+		  shard_shift(sizeof(size_t) * 8)
+	{
+		while (num_shards < shard_hint) {
+			num_shards <<= 1;
+			--shard_shift;
+		}
+		shards = shard_allocator::allocate(num_shards);
+		size_type i = 0;
+		__STL_TRY {
+			for (; i < num_shards; ++i)
+				new (shards + i) shard(n / num_shards, hf, eql);
+		}
+		__STL_UNWIND(while (i > 0) shards[--i].~shard();
+		             shard_allocator::deallocate(shards, num_shards));
+	}
+
+	~concurrent_hashtable()
+	{
+		for (size_type i = 0; i < num_shards; ++i)
+			shards[i].~shard();
+		shard_allocator::deallocate(shards, num_shards);
+	}
+
+	size_type shard_count() const { return num_shards; }
+
+	/* sum of the shards, each one locked in turn: not a snapshot */
+	size_type size() const
+	{
+		size_type result = 0;
+		for (size_type i = 0; i < num_shards; ++i) {
+			read_lock guard(shards[i].lock);
+			result += shards[i].tab.size();
+		}
+		return result;
+	}
+
+	bool insert_unique(const value_type& obj)
+	{
+		const size_type h = hash(get_key(obj));
+		shard& s = shard_of(h);
+		write_lock guard(s.lock);
+		return s.tab.insert_unique_with_hash(obj, h).second;
+	}
+
+	void insert_equal(const value_type& obj)
+	{
+		const size_type h = hash(get_key(obj));
+		shard& s = shard_of(h);
+		write_lock guard(s.lock);
+		s.tab.insert_equal_with_hash(obj, h);
+	}
+
+	/* copy the element with key into result, false if there is none */
+	bool find(const key_type& key, value_type& result) const
+	{
+		const size_type h = hash(key);
+		shard& s = shard_of(h);
+		read_lock guard(s.lock);
+		typename table::iterator it = s.tab.find_with_hash(key, h);
+		if (!it.cur)
+			return false;
+		result = *it;
+		return true;
+	}
+
+	size_type count(const key_type& key) const
+	{
+		const size_type h = hash(key);
+		shard& s = shard_of(h);
+		read_lock guard(s.lock);
+		return s.tab.count_with_hash(key, h);
+	}
+
+	size_type erase(const key_type& key)
+	{
+		const size_type h = hash(key);
+		shard& s = shard_of(h);
+		write_lock guard(s.lock);
+		return s.tab.erase_with_hash(key, h);
+	}
+
+	void clear()
+	{
+		for (size_type i = 0; i < num_shards; ++i) {
+			write_lock guard(shards[i].lock);
+			shards[i].tab.clear();
+		}
+	}
+};
+
+#endif
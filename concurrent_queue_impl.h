@@ -0,0 +1,380 @@
+#ifndef _CONCURRENT_QUEUE_IMPL_H_
+#define _CONCURRENT_QUEUE_IMPL_H_
+
+#include <atomic>
+#include "ring_queue_impl.h"
+
+/* slots per segment, like __deque_buf_size with 8K buffers */
+inline size_t __concurrent_queue_buf_size(size_t n, size_t sz)
+{
+	return n != 0 ? n : (sz < 128 ? size_t(8192 / sz) : size_t(64));
+}
+
+enum { __slot_empty = 0, __slot_full = 1, __slot_taken = 2 };
+
+template <typename T>
+struct __concurrent_queue_slot
+{
+	atomic<int> state;
+	T value_field;
+};
+
+/*
+ * one buffer of the queue. producers take slots with a fetch-add on
+ * enq_idx and consumers with one on deq_idx, the two on their own cache
+ * lines. pool_next links the segment in the retired list or the pool.
+ */
+template <typename T>
+struct __concurrent_queue_segment
+{
+	typedef __concurrent_queue_segment* link_type;
+	typedef __concurrent_queue_slot<T> slot;
+
+	atomic<size_t> enq_idx;
+	char pad1[__cache_line_size - sizeof(atomic<size_t>)];
+	atomic<size_t> deq_idx;
+	char pad2[__cache_line_size - sizeof(atomic<size_t>)];
+	atomic<link_type> next;
+	link_type pool_next;
+	slot slots[1];  /* really slots[buffer_size] */
+
+	static size_t bytes(size_t n)
+	{ return sizeof(__concurrent_queue_segment) + (n - 1) * sizeof(slot); }
+};
+
+/* the segment a thread works on, one record per thread */
+struct __hazard_record
+{
+	atomic<bool> active;
+	atomic<void*> hazard;
+	atomic<__hazard_record*> next;
+	char pad[__cache_line_size - sizeof(atomic<bool>) - sizeof(atomic<void*>)
+	         - sizeof(atomic<__hazard_record*>)];
+};
+
+/*
+ * the hazard records of every concurrent_queue. a thread takes one on its
+ * first operation and keeps it until it exits, when it goes back for the
+ * next new thread. records are never freed, so a scan can't meet one that
+ * is gone, and there are only as many as threads ever ran at once. a
+ * queue scanning them also sees other queues' segments, which can only
+ * delay a reuse.
+ */
+template <int inst>
+struct __hazard_domain
+{
+	static atomic<__hazard_record*> records;
+
+	struct holder {
+		__hazard_record* record;
+
+		holder() : record(acquire()) {}
+		~holder()
+		{
+			record->hazard.store(0, memory_order_release);
+			record->active.store(false, memory_order_release);
+		}
+	};
+
+	static __hazard_record* acquire()
+	{
+		for (__hazard_record* r = records.load(memory_order_acquire); r != 0;
+				r = r->next.load(memory_order_relaxed)) {
+			bool f = false;
+			if (!r->active.load(memory_order_relaxed) &&
+					r->active.compare_exchange_strong(f, true, memory_order_acquire))
+				return r;
+		}
+		__hazard_record* r =
+				(__hazard_record*) __malloc_alloc::allocate(sizeof(__hazard_record));
+		new (&r->active) atomic<bool>(true);
+		new (&r->hazard) atomic<void*>((void*) 0);
+		__hazard_record* top = records.load(memory_order_relaxed);
+		new (&r->next) atomic<__hazard_record*>(top);
+		while (!records.compare_exchange_weak(top, r,
+				memory_order_release, memory_order_relaxed))
+			r->next.store(top, memory_order_relaxed);
+		return r;
+	}
+
+	/* the calling thread's record */
+	static __hazard_record* record()
+	{
+		static thread_local holder h;
+		return h.record;
+	}
+
+	static bool hazardous(void* p)
+	{
+		for (__hazard_record* r = records.load(memory_order_acquire); r != 0;
+				r = r->next.load(memory_order_relaxed))
+			if (r->hazard.load(memory_order_seq_cst) == p)
+				return true;
+		return false;
+	}
+};
+
+template <int inst>
+atomic<__hazard_record*> __hazard_domain<inst>::records(0);
+
+/*
+ * unbounded queue for any number of producers and consumers, a list of
+ * segments like the buffers of a deque. in the common case a push or pop
+ * publishes its segment in the thread's hazard record (a store and a
+ * reload of tail or head), claims a slot with one fetch-add and hands the
+ * value over with one atomic on the slot's state: a producer stores the
+ * value and moves the slot from empty to full, a consumer swaps in taken
+ * and keeps the value if it was full. a consumer that gets there first
+ * spoils the slot and the producer retries further on. a full segment is
+ * followed by a new one linked with CAS.
+ *
+ * segments that head has left behind are retired and only reused once no
+ * hazard record names them. they go back to a small pool, and new
+ * segments come from there before the allocator.
+ *
+ * a taken slot can't be given back, so copying a value_type out of the
+ * queue must not throw. the copy must not use a concurrent_queue either,
+ * the thread's one hazard record is busy then.
+ */
+template <typename T, typename Alloc = alloc, size_t BufSize = 0>
+class concurrent_queue {
+public:
+	typedef T value_type;
+	typedef size_t size_type;
+protected:
+	typedef __concurrent_queue_segment<T> segment;
+	typedef segment* link_type;
+	typedef __hazard_domain<0> domain;
+
+	enum { max_pool = 8 };
+
+	alignas(__cache_line_size) atomic<link_type> head;
+	alignas(__cache_line_size) atomic<link_type> tail;
+	alignas(__cache_line_size) atomic<link_type> retired;
+	atomic<link_type> pool;
+	atomic<size_type> pool_size;
+
+	static size_type buffer_size()
+	{ return __concurrent_queue_buf_size(BufSize, sizeof(T)); }
+
+	static link_type allocate_segment()
+	{ return (link_type) Alloc::allocate(segment::bytes(buffer_size())); }
+
+	static void deallocate_segment(link_type s)
+	{ Alloc::deallocate(s, segment::bytes(buffer_size())); }
+
+	static void init_segment(link_type s)
+	{
+		new (&s->enq_idx) atomic<size_t>(0);
+		new (&s->deq_idx) atomic<size_t>(0);
+		new (&s->next) atomic<link_type>((link_type) 0);
+		for (size_type i = 0; i < buffer_size(); ++i)
+			new (&s->slots[i].state) atomic<int>(__slot_empty);
+	}
+
+	/* an empty segment, from the pool if it has one */
+	link_type get_segment()
+	{
+		link_type s = pool.exchange(0, memory_order_acquire);
+		if (s == 0) {
+			s = allocate_segment();
+		} else {
+			pool_size.fetch_sub(1, memory_order_relaxed);
+			for (link_type rest = s->pool_next; rest != 0; ) {
+				link_type n = rest->pool_next;
+				push_list(pool, rest);
+				rest = n;
+			}
+		}
+		init_segment(s);
+		return s;
+	}
+
+	void put_segment(link_type s)
+	{
+		if (pool_size.load(memory_order_relaxed) >= max_pool) {
+			deallocate_segment(s);
+		} else {
+			pool_size.fetch_add(1, memory_order_relaxed);
+			push_list(pool, s);
+		}
+	}
+
+	static void push_list(atomic<link_type>& list, link_type s)
+	{
+		link_type top = list.load(memory_order_relaxed);
+		do {
+			s->pool_next = top;
+		} while (!list.compare_exchange_weak(top, s,
+				memory_order_release, memory_order_relaxed));
+	}
+
+	/* publish src in r, and read it again until it stays put */
+	static link_type protect(__hazard_record* r, atomic<link_type>& src)
+	{
+		link_type p = src.load(memory_order_acquire);
+		for (;;) {
+			r->hazard.store(p, memory_order_seq_cst);
+			link_type q = src.load(memory_order_seq_cst);
+			if (q == p)
+				return p;
+			p = q;
+		}
+	}
+
+	static void unprotect(__hazard_record* r)
+	{ r->hazard.store(0, memory_order_release); }
+
+	/* retire s, then recycle whatever retired segment is no longer in use */
+	void retire(link_type s)
+	{
+		push_list(retired, s);
+		link_type x = retired.exchange(0, memory_order_acquire);
+		while (x != 0) {
+			link_type next = x->pool_next;
+			if (domain::hazardous(x))
+				push_list(retired, x);
+			else
+				put_segment(x);
+			x = next;
+		}
+	}
+
+	concurrent_queue(const concurrent_queue&);
+	concurrent_queue& operator=(const concurrent_queue&);
+
+public:
+	concurrent_queue()
+		: retired(0), pool(0), pool_size(0)
+	{
+		link_type s = allocate_segment();
+		init_segment(s);
+		head.store(s, memory_order_relaxed);
+		tail.store(s, memory_order_relaxed);
+	}
+
+	/* not thread safe, like the destruction of any container */
+	~concurrent_queue()
+	{
+		for (link_type s = head.load(memory_order_relaxed); s != 0; ) {
+			link_type next = s->next.load(memory_order_relaxed);
+			size_type n = s->enq_idx.load(memory_order_relaxed);
+			if (n > buffer_size())
+				n = buffer_size();
+			for (size_type i = s->deq_idx.load(memory_order_relaxed); i < n; ++i)
+				if (s->slots[i].state.load(memory_order_relaxed) == __slot_full)
+					destroy(&s->slots[i].value_field);
+			deallocate_segment(s);
+			s = next;
+		}
+		link_type lists[2] = { retired.load(memory_order_relaxed),
+		                       pool.load(memory_order_relaxed) };
+		for (int k = 0; k < 2; ++k)
+			for (link_type s = lists[k]; s != 0; ) {
+				link_type next = s->pool_next;
+				deallocate_segment(s);
+				s = next;
+			}
+	}
+
+	/* a snapshot */
+	bool empty()
+	{
+		__hazard_record* r = domain::record();
+		link_type h = protect(r, head);
+		bool e = h->deq_idx.load(memory_order_acquire) >= h->enq_idx.load(memory_order_acquire)
+				&& h->next.load(memory_order_acquire) == 0;
+		unprotect(r);
+		return e;
+	}
+
+	void push(const value_type& x);
+	bool pop(value_type& x);
+};
+
+template <typename T, typename Alloc, size_t BufSize>
+void concurrent_queue<T, Alloc, BufSize>::push(const value_type& x)
+{
+	__hazard_record* r = domain::record();
+	__STL_TRY {
+		for (;;) {
+			link_type t = protect(r, tail);
+			size_type i = t->enq_idx.fetch_add(1, memory_order_relaxed);
+			if (i >= buffer_size()) {
+				/* full: link a segment that already holds x */
+				if (t != tail.load(memory_order_acquire))
+					continue;
+				link_type next = t->next.load(memory_order_acquire);
+				if (next == 0) {
+					link_type s = get_segment();
+					__STL_TRY {
+						construct(&s->slots[0].value_field, x);
+					}
+					__STL_UNWIND(put_segment(s));
+					s->slots[0].state.store(__slot_full, memory_order_relaxed);
+					s->enq_idx.store(1, memory_order_relaxed);
+					if (t->next.compare_exchange_strong(next, s,
+							memory_order_release, memory_order_acquire)) {
+						tail.compare_exchange_strong(t, s, memory_order_release);
+						break;
+					}
+					destroy(&s->slots[0].value_field);
+					put_segment(s);
+				}
+				tail.compare_exchange_strong(t, next, memory_order_release);
+				continue;
+			}
+			__concurrent_queue_slot<T>& slot = t->slots[i];
+			construct(&slot.value_field, x);
+			int e = __slot_empty;
+			if (slot.state.compare_exchange_strong(e, __slot_full,
+					memory_order_release, memory_order_relaxed))
+				break;
+			destroy(&slot.value_field);  /* a consumer gave up on it */
+		}
+	}
+	__STL_UNWIND(unprotect(r));
+	unprotect(r);
+}
+
+template <typename T, typename Alloc, size_t BufSize>
+bool concurrent_queue<T, Alloc, BufSize>::pop(value_type& x)
+{
+	__hazard_record* r = domain::record();
+	bool found = false;
+	__STL_TRY {
+		for (;;) {
+			link_type h = protect(r, head);
+			if (h->deq_idx.load(memory_order_relaxed) >=
+					h->enq_idx.load(memory_order_relaxed) &&
+					h->next.load(memory_order_acquire) == 0)
+				break;
+			size_type i = h->deq_idx.fetch_add(1, memory_order_relaxed);
+			if (i >= buffer_size()) {
+				/* used up: move head on, tail first so it never names h again */
+				link_type next = h->next.load(memory_order_acquire);
+				if (next == 0)
+					break;
+				link_type t = h;
+				tail.compare_exchange_strong(t, next, memory_order_release);
+				if (head.compare_exchange_strong(h, next, memory_order_seq_cst)) {
+					unprotect(r);
+					retire(h);
+				}
+				continue;
+			}
+			__concurrent_queue_slot<T>& slot = h->slots[i];
+			if (slot.state.exchange(__slot_taken, memory_order_acquire) == __slot_full) {
+				x = slot.value_field;
+				destroy(&slot.value_field);
+				found = true;
+				break;
+			}
+		}
+	}
+	__STL_UNWIND(unprotect(r));
+	unprotect(r);
+	return found;
+}
+
+#endif
@@ -0,0 +1,262 @@
+#ifndef _CONCURRENT_SKIPLIST_IMPL_H_
+#define _CONCURRENT_SKIPLIST_IMPL_H_
+
+#include <atomic>
+
+const int __skiplist_max_level = 32;
+
+/*
+ * ordered container with the insert_unique/find/lower_bound semantics of
+ * rb_tree for many threads at once. readers take no lock and write
+ * nothing shared, writers link new nodes with compare-and-swap, one level
+ * at a time from the bottom up. an element is in the set as soon as it is
+ * linked on level 0, the upper levels are only shortcuts.
+ *
+ * nothing is ever unlinked, so a node lives until the list is destroyed:
+ * iterators never dangle, and a scan sees, in order, every element that
+ * was there when it started plus perhaps some inserted meanwhile.
+ */
+template <typename Value>
+struct __skiplist_node {
+	typedef __skiplist_node* link_type;
+
+	Value value_field;
+	int level;
+	atomic<link_type> next[1];  /* really next[level] */
+
+	static size_t bytes(int level)
+	{ return sizeof(__skiplist_node) + (level - 1) * sizeof(atomic<link_type>); }
+};
+
+template <typename Value>
+struct __skiplist_iterator {
+	typedef Value value_type;
+	typedef const Value& reference;
+	typedef const Value* pointer;
+	typedef forward_iterator_tag iterator_category;
+	typedef ptrdiff_t difference_type;
+	typedef __skiplist_iterator<Value> self;
+	typedef __skiplist_node<Value>* link_type;
+
+	link_type node;
+
+	__skiplist_iterator() {}
+	__skiplist_iterator(link_type x) : node(x) {}
+
+	reference operator*() const { return node->value_field; }
+	pointer operator->() const { return &(operator*()); }
+
+	self& operator++()
+	{
+		node = node->next[0].load(memory_order_acquire);
+		return *this;
+	}
+
+	self operator++(int)
+	{
+		self tmp = *this;
+		++*this;
+		return tmp;
+	}
+
+	bool operator==(const self& x) const { return node == x.node; }
+	bool operator!=(const self& x) const { return node != x.node; }
+};
+
+template <typename Key, typename Value, typename KeyOfValue, typename Compare,
+		  typename Alloc = alloc>
+class concurrent_skiplist {
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef const value_type* const_pointer;
+	typedef const value_type& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef __skiplist_iterator<Value> const_iterator;
+	typedef const_iterator iterator;
+protected:
+	typedef __skiplist_node<Value> node;
+	typedef node* link_type;
+
+	link_type head;  /* no value, all levels */
+	atomic<int> height;  /* highest level in use */
+	atomic<size_type> node_count;
+	Compare key_compare;
+
+	static const Key& key(link_type x) { return KeyOfValue() (x->value_field); }
+
+	static link_type allocate_node(int level)
+	{
+		link_type x = (link_type) Alloc::allocate(node::bytes(level));
+		x->level = level;
+		for (int i = 0; i < level; ++i)
+			new (&x->next[i]) atomic<link_type>((link_type) 0);
+		return x;
+	}
+
+	static void deallocate_node(link_type x)
+	{ Alloc::deallocate(x, node::bytes(x->level)); }
+
+	link_type create_node(const value_type& v, int level)
+	{
+		link_type x = allocate_node(level);
+		__STL_TRY {
+			construct(&x->value_field, v);
+		}
+		__STL_UNWIND(deallocate_node(x));
+		return x;
+	}
+
+	void destroy_node(link_type x)
+	{
+		destroy(&x->value_field);
+		deallocate_node(x);
+	}
+
+	/* one more level with probability 1/4, from a per-thread xorshift */
+	static int random_level()
+	{
+		static thread_local unsigned int seed = 0;
+		if (seed == 0)
+			seed = (unsigned int) (size_t) &seed | 1;
+		seed ^= seed << 13;
+		seed ^= seed >> 17;
+		seed ^= seed << 5;
+		int level = 1;
+		for (unsigned int r = seed; (r & 3) == 0 && level < __skiplist_max_level; r >>= 2)
+			++level;
+		return level;
+	}
+
+	/* first node not less than k, searching from the current height */
+	link_type lower_bound_node(const Key& k) const
+	{
+		link_type pred = head;
+		link_type cur = 0;
+		for (int i = height.load(memory_order_acquire) - 1; i >= 0; --i) {
+			cur = pred->next[i].load(memory_order_acquire);
+			while (cur != 0 && key_compare(key(cur), k)) {
+				pred = cur;
+				cur = cur->next[i].load(memory_order_acquire);
+			}
+		}
+		return cur;
+	}
+
+	/* fill preds/succs on every level below level, true if k is found */
+	bool find_position(const Key& k, link_type* preds, link_type* succs, int level)
+	{
+		link_type pred = head;
+		for (int i = level - 1; i >= 0; --i) {
+			link_type cur = pred->next[i].load(memory_order_acquire);
+			while (cur != 0 && key_compare(key(cur), k)) {
+				pred = cur;
+				cur = cur->next[i].load(memory_order_acquire);
+			}
+			preds[i] = pred;
+			succs[i] = cur;
+		}
+		return succs[0] != 0 && !key_compare(k, key(succs[0]));
+	}
+
+	concurrent_skiplist(const concurrent_skiplist&);
+	concurrent_skiplist& operator=(const concurrent_skiplist&);
+
+public:
+	concurrent_skiplist(const Compare& comp = Compare())
+		: height(1), node_count(0), key_compare(comp)
+	{ head = allocate_node(__skiplist_max_level); }
+
+	/* not thread safe, like the destruction of any container */
+	~concurrent_skiplist()
+	{
+		link_type x = head->next[0].load(memory_order_relaxed);
+		while (x != 0) {
+			link_type next = x->next[0].load(memory_order_relaxed);
+			destroy_node(x);
+			x = next;
+		}
+		deallocate_node(head);
+	}
+
+	Compare key_comp() const { return key_compare; }
+	size_type size() const { return node_count.load(memory_order_relaxed); }
+	bool empty() const { return size() == 0; }
+
+	const_iterator begin() const
+	{ return const_iterator(head->next[0].load(memory_order_acquire)); }
+	const_iterator end() const { return const_iterator(0); }
+
+	pair<iterator, bool> insert_unique(const value_type& v);
+
+	const_iterator lower_bound(const key_type& k) const
+	{ return const_iterator(lower_bound_node(k)); }
+
+	const_iterator upper_bound(const key_type& k) const
+	{
+		link_type x = lower_bound_node(k);
+		while (x != 0 && !key_compare(k, key(x)))
+			x = x->next[0].load(memory_order_acquire);
+		return const_iterator(x);
+	}
+
+	const_iterator find(const key_type& k) const
+	{
+		link_type x = lower_bound_node(k);
+		return const_iterator(x != 0 && !key_compare(k, key(x)) ? x : 0);
+	}
+
+	size_type count(const key_type& k) const { return find(k) == end() ? 0 : 1; }
+};
+
+/*
+ * linking on level 0 decides the race between two writers of the same
+ * key: the loser finds the winner on its retry. the upper levels are then
+ * linked one by one, searching again whenever a CAS fails.
+ */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+pair<typename concurrent_skiplist<Key, Value, KeyOfValue, Compare, Alloc>::iterator,
+     bool>
+concurrent_skiplist<Key, Value, KeyOfValue, Compare, Alloc>::
+	insert_unique(const Value& v)
+{
+	const Key& k = KeyOfValue() (v);
+	link_type preds[__skiplist_max_level];
+	link_type succs[__skiplist_max_level];
+	const int level = random_level();
+	link_type x = 0;
+
+	for (;;) {
+		if (find_position(k, preds, succs, __skiplist_max_level)) {
+			if (x != 0)
+				destroy_node(x);
+			return pair<iterator, bool>(iterator(succs[0]), false);
+		}
+		if (x == 0)
+			x = create_node(v, level);
+		for (int i = 0; i < level; ++i)
+			x->next[i].store(succs[i], memory_order_relaxed);
+		if (preds[0]->next[0].compare_exchange_strong(succs[0], x,
+				memory_order_release, memory_order_relaxed))
+			break;
+	}
+
+	for (int i = 1; i < level; ++i) {
+		while (!preds[i]->next[i].compare_exchange_strong(succs[i], x,
+				memory_order_release, memory_order_relaxed)) {
+			find_position(k, preds, succs, level);
+			x->next[i].store(succs[i], memory_order_relaxed);
+		}
+	}
+
+	int h = height.load(memory_order_relaxed);
+	while (h < level && !height.compare_exchange_weak(h, level,
+			memory_order_release, memory_order_relaxed))
+		;
+	node_count.fetch_add(1, memory_order_relaxed);
+	return pair<iterator, bool>(iterator(x), true);
+}
+
+#endif
@@ -1,24 +1,15 @@
 #ifndef _DEQUE_IMPL_H_
 #define _DEQUE_IMPL_H_
 
-template <typename T, typename Alloc = alloc, size_t BufSize = 0>
-class deque {
-public:
-	typedef T value_type;
-	typedef value_type* pointer;
-	
-protected:
-	typedef pointer* map_pointer;
-	
-protected:
-	map_pointer map;
-	size_type map_size;
-};
+inline size_t __deque_buf_size(size_t n, size_t sz)
+{
+	return n != 0 ? n : (sz < 512 ? size_t(512/sz) : size_t(1));
+}
 
 template <typename T, typename Ref, typename Ptr, size_t BufSize>
 struct __deque_iterator {
-	typedef __deque_iterator<T, T&, T*, size_t> iterator;
-	typedef __deque_iterator<T, const T&, const T*, size_t> const_iterator;
+	typedef __deque_iterator<T, T&, T*, BufSize> iterator;
+	typedef __deque_iterator<T, const T&, const T*, BufSize> const_iterator;
 	static size_t buffer_size()
 	{ return __deque_buf_size(BufSize, sizeof(T)); }
 	
@@ -62,7 +53,7 @@ struct __deque_iterator {
 		}
 		return *this;
 	}
-	self& operator++(int) {
+	self operator++(int) {
 		self tmp = *this;
 		++*this;
 		return tmp;
@@ -76,7 +67,7 @@ struct __deque_iterator {
 		--cur;
 		return *this;
 	}
-	self& operator--(int)
+	self operator--(int)
 	{
 		self tmp = *this;
 		--*this;
@@ -121,17 +112,41 @@ struct __deque_iterator {
 	{ return (node == x.node) ? (cur < x.cur) : (node < x.node); }
 };
 
-inline size_t __deque_buf_size(size_t n, size_t sz)
+/* defined in algo.h, a deque iterator is segmented by its buffers */
+template <typename Iterator> struct __segmented_iterator_traits;
+
+template <typename T, typename Ref, typename Ptr, size_t BufSize>
+struct __segmented_iterator_traits<__deque_iterator<T, Ref, Ptr, BufSize> >
 {
-	return n != 0 ? n : (sz < 512 ? size_t(512/sz) : size_t(1));
-}
+	typedef __true_type is_segmented_iterator;
+	typedef __deque_iterator<T, Ref, Ptr, BufSize> iterator;
+	typedef typename iterator::map_pointer segment_iterator;
+	typedef Ptr local_iterator;
+
+	static segment_iterator segment(const iterator& it) { return it.node; }
+	static local_iterator local(const iterator& it) { return it.cur; }
+	static local_iterator begin(segment_iterator s) { return *s; }
+	static local_iterator end(segment_iterator s)
+	{ return *s + iterator::buffer_size(); }
+
+	static iterator compose(segment_iterator s, local_iterator l)
+	{
+		iterator it;
+		it.set_node(s);
+		it.cur = (T*) l;
+		return it;
+	}
+};
 
 template <typename T, typename Alloc = alloc, size_t BufSize = 0>
 class deque {
 public:
 	typedef T value_type;
 	typedef value_type* pointer;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
 	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
 public:
 	typedef __deque_iterator<T, T&, T*, BufSize> iterator;
 	
@@ -153,9 +168,38 @@ public:
 	size_type max_size() const { return size_type(-1); }
 	bool empty() const { return finish == start; }
 	
+	deque()
+		: start(), finish(), map(0), map_size(0), spare(0)
+	{ create_map_and_nodes(0); }
+
+	deque(const deque& x)
+		: start(), finish(), map(0), map_size(0), spare(0)
+	{
+		create_map_and_nodes(0);
+		__STL_TRY {
+			append(x.start, x.finish);
+		}
+		__STL_UNWIND(destroy_map_and_nodes());
+	}
+
 	deque(int n, const value_type& value)
-		: start(), finish(), map(0), map_size(0)
+		: start(), finish(), map(0), map_size(0), spare(0)
 	{ fill_initialize(n, value); }
+
+	~deque()
+	{
+		clear();
+		destroy_map_and_nodes();
+	}
+
+	deque& operator=(const deque& x)
+	{
+		if (this != &x) {
+			clear();
+			append(x.start, x.finish);
+		}
+		return *this;
+	}
 	
 	void push_back(const value_type& t)
 	{
@@ -203,7 +247,7 @@ public:
 	
 	iterator erase(iterator pos)
 	{
-		iterator next_permutation = pos;
+		iterator next = pos;
 		++next;
 		difference_type index = pos - start;
 		if (index < (size() >> 1)) {  /* direction: left -> pos */
@@ -234,6 +278,22 @@ public:
 		}
 	}
 	iterator insert_aux(iterator pos, const value_type& x);
+
+	/*
+	 * bulk versions of push_back/push_front/pop_front: the map and the
+	 * buffers are reserved once, then the elements are copied one buffer
+	 * at a time, which uninitialized_copy turns into a memmove for trivial
+	 * types. input iterators can't be counted and go element by element.
+	 */
+	template <typename InputIterator>
+	void append(InputIterator first, InputIterator last)
+	{ append_aux(first, last, iterator_category(first)); }
+
+	template <typename InputIterator>
+	void prepend(InputIterator first, InputIterator last)
+	{ prepend_aux(first, last, iterator_category(first)); }
+
+	void pop_front_n(size_type n);
 protected:
 	typedef pointer* map_pointer;
 protected:
@@ -241,19 +301,98 @@ protected:
 	iterator finish;
 	map_pointer map;
 	size_type map_size;
+	pointer spare;  /* the last buffer given back, handed out again first */
 	
 	typedef simple_alloc<value_type, Alloc> data_allocator;
 	typedef simple_alloc<pointer, Alloc> map_allocator;
 	
-	fill_initialize(size_type n, const value_type& value);
+	static size_type buffer_size() { return iterator::buffer_size(); }
+	static size_type initial_map_size() { return 8; }
+
+	/*
+	 * a queue that pushes at one end and pops at the other frees and
+	 * needs a buffer at the same rate, so the freed one is kept for the
+	 * next allocation.
+	 */
+	pointer allocate_node()
+	{
+		if (spare) {
+			pointer n = spare;
+			spare = 0;
+			return n;
+		}
+		return data_allocator::allocate(buffer_size());
+	}
+
+	void deallocate_node(pointer n)
+	{
+		if (spare)
+			data_allocator::deallocate(spare, buffer_size());
+		spare = n;
+	}
+
+	/* free what clear() leaves: the start buffer, the spare and the map */
+	void destroy_map_and_nodes()
+	{
+		data_allocator::deallocate(start.first, buffer_size());
+		if (spare)
+			data_allocator::deallocate(spare, buffer_size());
+		map_allocator::deallocate(map, map_size);
+	}
+
+	void fill_initialize(size_type n, const value_type& value);
 	
-	create_map_and_nodes(size_type num_element);
+	void create_map_and_nodes(size_type num_element);
 	
-	push_back_aux(const value_type& t);
-	push_front_aux(const value_type& t);
+	void push_back_aux(const value_type& t);
+	void push_front_aux(const value_type& t);
 	
-	reallocate_map(size_type nodes_to_add, bool add_at_front);
+	void reallocate_map(size_type nodes_to_add, bool add_at_front);
 	
+	template <typename InputIterator>
+	void append_aux(InputIterator first, InputIterator last, input_iterator_tag)
+	{
+		for (; first != last; ++first)
+			push_back(*first);
+	}
+
+	template <typename InputIterator>
+	void prepend_aux(InputIterator first, InputIterator last, input_iterator_tag)
+	{
+		deque tmp;
+		tmp.append(first, last);
+		prepend(tmp.begin(), tmp.end());
+	}
+
+	template <typename ForwardIterator>
+	void append_aux(ForwardIterator first, ForwardIterator last,
+	                forward_iterator_tag);
+	template <typename ForwardIterator>
+	void prepend_aux(ForwardIterator first, ForwardIterator last,
+	                 forward_iterator_tag);
+	template <typename ForwardIterator>
+	void copy_segments(ForwardIterator first, iterator dest, size_type n);
+
+	/* make room for n more elements, the returned iterator is the new end */
+	iterator reserve_elements_at_back(size_type n)
+	{
+		size_type vacancies = (finish.last - finish.cur) - 1;
+		if (n > vacancies)
+			new_elements_at_back(n - vacancies);
+		return finish + difference_type(n);
+	}
+
+	iterator reserve_elements_at_front(size_type n)
+	{
+		size_type vacancies = start.cur - start.first;
+		if (n > vacancies)
+			new_elements_at_front(n - vacancies);
+		return start - difference_type(n);
+	}
+
+	void new_elements_at_back(size_type new_elements);
+	void new_elements_at_front(size_type new_elements);
+
 	void reserve_map_at_back(size_type nodes_to_add = 1)
 	{
 		if (nodes_to_add + 1 > map_size - (finish.node - map))
@@ -276,9 +415,12 @@ void deque<T, Alloc, BufSize>::fill_initialize(size_type n, const value_type& va
 		for (cur = start.node; cur < finish.node; ++cur)
 			uninitialized_fill(*cur, *cur + buffer_size(), value);
 		uninitialized_fill(finish.first, finish.cur, value);
-	} catch (/* ... */) {
-		
 	}
+	__STL_UNWIND(for (map_pointer n = start.node; n < cur; ++n)
+	                 destroy(*n, *n + buffer_size());
+	             for (cur = start.node; cur <= finish.node; ++cur)
+	                 data_allocator::deallocate(*cur, buffer_size());
+	             map_allocator::deallocate(map, map_size));
 }
 
 template <typename T, typename Alloc, size_t BufSize>
@@ -295,14 +437,15 @@ void deque<T, Alloc, BufSize>::create_map_and_nodes(size_type num_element)
 	map_pointer cur;
 	__STL_TRY {
 		for (cur = nstart; cur <= nfinish; ++cur)
-			*cur = data_allocator::allocate(buffer_size());
-	} catch (/* ... */) {
-		// commit or rollback
+			*cur = allocate_node();
 	}
+	__STL_UNWIND(for (map_pointer n = nstart; n < cur; ++n)
+	                 data_allocator::deallocate(*n, buffer_size());
+	             map_allocator::deallocate(map, map_size));
 	
 	start.set_node(nstart);
 	finish.set_node(nfinish);
-	start.cur = star.finish;
+	start.cur = start.first;
 	finish.cur = finish.first + num_element % buffer_size();
 }
 
@@ -311,7 +454,7 @@ void deque<T, Alloc, BufSize>::push_back_aux(const value_type& t)
 {
 	value_type t_copy = t;
 	reserve_map_at_back();  // use new map if need
-	*(finish.node + 1) = data_allocator::allocate(buffer_size());
+	*(finish.node + 1) = allocate_node();
 	__STL_TRY {
 		construct(finish.cur, t_copy);
 		finish.set_node(finish.node + 1);
@@ -325,17 +468,15 @@ void deque<T, Alloc, BufSize>::push_front_aux(const value_type& t)
 {
 	value_type t_copy = t;
 	reserve_map_at_front();
-	*(start.node - 1) = data_allocator::allocate(buffer_size());
+	*(start.node - 1) = allocate_node();
 	__STL_TRY {
 		start.set_node(start.node - 1);
 		start.cur = start.last - 1;
 		construct(start.cur, t_copy);
-	} catch (/* ... */) {
-		start.set_node(start.node + 1);
-		start.cur = start.first;
-		deallocate_node(*(start.node - 1));
-		throw;
 	}
+	__STL_UNWIND(start.set_node(start.node + 1);
+	             start.cur = start.first;
+	             deallocate_node(*(start.node - 1)));
 }
 
 template <typename T, typename Alloc, size_t BufSize>
@@ -345,10 +486,18 @@ void deque<T, Alloc, BufSize>::reallocate_map(size_type nodes_to_add,
 	size_type old_num_nodes = finish.node - start.node + 1;
 	size_type new_num_nodes = old_num_nodes + nodes_to_add;
 	
+	/*
+	 * the side that ran out gets three quarters of the free slots, so a
+	 * deque used as a fifo, which drifts one way, slides its map only
+	 * after using up most of them rather than half. the map grows only
+	 * when more than half full, at least doubling, so sliding and growing
+	 * both cost amortized O(1) per buffer.
+	 */
 	map_pointer new_nstart;
 	if (map_size > 2 * new_num_nodes) {
-		new_nstart = map + (map_size - new_num_nodes) / 2
-				+ (add_at_front ? nodes_to_add : 0);
+		size_type slack = map_size - new_num_nodes;
+		new_nstart = map + (add_at_front ? slack - slack / 4 + nodes_to_add
+		                                 : slack / 4);
 		if (new_nstart < start.node)
 			copy(start.node, finish.node + 1, new_nstart);
 		else
@@ -356,8 +505,9 @@ void deque<T, Alloc, BufSize>::reallocate_map(size_type nodes_to_add,
 	} else {
 		size_type new_map_size = map_size + max(map_size, nodes_to_add) + 2;
 		map_pointer new_map = map_allocator::allocate(new_map_size);
-		new_nstart = new_map + (new_map_size - new_num_nodes) / 2
-				+ (add_at_front ? nodes_to_add : 0);
+		size_type slack = new_map_size - new_num_nodes;
+		new_nstart = new_map + (add_at_front ? slack - slack / 4 + nodes_to_add
+		                                     : slack / 4);
 		copy(start.node, finish.node + 1, new_nstart);
 		map_allocator::deallocate(map, map_size);
 		map = new_map;
@@ -371,10 +521,10 @@ void deque<T, Alloc, BufSize>::reallocate_map(size_type nodes_to_add,
 template <typename T, typename Alloc, size_t BufSize>
 void deque<T, Alloc, BufSize>::pop_back_aux()
 {
-	destroy(finish.cur);
 	deallocate_node(finish.first);
 	finish.set_node(finish.node - 1);
 	finish.cur = finish.last - 1;
+	destroy(finish.cur);  /* the last element is in the buffer before */
 }
 
 template <typename T, typename Alloc, size_t BufSize>
@@ -386,21 +536,124 @@ void deque<T, Alloc, BufSize>::pop_front_aux()
 	start.cur = start.first;
 }
 
+template <typename T, typename Alloc, size_t BufSize>
+void deque<T, Alloc, BufSize>::new_elements_at_back(size_type new_elements)
+{
+	size_type new_nodes = (new_elements + buffer_size() - 1) / buffer_size();
+	reserve_map_at_back(new_nodes);
+	size_type i;
+	__STL_TRY {
+		for (i = 1; i <= new_nodes; ++i)
+			*(finish.node + i) = allocate_node();
+	}
+	__STL_UNWIND(for (size_type j = 1; j < i; ++j)
+	                 deallocate_node(*(finish.node + j)));
+}
+
+template <typename T, typename Alloc, size_t BufSize>
+void deque<T, Alloc, BufSize>::new_elements_at_front(size_type new_elements)
+{
+	size_type new_nodes = (new_elements + buffer_size() - 1) / buffer_size();
+	reserve_map_at_front(new_nodes);
+	size_type i;
+	__STL_TRY {
+		for (i = 1; i <= new_nodes; ++i)
+			*(start.node - i) = allocate_node();
+	}
+	__STL_UNWIND(for (size_type j = 1; j < i; ++j)
+	                 deallocate_node(*(start.node - j)));
+}
+
+/* copy n elements to the raw space at dest, one buffer per call */
+template <typename T, typename Alloc, size_t BufSize>
+template <typename ForwardIterator>
+void deque<T, Alloc, BufSize>::copy_segments(ForwardIterator first,
+                                             iterator dest, size_type n)
+{
+	iterator cur = dest;
+	__STL_TRY {
+		while (n > 0) {
+			size_type len = cur.last - cur.cur;
+			if (len > n)
+				len = n;
+			ForwardIterator mid = first;
+			advance(mid, difference_type(len));
+			uninitialized_copy(first, mid, cur.cur);
+			cur += difference_type(len);
+			first = mid;
+			n -= len;
+		}
+	}
+	__STL_UNWIND(for (; dest != cur; ++dest) destroy(dest.cur));
+}
+
+template <typename T, typename Alloc, size_t BufSize>
+template <typename ForwardIterator>
+void deque<T, Alloc, BufSize>::append_aux(ForwardIterator first,
+                                          ForwardIterator last,
+                                          forward_iterator_tag)
+{
+	size_type n = 0;
+	distance(first, last, n);
+	iterator new_finish = reserve_elements_at_back(n);
+	__STL_TRY {
+		copy_segments(first, finish, n);
+	}
+	__STL_UNWIND(for (map_pointer cur = new_finish.node; cur > finish.node; --cur)
+	                 deallocate_node(*cur));
+	finish = new_finish;
+}
+
+template <typename T, typename Alloc, size_t BufSize>
+template <typename ForwardIterator>
+void deque<T, Alloc, BufSize>::prepend_aux(ForwardIterator first,
+                                           ForwardIterator last,
+                                           forward_iterator_tag)
+{
+	size_type n = 0;
+	distance(first, last, n);
+	iterator new_start = reserve_elements_at_front(n);
+	__STL_TRY {
+		copy_segments(first, new_start, n);
+	}
+	__STL_UNWIND(for (map_pointer cur = new_start.node; cur < start.node; ++cur)
+	                 deallocate_node(*cur));
+	start = new_start;
+}
+
+/* drop the first n elements, releasing every buffer they emptied */
+template <typename T, typename Alloc, size_t BufSize>
+void deque<T, Alloc, BufSize>::pop_front_n(size_type n)
+{
+	if (n >= size()) {
+		clear();
+		return;
+	}
+	iterator new_start = start + difference_type(n);
+	for (map_pointer cur = start.node; cur < new_start.node; ++cur) {
+		destroy(cur == start.node ? start.cur : *cur, *cur + buffer_size());
+		deallocate_node(*cur);
+	}
+	destroy(new_start.node == start.node ? start.cur : new_start.first,
+	        new_start.cur);
+	start = new_start;
+}
+
 template <typename T, typename Alloc, size_t BufSize>
 void deque<T, Alloc, BufSize>::clear()
 {
 	for (map_pointer node = start.node + 1; node < finish.node; ++node) {
 		destroy(*node, *node + buffer_size());
-		data_allocator::deallocate(*node, buffer_size());
+		deallocate_node(*node);
 	}
 	if (start.node != finish.node) {
 		destroy(start.cur, start.last);
 		destroy(finish.first, finish.cur);
-		data_allocator::deallocate(finish.first, buffer_size());
+		deallocate_node(finish.first);
 	} else {
 		destroy(start.cur, finish.cur);
-		finish = start;
 	}
+	finish = start;
 }
 
 template <typename T, typename Alloc, size_t BufSize>
@@ -418,14 +671,14 @@ deque<T, Alloc, BufSize>::erase(iterator first, iterator last)
 			iterator new_start = start + n;
 			destroy(start, new_start);
 			for (map_pointer cur = start.node; cur < new_start.node; ++cur)
-				data_allocator::deallocate(*cur, buffer_size());
+				deallocate_node(*cur);
 			start = new_start;
 		} else {
 			copy(last, finish, first);
 			iterator new_finish = finish - n;
 			destroy(new_finish, finish);
 			for (map_pointer cur = new_finish.node + 1; cur <= finish.node; ++cur)
-				data_allocator::deallocate(*cur, buffer_size());
+				deallocate_node(*cur);
 			finish = new_finish;
 		}
 		return start + elems_before;
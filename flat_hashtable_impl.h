@@ -0,0 +1,475 @@
+#ifndef _FLAT_HASHTABLE_IMPL_H_
+#define _FLAT_HASHTABLE_IMPL_H_
+
+/*
+ * open addressing hashtable: one control byte per slot plus the values
+ * stored inline in a flat array, no per element node.
+ * control byte: full slot keeps the low 7 bits of hash (h2), the others
+ * use the sign bit so that "not full" is a single compare.
+ */
+typedef signed char __flat_ctrl_t;
+const __flat_ctrl_t __flat_empty = -128;   /* 0b10000000 */
+const __flat_ctrl_t __flat_deleted = -2;   /* 0b11111110 */
+const __flat_ctrl_t __flat_sentinel = -1;  /* 0b11111111, stop iterator */
+
+/*
+ * a group is matched with one vector compare + movemask when the target
+ * has AVX2 (32 bytes) or SSE2 (16 bytes), byte by byte otherwise.
+ */
+#if defined(__AVX2__)
+#include <immintrin.h>
+#define __STL_FLAT_GROUP_AVX2
+const size_t __flat_group_width = 32;
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#define __STL_FLAT_GROUP_SSE2
+const size_t __flat_group_width = 16;
+#else
+const size_t __flat_group_width = 16;
+#endif
+
+inline int __flat_ctz(unsigned mask)
+{
+#ifdef __GNUC__
+	return __builtin_ctz(mask);
+#else
+	int n = 0;
+	while (!(mask & 1)) {
+		mask >>= 1;
+		++n;
+	}
+	return n;
+#endif
+}
+
+/* bits of hash are mixed so that weak hashers (eg. identity) spread well */
+inline size_t __flat_mix(size_t h)
+{
+	const size_t k = sizeof(size_t) == 8 ? size_t(0x9E3779B97F4A7C15ULL)
+	                                     : size_t(0x9E3779B9UL);
+	h *= k;
+	return h ^ (h >> (sizeof(size_t) * 4));
+}
+
+inline size_t __flat_h1(size_t h) { return h >> 7; }
+inline __flat_ctrl_t __flat_h2(size_t h) { return __flat_ctrl_t(h & 0x7f); }
+
+/* a group of __flat_group_width control bytes, each match returns a bitmask */
+#if defined(__STL_FLAT_GROUP_AVX2)
+struct __flat_group {
+	__m256i ctrl;
+
+	explicit __flat_group(const __flat_ctrl_t* p)
+		: ctrl(_mm256_loadu_si256((const __m256i*) p)) {}
+
+	unsigned match(__flat_ctrl_t h2) const
+	{ return _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_set1_epi8(h2), ctrl)); }
+
+	unsigned match_empty() const
+	{ return match(__flat_empty); }
+
+	unsigned match_empty_or_deleted() const
+	{
+		__m256i special = _mm256_set1_epi8(__flat_sentinel);
+		return _mm256_movemask_epi8(_mm256_cmpgt_epi8(special, ctrl));
+	}
+};
+#elif defined(__STL_FLAT_GROUP_SSE2)
+struct __flat_group {
+	__m128i ctrl;
+
+	explicit __flat_group(const __flat_ctrl_t* p)
+		: ctrl(_mm_loadu_si128((const __m128i*) p)) {}
+
+	unsigned match(__flat_ctrl_t h2) const
+	{ return _mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(h2), ctrl)); }
+
+	unsigned match_empty() const
+	{ return match(__flat_empty); }
+
+	unsigned match_empty_or_deleted() const
+	{
+		__m128i special = _mm_set1_epi8(__flat_sentinel);
+		return _mm_movemask_epi8(_mm_cmpgt_epi8(special, ctrl));
+	}
+};
+#else
+struct __flat_group {
+	const __flat_ctrl_t* ctrl;
+
+	explicit __flat_group(const __flat_ctrl_t* p) : ctrl(p) {}
+
+	unsigned match(__flat_ctrl_t h2) const
+	{
+		unsigned mask = 0;
+		for (size_t i = 0; i < __flat_group_width; ++i)
+			if (ctrl[i] == h2)
+				mask |= 1u << i;
+		return mask;
+	}
+
+	unsigned match_empty() const
+	{ return match(__flat_empty); }
+
+	unsigned match_empty_or_deleted() const
+	{
+		unsigned mask = 0;
+		for (size_t i = 0; i < __flat_group_width; ++i)
+			if (ctrl[i] < __flat_sentinel)
+				mask |= 1u << i;
+		return mask;
+	}
+};
+#endif
+
+template <typename Value, typename Key, typename HashFcn,
+		  typename ExtractKey, typename EqualKey, typename Alloc = alloc>
+class flat_hashtable;
+
+template <typename Value, typename Key, typename HashFcn,
+	      typename ExtractKey, typename EqualKey, typename Alloc>
+struct __flat_hashtable_iterator {
+	typedef __flat_hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey,
+			Alloc> iterator;
+	typedef forward_iterator_tag iterator_category;
+	typedef Value value_type;
+	typedef ptrdiff_t difference_type;
+	typedef size_t size_type;
+	typedef Value& reference;
+	typedef Value* pointer;
+
+	const __flat_ctrl_t* ctrl;
+	Value* slot;
+
+	__flat_hashtable_iterator(const __flat_ctrl_t* c, Value* s)
+		: ctrl(c), slot(s) {}
+	__flat_hashtable_iterator() {}
+	reference operator*() const { return *slot; }
+	pointer operator->() const { return &(operator*()); }
+
+	/* move to the next full slot, the sentinel stops the scan */
+	void skip_empty_or_deleted()
+	{
+		while (*ctrl < __flat_sentinel) {
+			++ctrl;
+			++slot;
+		}
+	}
+
+	iterator& operator++()
+	{
+		++ctrl;
+		++slot;
+		skip_empty_or_deleted();
+		return *this;
+	}
+
+	iterator operator++(int)
+	{
+		iterator tmp = *this;
+		++*this;
+		return tmp;
+	}
+
+	bool operator==(const iterator& it) const { return slot == it.slot; }
+	bool operator!=(const iterator& it) const { return slot != it.slot; }
+};
+
+template <typename Value, typename Key, typename HashFcn,
+		  typename ExtractKey, typename EqualKey, typename Alloc>
+class flat_hashtable {
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef HashFcn hasher;
+	typedef EqualKey key_equal;
+	typedef size_t size_type;
+	typedef __flat_hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey,
+			Alloc> iterator;
+private:
+	hasher hash;
+	key_equal equals;
+	ExtractKey get_key;
+
+	typedef simple_alloc<__flat_ctrl_t, Alloc> ctrl_allocator;
+	typedef simple_alloc<value_type, Alloc> slot_allocator;
+
+	__flat_ctrl_t* ctrl;   /* capacity + 1 bytes, the last is sentinel */
+	value_type* slots;
+	size_type capacity;    /* power of 2, multiple of group width */
+	size_type num_elements;
+	size_type growth_left; /* empty slots usable before max load 7/8 */
+
+	static size_type next_capacity(size_type n)
+	{
+		size_type cap = __flat_group_width;
+		while (cap - cap / 8 < n)
+			cap <<= 1;
+		return cap;
+	}
+
+	size_type hash_of(const key_type& key) const
+	{ return __flat_mix(hash(key)); }
+
+	size_type group_mask() const
+	{ return capacity / __flat_group_width - 1; }
+
+	void allocate_slots(size_type n);
+	void initialize_slots(size_type n) { allocate_slots(next_capacity(n)); }
+	void deallocate_slots();
+	void rehash(size_type new_capacity);
+	size_type find_first_non_full(size_type h) const;
+	void set_ctrl(size_type i, __flat_ctrl_t c) { ctrl[i] = c; }
+
+	size_type find_index(const key_type& key, size_type h) const;
+
+public:
+	flat_hashtable(size_type n, const HashFcn& hf, const EqualKey& eql)
+		: hash(hf), equals(eql), get_key(ExtractKey()), num_elements(0)
+	{ initialize_slots(n); }
+
+	flat_hashtable(const flat_hashtable& ht)
+		: hash(ht.hash), equals(ht.equals), get_key(ht.get_key),
+		  num_elements(0)
+	{
+		initialize_slots(ht.num_elements);
+		__STL_TRY {
+			copy_from(ht);
+		}
+		__STL_UNWIND(deallocate_slots());
+	}
+
+	flat_hashtable& operator=(const flat_hashtable& ht)
+	{
+		if (&ht != this) {
+			clear();
+			hash = ht.hash;
+			equals = ht.equals;
+			get_key = ht.get_key;
+			copy_from(ht);
+		}
+		return *this;
+	}
+
+	~flat_hashtable()
+	{
+		clear();
+		deallocate_slots();
+	}
+
+	size_type size() const { return num_elements; }
+	bool empty() const { return num_elements == 0; }
+	size_type bucket_count() const { return capacity; }
+
+	iterator begin()
+	{
+		iterator it(ctrl, slots);
+		it.skip_empty_or_deleted();
+		return it;
+	}
+	iterator end() { return iterator(ctrl + capacity, slots + capacity); }
+
+	/* make room for n elements without rehash */
+	void resize(size_type num_elements_hint)
+	{
+		size_type n = next_capacity(num_elements_hint);
+		if (n > capacity)
+			rehash(n);
+	}
+
+	pair<iterator, bool> insert_unique(const value_type& obj);
+
+	iterator find(const key_type& key)
+	{
+		size_type i = find_index(key, hash_of(key));
+		return i == capacity ? end() : iterator(ctrl + i, slots + i);
+	}
+
+	size_type count(const key_type& key) const
+	{ return find_index(key, hash_of(key)) != capacity ? 1 : 0; }
+
+	void erase(iterator it);
+	size_type erase(const key_type& key)
+	{
+		size_type i = find_index(key, hash_of(key));
+		if (i == capacity)
+			return 0;
+		erase(iterator(ctrl + i, slots + i));
+		return 1;
+	}
+
+	void clear();
+	void copy_from(const flat_hashtable& ht);
+};
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+void flat_hashtable<V, K, HF, Ex, Eq, A>::allocate_slots(size_type n)
+{
+	/* nothing changes unless both arrays are there */
+	__flat_ctrl_t* c = ctrl_allocator::allocate(n + 1);
+	value_type* s;
+	__STL_TRY {
+		s = slot_allocator::allocate(n);
+	}
+	__STL_UNWIND(ctrl_allocator::deallocate(c, n + 1));
+	memset(c, __flat_empty, n);
+	c[n] = __flat_sentinel;
+	ctrl = c;
+	slots = s;
+	capacity = n;
+	growth_left = capacity - capacity / 8;
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+void flat_hashtable<V, K, HF, Ex, Eq, A>::deallocate_slots()
+{
+	slot_allocator::deallocate(slots, capacity);
+	ctrl_allocator::deallocate(ctrl, capacity + 1);
+}
+
+/*
+ * probe sequence visits whole groups: g, g+1, g+3, g+6 ... (mod groups),
+ * a group with an empty slot ends the sequence.
+ */
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+typename flat_hashtable<V, K, HF, Ex, Eq, A>::size_type
+flat_hashtable<V, K, HF, Ex, Eq, A>::find_index(const key_type& key,
+                                                size_type h) const
+{
+	const size_type mask = group_mask();
+	const __flat_ctrl_t h2 = __flat_h2(h);
+	size_type g = __flat_h1(h) & mask;
+
+	for (size_type step = 1; ; ++step) {
+		const size_type base = g * __flat_group_width;
+		__flat_group group(ctrl + base);
+		for (unsigned m = group.match(h2); m; m &= m - 1) {
+			size_type i = base + __flat_ctz(m);
+			if (equals(get_key(slots[i]), key))
+				return i;
+		}
+		if (group.match_empty() || step > mask)
+			return capacity;
+		g = (g + step) & mask;
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+typename flat_hashtable<V, K, HF, Ex, Eq, A>::size_type
+flat_hashtable<V, K, HF, Ex, Eq, A>::find_first_non_full(size_type h) const
+{
+	const size_type mask = group_mask();
+	size_type g = __flat_h1(h) & mask;
+
+	for (size_type step = 1; ; ++step) {
+		const size_type base = g * __flat_group_width;
+		unsigned m = __flat_group(ctrl + base).match_empty_or_deleted();
+		if (m)
+			return base + __flat_ctz(m);
+		g = (g + step) & mask;
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+pair<typename flat_hashtable<V, K, HF, Ex, Eq, A>::iterator, bool>
+flat_hashtable<V, K, HF, Ex, Eq, A>::insert_unique(const value_type& obj)
+{
+	const size_type h = hash_of(get_key(obj));
+	size_type i = find_index(get_key(obj), h);
+	if (i != capacity)
+		return pair<iterator, bool>(iterator(ctrl + i, slots + i), false);
+
+	i = find_first_non_full(h);
+	if (growth_left == 0 && ctrl[i] != __flat_deleted) {
+		/* drop tombstones when they are the most of load, grow otherwise */
+		rehash(num_elements * 2 < capacity - capacity / 8 ?
+		       capacity : capacity * 2);
+		i = find_first_non_full(h);
+	}
+	construct(&slots[i], obj);
+	if (ctrl[i] == __flat_empty)
+		--growth_left;
+	set_ctrl(i, __flat_h2(h));
+	++num_elements;
+	return pair<iterator, bool>(iterator(ctrl + i, slots + i), true);
+}
+
+/*
+ * a slot can go back to empty only if its group still has an empty slot,
+ * then no probe sequence has ever walked through the group.
+ */
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+void flat_hashtable<V, K, HF, Ex, Eq, A>::erase(iterator it)
+{
+	const size_type i = it.slot - slots;
+	const size_type base = i & ~(__flat_group_width - 1);
+	destroy(it.slot);
+	--num_elements;
+	if (__flat_group(ctrl + base).match_empty()) {
+		set_ctrl(i, __flat_empty);
+		++growth_left;
+	} else {
+		set_ctrl(i, __flat_deleted);
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+void flat_hashtable<V, K, HF, Ex, Eq, A>::rehash(size_type new_capacity)
+{
+	__flat_ctrl_t* old_ctrl = ctrl;
+	value_type* old_slots = slots;
+	const size_type old_capacity = capacity;
+	const size_type old_growth_left = growth_left;
+	const size_type old_num_elements = num_elements;
+
+	/* copy them all before destroying any: a copy that throws leaves the old table */
+	allocate_slots(new_capacity);
+	__STL_TRY {
+		for (size_type j = 0; j < old_capacity; ++j) {
+			if (old_ctrl[j] >= 0) {
+				const size_type h = hash_of(get_key(old_slots[j]));
+				const size_type i = find_first_non_full(h);
+				construct(&slots[i], old_slots[j]);
+				set_ctrl(i, __flat_h2(h));
+				--growth_left;
+			}
+		}
+	}
+	__STL_UNWIND(clear();
+	             deallocate_slots();
+	             ctrl = old_ctrl;
+	             slots = old_slots;
+	             capacity = old_capacity;
+	             growth_left = old_growth_left;
+	             num_elements = old_num_elements);
+	for (size_type j = 0; j < old_capacity; ++j)
+		if (old_ctrl[j] >= 0)
+			destroy(&old_slots[j]);
+	slot_allocator::deallocate(old_slots, old_capacity);
+	ctrl_allocator::deallocate(old_ctrl, old_capacity + 1);
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+void flat_hashtable<V, K, HF, Ex, Eq, A>::clear()
+{
+	for (size_type i = 0; i < capacity; ++i)
+		if (ctrl[i] >= 0)
+			destroy(&slots[i]);
+	memset(ctrl, __flat_empty, capacity);
+	num_elements = 0;
+	growth_left = capacity - capacity / 8;
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
+void flat_hashtable<V, K, HF, Ex, Eq, A>::copy_from(const flat_hashtable& ht)
+{
+	resize(ht.num_elements);
+	__STL_TRY {
+		for (size_type i = 0; i < ht.capacity; ++i)
+			if (ht.ctrl[i] >= 0)
+				insert_unique(ht.slots[i]);
+	}
+	__STL_UNWIND(clear());
+}
+
+#endif
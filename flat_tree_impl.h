@@ -0,0 +1,348 @@
+#ifndef _FLAT_TREE_IMPL_H_
+#define _FLAT_TREE_IMPL_H_
+
+/*
+ * ordered container with the parameters of rb_tree, keeping the values
+ * sorted in one array. lookups are a binary search over contiguous
+ * memory, single inserts and erases shift the tail, so it suits tables
+ * that are read much and changed in batches: a batch is sorted on its own
+ * and merged with the array in one pass.
+ */
+template <typename Key, typename Value, typename KeyOfValue, typename Compare,
+		  typename Alloc = alloc>
+class flat_tree {
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef value_type* pointer;
+	typedef const value_type* const_pointer;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
+	typedef value_type* iterator;
+	typedef const value_type* const_iterator;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+protected:
+	typedef simple_alloc<value_type, Alloc> data_allocator;
+	typedef simple_alloc<const value_type*, Alloc> pointer_allocator;
+
+	iterator start;
+	iterator finish;
+	iterator end_of_storage;
+	Compare key_compare;
+
+	static const Key& key(const value_type& v) { return KeyOfValue() (v); }
+
+	bool less(const value_type* x, const value_type* y) const
+	{ return key_compare(key(*x), key(*y)); }
+
+	void deallocate()
+	{
+		if (start)
+			data_allocator::deallocate(start, end_of_storage - start);
+	}
+
+	void destroy_all()
+	{
+		for (iterator i = start; i != finish; ++i)
+			destroy(i);
+	}
+
+	void insert_aux(iterator position, const value_type& x);
+	void sort_pointers(const value_type** first, const value_type** buf,
+	                   size_type n) const;
+	template <typename InputIterator>
+	void insert_batch(InputIterator first, InputIterator last, bool unique);
+
+public:
+	flat_tree(const Compare& comp = Compare())
+		: start(0), finish(0), end_of_storage(0), key_compare(comp) {}
+
+	flat_tree(const flat_tree& x)
+		: start(0), finish(0), end_of_storage(0), key_compare(x.key_compare)
+	{
+		start = data_allocator::allocate(x.size());
+		__STL_TRY {
+			finish = uninitialized_copy(x.start, x.finish, start);
+		}
+		__STL_UNWIND(data_allocator::deallocate(start, x.size()));
+		end_of_storage = finish;
+	}
+
+	~flat_tree()
+	{
+		destroy_all();
+		deallocate();
+	}
+
+	flat_tree& operator=(const flat_tree& x)
+	{
+		if (this != &x) {
+			flat_tree tmp(x);
+			swap(tmp);
+		}
+		return *this;
+	}
+
+	void swap(flat_tree& x)
+	{
+		iterator t;
+		t = start; start = x.start; x.start = t;
+		t = finish; finish = x.finish; x.finish = t;
+		t = end_of_storage; end_of_storage = x.end_of_storage; x.end_of_storage = t;
+		Compare c = key_compare; key_compare = x.key_compare; x.key_compare = c;
+	}
+
+	Compare key_comp() const { return key_compare; }
+	iterator begin() { return start; }
+	const_iterator begin() const { return start; }
+	iterator end() { return finish; }
+	const_iterator end() const { return finish; }
+	bool empty() const { return start == finish; }
+	size_type size() const { return size_type(finish - start); }
+	size_type max_size() const { return size_type(-1) / sizeof(value_type); }
+	size_type capacity() const { return size_type(end_of_storage - start); }
+	const_reference operator[](size_type n) const { return start[n]; }
+
+	void reserve(size_type n);
+
+	void clear()
+	{
+		destroy_all();
+		finish = start;
+	}
+
+	/*
+	 * the searches keep the candidate range in [base, base + n] and halve
+	 * n with a select instead of a branch, so the loop runs the same
+	 * log2(n) steps whatever the keys are.
+	 */
+	const_iterator lower_bound(const key_type& k) const
+	{
+		const_iterator base = start;
+		size_type n = size();
+		if (n == 0)
+			return base;
+		while (n > 1) {
+			size_type half = n / 2;
+			base = key_compare(key(base[half]), k) ? base + half : base;
+			n -= half;
+		}
+		return base + key_compare(key(*base), k);
+	}
+
+	const_iterator upper_bound(const key_type& k) const
+	{
+		const_iterator base = start;
+		size_type n = size();
+		if (n == 0)
+			return base;
+		while (n > 1) {
+			size_type half = n / 2;
+			base = key_compare(k, key(base[half])) ? base : base + half;
+			n -= half;
+		}
+		return base + !key_compare(k, key(*base));
+	}
+
+	iterator lower_bound(const key_type& k)
+	{ return start + (static_cast<const flat_tree&>(*this).lower_bound(k) - start); }
+	iterator upper_bound(const key_type& k)
+	{ return start + (static_cast<const flat_tree&>(*this).upper_bound(k) - start); }
+
+	const_iterator find(const key_type& k) const
+	{
+		const_iterator j = lower_bound(k);
+		return (j == finish || key_compare(k, key(*j))) ? finish : j;
+	}
+
+	iterator find(const key_type& k)
+	{ return start + (static_cast<const flat_tree&>(*this).find(k) - start); }
+
+	size_type count(const key_type& k) const
+	{ return size_type(upper_bound(k) - lower_bound(k)); }
+
+	pair<iterator, iterator> equal_range(const key_type& k)
+	{ return pair<iterator, iterator>(lower_bound(k), upper_bound(k)); }
+
+	pair<iterator, bool> insert_unique(const value_type& v)
+	{
+		iterator j = lower_bound(key(v));
+		if (j != finish && !key_compare(key(v), key(*j)))
+			return pair<iterator, bool>(j, false);
+		difference_type n = j - start;
+		insert_aux(j, v);
+		return pair<iterator, bool>(start + n, true);
+	}
+
+	iterator insert_equal(const value_type& v)
+	{
+		iterator j = upper_bound(key(v));
+		difference_type n = j - start;
+		insert_aux(j, v);
+		return start + n;
+	}
+
+	/* batches: O(m log m + n) for m new values, sorted or not */
+	template <typename InputIterator>
+	void insert_unique(InputIterator first, InputIterator last)
+	{ insert_batch(first, last, true); }
+
+	template <typename InputIterator>
+	void insert_equal(InputIterator first, InputIterator last)
+	{ insert_batch(first, last, false); }
+
+	iterator erase(iterator first, iterator last)
+	{
+		iterator i = first;
+		for (iterator j = last; j != finish; ++i, ++j)
+			*i = *j;
+		for (iterator j = i; j != finish; ++j)
+			destroy(j);
+		finish = i;
+		return first;
+	}
+
+	iterator erase(iterator position) { return erase(position, position + 1); }
+
+	size_type erase(const key_type& k)
+	{
+		iterator first = lower_bound(k);
+		iterator last = upper_bound(k);
+		size_type n = size_type(last - first);
+		erase(first, last);
+		return n;
+	}
+};
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void flat_tree<Key, Value, KeyOfValue, Compare, Alloc>::reserve(size_type n)
+{
+	if (capacity() >= n)
+		return;
+	iterator new_start = data_allocator::allocate(n);
+	iterator new_finish = new_start;
+	__STL_TRY {
+		new_finish = uninitialized_copy(start, finish, new_start);
+	}
+	__STL_UNWIND(data_allocator::deallocate(new_start, n));
+	destroy_all();
+	deallocate();
+	start = new_start;
+	finish = new_finish;
+	end_of_storage = new_start + n;
+}
+
+/* put x at position, moving the tail one place up */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void flat_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	insert_aux(iterator position, const value_type& x)
+{
+	if (finish == end_of_storage) {
+		difference_type n = position - start;
+		size_type len = size() != 0 ? 2 * size() : 1;
+		value_type x_copy = x;  /* x may live in the old array */
+		reserve(len);
+		insert_aux(start + n, x_copy);
+		return;
+	}
+	if (position == finish) {
+		construct(finish, x);
+	} else {
+		value_type x_copy = x;
+		construct(finish, *(finish - 1));
+		for (iterator i = finish - 1; i != position; --i)
+			*i = *(i - 1);
+		*position = x_copy;
+	}
+	++finish;
+}
+
+/* stable bottom-up merge sort of n pointers by key, buf holds n more */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+void flat_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	sort_pointers(const value_type** first, const value_type** buf,
+	              size_type n) const
+{
+	const value_type** from = first;
+	const value_type** to = buf;
+	for (size_type width = 1; width < n; width *= 2) {
+		for (size_type lo = 0; lo < n; lo += 2 * width) {
+			size_type mid = lo + width < n ? lo + width : n;
+			size_type hi = lo + 2 * width < n ? lo + 2 * width : n;
+			size_type i = lo, j = mid, k = lo;
+			while (i < mid && j < hi)
+				to[k++] = less(from[j], from[i]) ? from[j++] : from[i++];
+			while (i < mid)
+				to[k++] = from[i++];
+			while (j < hi)
+				to[k++] = from[j++];
+		}
+		const value_type** t = from; from = to; to = t;
+	}
+	if (from != first)
+		for (size_type i = 0; i < n; ++i)
+			first[i] = from[i];
+}
+
+/*
+ * the batch is copied out, its pointers sorted, then both sequences are
+ * merged into a new array. the old one is only released at the end, so a
+ * throwing copy leaves the tree as it was.
+ */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+template <typename InputIterator>
+void flat_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	insert_batch(InputIterator first, InputIterator last, bool unique)
+{
+	flat_tree batch(key_compare);
+	for (; first != last; ++first)
+		batch.insert_aux(batch.finish, *first);
+	const size_type m = batch.size();
+	if (m == 0)
+		return;
+
+	const value_type** ptrs = pointer_allocator::allocate(2 * m);
+	for (size_type i = 0; i < m; ++i)
+		ptrs[i] = batch.start + i;
+
+	const size_type len = size() + m;
+	iterator new_start = 0;
+	iterator new_finish = 0;
+	__STL_TRY {
+		sort_pointers(ptrs, ptrs + m, m);
+		new_start = data_allocator::allocate(len);
+		new_finish = new_start;
+		const_iterator i = start;
+		size_type j = 0;
+		while (i != finish || j < m) {
+			const value_type* next;
+			if (j == m || (i != finish && !less(ptrs[j], i)))
+				next = i++;  /* equal keys: the old value first */
+			else
+				next = ptrs[j++];
+			if (unique && new_finish != new_start &&
+					!key_compare(key(*(new_finish - 1)), key(*next)))
+				continue;
+			construct(new_finish, *next);
+			++new_finish;
+		}
+	}
+	__STL_UNWIND(for (iterator p = new_start; p != new_finish; ++p) destroy(p);
+	             if (new_start)
+	                 data_allocator::deallocate(new_start, len);
+	             pointer_allocator::deallocate(ptrs, 2 * m));
+
+	pointer_allocator::deallocate(ptrs, 2 * m);
+	destroy_all();
+	deallocate();
+	start = new_start;
+	finish = new_finish;
+	end_of_storage = new_start + len;
+}
+
+#endif
@@ -1,25 +1,114 @@
 #ifndef _HASHTABLE_IMPL_H_
 #define _HASHTABLE_IMPL_H_
 
-template <typename Value>
+#ifdef __GNUC__
+#define __STL_PREFETCH(p) __builtin_prefetch(p)
+#else
+#define __STL_PREFETCH(p)
+#endif
+
+/* keys hashed and prefetched together by the bulk operations */
+const size_t __hashtable_batch = 16;
+
+/*
+ * bucket policy: next_size() picks the bucket count for n elements and
+ * bucket() maps a hash code to [0, n).
+ */
+static const int __stl_num_primes = 28;
+static const unsigned long __stl_prime_list[__stl_num_primes] = {
+	53ul,         97ul,         193ul,       389ul,       769ul,
+	1543ul,       3079ul,       6151ul,      12289ul,     24593ul,
+	49157ul,      98317ul,      196613ul,    393241ul,    786433ul,
+	1572869ul,    3145739ul,    6291469ul,   12582917ul,  25165843ul,
+	50331653ul,   100663319ul,  201326611ul, 402653189ul, 805306457ul,
+	1610612741ul, 3221225473ul, 4294967291ul
+};
+
+inline unsigned long __stl_next_prime(unsigned long n)
+{
+	const unsigned long* first = __stl_prime_list;
+	const unsigned long* last = __stl_prime_list + __stl_num_primes;
+	const unsigned long* pos = lower_bound(first, last, n);
+	return pos == last ? *(last - 1) : *pos;
+}
+
+/* prime bucket count and modulo, safe for weak hashers (default) */
+struct __hashtable_prime_policy {
+	static size_t next_size(size_t n) { return __stl_next_prime(n); }
+	static size_t bucket(size_t h, size_t n) { return h % n; }
+};
+
+/*
+ * power of 2 bucket count: fibonacci hashing spreads the hash code so the
+ * mask does not keep only its low bits, no division on any path.
+ */
+struct __hashtable_pow2_policy {
+	static size_t next_size(size_t n)
+	{
+		size_t result = 8;
+		while (result < n)
+			result <<= 1;
+		return result;
+	}
+	
+	static size_t bucket(size_t h, size_t n)
+	{
+		const size_t k = sizeof(size_t) == 8 ? size_t(0x9E3779B97F4A7C15ULL)
+		                                     : size_t(0x9E3779B9UL);
+		h *= k;
+		return (h ^ (h >> (sizeof(size_t) * 4))) & (n - 1);
+	}
+};
+
+/*
+ * specialize for a hasher which is expensive (eg. strings) to keep the full
+ * hash code in every node: rehash and iteration never call the hasher again
+ * and a lookup compares hash codes before calling EqualKey.
+ */
+template <typename HashFcn>
+struct __hashtable_traits {
+	typedef __false_type cache_hash_code;
+};
+
+/*
+ * lookups by another type than key_type (eg. a string view for string keys)
+ * are enabled when both HashFcn and EqualKey define is_transparent.
+ */
+template <typename HashFcn, typename EqualKey, typename Result,
+          typename = typename HashFcn::is_transparent,
+          typename = typename EqualKey::is_transparent>
+struct __hashtable_transparent {
+	typedef Result type;
+};
+
+template <typename Value, typename CacheHash = __false_type>
 struct __hashtable_node {
 	__hashtable_node* next;
 	Value val;
 };
 
+template <typename Value>
+struct __hashtable_node<Value, __true_type> {
+	__hashtable_node* next;
+	size_t hash_code;
+	Value val;
+};
+
 template <typename Value, typename Key, typename HashFcn,
-		  typename ExtractKey, typename EqualKey, typename Alloc = alloc>
+		  typename ExtractKey, typename EqualKey, typename Alloc = alloc,
+		  typename BucketPolicy = __hashtable_prime_policy>
 class hashtable;
 
 template <typename Value, typename Key, typename HashFcn,
-	      typename ExtractKey, typename EqualKey, typename Alloc>
+	      typename ExtractKey, typename EqualKey, typename Alloc,
+	      typename BucketPolicy>
 struct __hashtable_iterator {
-	typedef hashtable<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc> hashtable;
-	typedef __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>
-		iterator;
-	typedef __hashtable_const_iterator<Value, Key, HashFcn, ExtractKey, EqualKey,
-			Alloc> const_iterator;
-	typedef __hashtable_node<Value> node;
+	typedef hashtable<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc,
+			BucketPolicy> hashtable_type;
+	typedef __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc,
+			BucketPolicy> iterator;
+	typedef __hashtable_node<Value,
+			typename __hashtable_traits<HashFcn>::cache_hash_code> node;
 	typedef forward_iterator_tag iterator_category;
 	typedef Value value_type;
 	typedef ptrdiff_t difference_type;
@@ -28,9 +117,9 @@ struct __hashtable_iterator {
 	typedef Value* pointer;
 	
 	node* cur;
-	hashtable* ht;
+	hashtable_type* ht;
 	
-	__hashtable_iterator(node* n, hashtable* tab) : cur(n), ht(tab) {}
+	__hashtable_iterator(node* n, hashtable_type* tab) : cur(n), ht(tab) {}
 	__hashtable_iterator() {}
 	reference operator*() const { return cur->val; }
 	pointer operator->() const { return &(operator*()); }
@@ -43,24 +132,38 @@ struct __hashtable_iterator {
 };		  
 
 template <typename Value, typename Key, typename HashFcn,
-	      typename ExtractKey, typename EqualKey, typename Alloc>
-__hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>&
-__hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>::operator++()
+	      typename ExtractKey, typename EqualKey, typename Alloc,
+	      typename BucketPolicy>
+__hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc, BucketPolicy>&
+__hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc,
+		BucketPolicy>::operator++()
 {
 	const node* old = cur;
 	cur = cur->next;
 	if (!cur) {
-		size_type bucket = ht->bkt_num(old_val);
-		while (!cur && ++bucket < ht->buckets.size())
-			cur = ht->buckets[bucket];
+		/* during an incremental rehash, old buckets are walked after new ones */
+		const size_type old_n = ht->old_buckets.size();
+		size_type bucket;
+		if (old_n && (bucket = ht->node_bkt_num(old, old_n)) >= ht->rehash_pos) {
+			while (!cur && ++bucket < old_n)
+				cur = ht->old_buckets[bucket];
+		} else {
+			bucket = ht->node_bkt_num(old, ht->buckets.size());
+			while (!cur && ++bucket < ht->buckets.size())
+				cur = ht->buckets[bucket];
+			for (bucket = ht->rehash_pos; !cur && bucket < old_n; ++bucket)
+				cur = ht->old_buckets[bucket];
+		}
 	}
 	return *this;
 }
 
 template <typename Value, typename Key, typename HashFcn,
-	      typename ExtractKey, typename EqualKey, typename Alloc>
-inline __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>
-__hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>::operator++(int)
+	      typename ExtractKey, typename EqualKey, typename Alloc,
+	      typename BucketPolicy>
+inline __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc, BucketPolicy>
+__hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc,
+		BucketPolicy>::operator++(int)
 {
 	iterator tmp = *this;
 	++*this;
@@ -68,25 +171,45 @@ __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>::operator
 }
 
 template <typename Value, typename Key, typename HashFcn,
-		  typename ExtractKey, typename EqualKey, typename Alloc>
+		  typename ExtractKey, typename EqualKey, typename Alloc,
+		  typename BucketPolicy>
 class hashtable {
 public:
+	typedef Key key_type;
+	typedef Value value_type;
 	typedef HashFcn hasher;
 	typedef EqualKey key_equal;
 	typedef size_t size_type;
+	typedef __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc,
+			BucketPolicy> iterator;
+	
+	friend struct __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey,
+			Alloc, BucketPolicy>;
 private:
 	hasher hash;
 	key_equal equals;
 	ExtractKey get_key;
 	
-	typedef __hashtable_node<Value> node;
+	typedef typename __hashtable_traits<HashFcn>::cache_hash_code cache_hash_code;
+	typedef __hashtable_node<Value, cache_hash_code> node;
 	typedef simple_alloc<node, Alloc> node_allocator;
-	typedef __hashtable_iterator<Value, Key, HashFcn, ExtractKey, EqualKey, Alloc>
-			iterator;
 	
 	vector<node*, Alloc> buckets;
 	size_type num_elements;
 	
+	/*
+	 * incremental rehash: while old_buckets is not empty, buckets before
+	 * rehash_pos are already moved to buckets, the others still hold their
+	 * nodes. every insert moves rehash_step more of them, lookups move
+	 * nothing so that iterators stay valid across them.
+	 */
+	vector<node*, Alloc> old_buckets;
+	size_type rehash_pos;
+	size_type rehash_step;  /* 0: move all buckets at once */
+	
+	size_type next_size(size_type n) const
+	{ return BucketPolicy::next_size(n); }
+	
 	void initialize_buckets(size_type n)
 	{
 		const size_type n_buckets = next_size(n);
@@ -103,7 +226,7 @@ private:
 			construct(&n->val, obj);
 			return n;
 		}
-		__STL_UNWIND(node_allocator::deallocate(n));=
+		__STL_UNWIND(node_allocator::deallocate(n));
 	}
 	
 	void delete_node(node* n)
@@ -113,7 +236,87 @@ private:
 	}	
 	
 	void resize(size_type num_elements_hint);
-	pair<iterator, bool> insert_unique_noresize(const value_type& obj);
+	void migrate_buckets(size_type count);
+	void copy_buckets(vector<node*, Alloc>& dst, const vector<node*, Alloc>& src,
+	                  size_type first);
+	pair<iterator, bool> insert_unique_noresize(const value_type& obj, size_type h);
+	iterator insert_equal_noresize(const value_type& obj, size_type h);
+	
+	/* the bucket which holds hash code h, old or new during an incremental rehash */
+	node*& bucket_of_hash(size_type h)
+	{
+		if (!old_buckets.empty()) {
+			const size_type n = BucketPolicy::bucket(h, old_buckets.size());
+			if (n >= rehash_pos)
+				return old_buckets[n];
+		}
+		return buckets[BucketPolicy::bucket(h, buckets.size())];
+	}
+	
+	node* const& bucket_of_hash(size_type h) const
+	{
+		if (!old_buckets.empty()) {
+			const size_type n = BucketPolicy::bucket(h, old_buckets.size());
+			if (n >= rehash_pos)
+				return old_buckets[n];
+		}
+		return buckets[BucketPolicy::bucket(h, buckets.size())];
+	}
+	
+	size_type node_hash(const node* n, __true_type) const
+	{ return n->hash_code; }
+	size_type node_hash(const node* n, __false_type) const
+	{ return hash(get_key(n->val)); }
+	
+	size_type node_bkt_num(const node* n, size_type size) const
+	{ return BucketPolicy::bucket(node_hash(n, cache_hash_code()), size); }
+	
+	bool node_has_hash(const node* n, size_type h, __true_type) const
+	{ return n->hash_code == h; }
+	bool node_has_hash(const node*, size_type, __false_type) const
+	{ return true; }
+	
+	template <typename K>
+	bool node_equals(const node* n, const K& key, size_type h) const
+	{ return node_has_hash(n, h, cache_hash_code()) && equals(get_key(n->val), key); }
+	
+	void set_hash_code(node* n, size_type h, __true_type) { n->hash_code = h; }
+	void set_hash_code(node*, size_type, __false_type) {}
+	
+	/* touch the buckets, then the first nodes, of a window of hash codes */
+	void prefetch_buckets(const size_type* h, size_type n) const
+	{
+		for (size_type i = 0; i < n; ++i)
+			__STL_PREFETCH(&bucket_of_hash(h[i]));
+		for (size_type i = 0; i < n; ++i)
+			__STL_PREFETCH(bucket_of_hash(h[i]));
+	}
+	
+	template <typename InputIterator>
+	void insert_unique(InputIterator first, InputIterator last, input_iterator_tag)
+	{
+		for (; first != last; ++first)
+			insert_unique(*first);
+	}
+	
+	template <typename ForwardIterator>
+	void insert_unique(ForwardIterator first, ForwardIterator last,
+	                   forward_iterator_tag);
+	
+	template <typename InputIterator>
+	void insert_equal(InputIterator first, InputIterator last, input_iterator_tag)
+	{
+		for (; first != last; ++first)
+			insert_equal(*first);
+	}
+	
+	template <typename ForwardIterator>
+	void insert_equal(ForwardIterator first, ForwardIterator last,
+	                  forward_iterator_tag);
+	
+	void copy_hash_code(node* dst, const node* src, __true_type)
+	{ dst->hash_code = src->hash_code; }
+	void copy_hash_code(node*, const node*, __false_type) {}
 	
 	size_type bkt_num(const value_type& obj, size_t n) const
 	{ return bkt_num_key(get_key(obj), n); }
@@ -125,105 +328,283 @@ private:
 	{ return  bkt_num_key(key, buckets.size()); }
 	
 	size_type bkt_num_key(const key_type& key, size_t n) const 
-	{ return hash(key) % n; }
+	{ return BucketPolicy::bucket(hash(key), n); }
 	
 public:
+	size_type size() const { return num_elements; }
+	bool empty() const { return num_elements == 0; }
 	size_type bucket_count() const { return buckets.size(); }
 	
+	/* new buckets first, then the old ones not moved yet */
+	iterator begin()
+	{
+		for (size_type n = 0; n < buckets.size(); ++n)
+			if (buckets[n])
+				return iterator(buckets[n], this);
+		for (size_type n = rehash_pos; n < old_buckets.size(); ++n)
+			if (old_buckets[n])
+				return iterator(old_buckets[n], this);
+		return end();
+	}
+	
+	iterator end() { return iterator(0, this); }
+	
 	hashtable(size_type n, const HashFcn& hf, const EqualKey& eql)
-		: hash(hf), equals(eql), get_key(ExtractKey()), num_elements(0)
+		: hash(hf), equals(eql), get_key(ExtractKey()), num_elements(0),
+		  rehash_pos(0), rehash_step(0)
 	{ initialize_buckets(n); }
 	
+	hashtable(const hashtable& ht)
+		: hash(ht.hash), equals(ht.equals), get_key(ht.get_key), num_elements(0),
+		  rehash_pos(0), rehash_step(0)
+	{ copy_from(ht); }
+	
+	hashtable& operator=(const hashtable& ht)
+	{
+		if (&ht != this) {
+			clear();
+			hash = ht.hash;
+			equals = ht.equals;
+			get_key = ht.get_key;
+			copy_from(ht);
+		}
+		return *this;
+	}
+	
+	~hashtable() { clear(); }
+	
+	/*
+	 * grow without a latency spike: old and new buckets live side by side
+	 * and each insert moves n buckets. n == 0 turns it off and finishes a
+	 * rehash still running.
+	 */
+	void set_incremental_rehash(size_type n)
+	{
+		rehash_step = n;
+		if (n == 0 && !old_buckets.empty())
+			migrate_buckets(old_buckets.size());
+	}
+	bool rehashing() const { return !old_buckets.empty(); }
+	
 	pair<iterator, bool> insert_unique(const value_type& obj)
+	{ return insert_unique_with_hash(obj, hash(get_key(obj))); }
+	
+	iterator insert_equal(const value_type& obj)
+	{ return insert_equal_with_hash(obj, hash(get_key(obj))); }
+	
+	/* h must be hash(key of obj), eg. the one carried by the request */
+	pair<iterator, bool> insert_unique_with_hash(const value_type& obj, size_type h)
 	{
 		resize(num_elements + 1);
-		return insert_unique_noresize(obj);
+		return insert_unique_noresize(obj, h);
 	}
 	
-	iterator insert_equal(const value_type& obj)
+	iterator insert_equal_with_hash(const value_type& obj, size_type h)
 	{
 		resize(num_elements + 1);
-		return insert_equal_noresize(obj);
+		return insert_equal_noresize(obj, h);
 	}
 	
+	/*
+	 * bulk operations work on windows of __hashtable_batch keys: hash them
+	 * all, prefetch their buckets, then resolve, so that the cache misses
+	 * of a window overlap instead of being taken one key after another.
+	 */
+	template <typename InputIterator>
+	void insert_unique(InputIterator first, InputIterator last)
+	{ insert_unique(first, last, iterator_category(first)); }
+	
+	template <typename InputIterator>
+	void insert_equal(InputIterator first, InputIterator last)
+	{ insert_equal(first, last, iterator_category(first)); }
+	
+	/* *out++ = find(key) for each key of [first, last) */
+	template <typename ForwardIterator, typename OutputIterator>
+	OutputIterator find_many(ForwardIterator first, ForwardIterator last,
+	                         OutputIterator out);
+	
+	/* *out++ = count(key) for each key of [first, last) */
+	template <typename ForwardIterator, typename OutputIterator>
+	OutputIterator count_many(ForwardIterator first, ForwardIterator last,
+	                          OutputIterator out) const;
+	
 	void clear();
+
+	/*
+	 * empty the table without destroying or freeing its nodes, for an
+	 * __arena_alloc that gives them all back at once with release(). it
+	 * clears the bucket array but visits no node. the values must not
+	 * need their destructors.
+	 */
+	void forget_nodes()
+	{
+		for (size_type i = 0; i < buckets.size(); ++i)
+			buckets[i] = 0;
+		vector<node*, Alloc> tmp;
+		old_buckets.swap(tmp);
+		rehash_pos = 0;
+		num_elements = 0;
+	}
+
 	void copy_from(const hashtable& ht);
 	
 	iterator find(const key_type& key)
+	{ return find_with_hash(key, hash(key)); }
+	
+	size_type count(const key_type& key) const
+	{ return count_with_hash(key, hash(key)); }
+	
+	template <typename K, typename H = HashFcn, typename E = EqualKey>
+	typename __hashtable_transparent<H, E, iterator>::type
+	find(const K& key)
+	{ return find_with_hash(key, hash(key)); }
+	
+	template <typename K, typename H = HashFcn, typename E = EqualKey>
+	typename __hashtable_transparent<H, E, size_type>::type
+	count(const K& key) const
+	{ return count_with_hash(key, hash(key)); }
+	
+	/*
+	 * h must be hash(key), K is key_type or a type the transparent
+	 * HashFcn and EqualKey accept.
+	 */
+	template <typename K>
+	iterator find_with_hash(const K& key, size_type h)
 	{
-		size_type n = bkt_num_key(key);
 		node* first;
 		
-		for (first = buckets[n]; first && !equals(get_key(first->val), key);
+		for (first = bucket_of_hash(h); first && !node_equals(first, key, h);
 			 first = first->next) {}
 		return iterator(first, this);
 	}
 	
-	size_type count(const key_type& key) const
+	template <typename K>
+	size_type count_with_hash(const K& key, size_type h) const
 	{
-		const size_type n = bkt_num_key(key);
 		size_type result = 0;
 		
-		for (const node* cur = buckets[n]; cur; cur = cur->next)
-			if (equals(get_key(cur->val), key))
+		for (const node* cur = bucket_of_hash(h); cur; cur = cur->next)
+			if (node_equals(cur, key, h))
 				++result;
 		return result;
 	}
+	
+	size_type erase(const key_type& key)
+	{ return erase_with_hash(key, hash(key)); }
+	
+	/* remove every element whose key equals key, h must be hash(key) */
+	template <typename K>
+	size_type erase_with_hash(const K& key, size_type h)
+	{
+		size_type erased = 0;
+		node** link = &bucket_of_hash(h);
+		
+		while (node* cur = *link) {
+			if (node_equals(cur, key, h)) {
+				*link = cur->next;
+				delete_node(cur);
+				++erased;
+			} else {
+				link = &cur->next;
+			}
+		}
+		num_elements -= erased;
+		return erased;
+	}
 };
 
-template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
-void hashtable<V, K, HF, Ex, Eq, A>::resize(size_type num_elements_hint)
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::resize(size_type num_elements_hint)
 {
+	if (!old_buckets.empty())
+		migrate_buckets(rehash_step);
+	
 	const size_type old_n = buckets.size();
 	if (num_elements_hint > old_n) {
 		const size_type n = next_size(num_elements_hint);
-		if (n > old_n) {
+		if (n > old_n && rehash_step != 0) {
+			/* a rehash still running is finished before the next one */
+			migrate_buckets(old_buckets.size());
+			vector<node*, A> tmp(n, (node*) 0);  /* may throw, nothing moved yet */
+			old_buckets.swap(buckets);
+			buckets.swap(tmp);
+			rehash_pos = 0;
+			migrate_buckets(rehash_step);
+		} else if (n > old_n) {
 			vector<node*, A> tmp(n, (node*) 0);
-			__STL_TRY {
-				for (size_type bucket = 0; bucket < old_n; ++bucket) {
-					node* first = buckets[bucket];
-					while (first) {
-						size_type new_bucket = bkt_num(first->val, n);
-						buckets[bucket] = first->next;
-						first->next = tmp[new_bucket];
-						tmp[new_bucket] = first;
-						first = buckets[bucket];
-					}
+			/* relinking nodes can't throw, tmp was the only allocation */
+			for (size_type bucket = 0; bucket < old_n; ++bucket) {
+				node* first = buckets[bucket];
+				while (first) {
+					size_type new_bucket = node_bkt_num(first, n);
+					buckets[bucket] = first->next;
+					first->next = tmp[new_bucket];
+					tmp[new_bucket] = first;
+					first = buckets[bucket];
 				}
-				buckets.swap(tmp);
 			}
+			buckets.swap(tmp);
+		}
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::migrate_buckets(size_type count)
+{
+	const size_type old_n = old_buckets.size();
+	for (; count > 0 && rehash_pos < old_n; --count, ++rehash_pos) {
+		node* first = old_buckets[rehash_pos];
+		while (first) {
+			size_type new_bucket = node_bkt_num(first, buckets.size());
+			old_buckets[rehash_pos] = first->next;
+			first->next = buckets[new_bucket];
+			buckets[new_bucket] = first;
+			first = old_buckets[rehash_pos];
 		}
 	}
+	if (rehash_pos == old_n) {
+		vector<node*, A> tmp;
+		old_buckets.swap(tmp);
+		rehash_pos = 0;
+	}
 }
 
-template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
-pair<typename hashtable<V, K, HF, Ex, Eq, A>::iterator, bool>
-hashtable<V, K, HF, Ex, Eq, A>::insert_unique_noresize(const value_type& obj)
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+pair<typename hashtable<V, K, HF, Ex, Eq, A, BP>::iterator, bool>
+hashtable<V, K, HF, Ex, Eq, A, BP>::insert_unique_noresize(const value_type& obj,
+                                                            size_type h)
 {
-	const size_type n = bkt_num(obj);
-	node* first = buckets[n];
+	node*& head = bucket_of_hash(h);
+	node* first = head;
 	
 	for (node* cur = first; cur; cur = cur->next)
-		if (equals(get_key(cur->val), get_key(obj)))
+		if (node_equals(cur, get_key(obj), h))
 			return pair<iterator, bool> (iterator(cur, this), false);
 		
 	node* tmp = new_node(obj);
+	set_hash_code(tmp, h, cache_hash_code());
 	tmp->next = first;
-	buckets[n] = tmp;
+	head = tmp;
 	++num_elements;
 	return pair<iterator, bool> (iterator(tmp, this), true);
 }
 
-template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
-typename hashtable<V, K, HF, Ex, Eq, A>::iterator
-hashtable<V, K, HF, Ex, Eq, A>::insert_equal_noresize(const value_type& obj)
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+typename hashtable<V, K, HF, Ex, Eq, A, BP>::iterator
+hashtable<V, K, HF, Ex, Eq, A, BP>::insert_equal_noresize(const value_type& obj,
+                                                           size_type h)
 {
-	const size_type n = bkt_num(obj);
-	node* first = buckets[n];
+	node*& head = bucket_of_hash(h);
+	node* first = head;
 	
 	for (node* cur = first; cur; cur = cur->next) {
-		if (equals(get_key(cur->val), get_key(obj))) {
+		if (node_equals(cur, get_key(obj), h)) {
 			node* tmp = new_node(obj);
+			set_hash_code(tmp, h, cache_hash_code());
 			tmp->next = cur->next;
 			cur->next = tmp;
 			++num_elements;
@@ -232,14 +613,108 @@ hashtable<V, K, HF, Ex, Eq, A>::insert_equal_noresize(const value_type& obj)
 	}
 	
 	node* tmp = new_node(obj);
+	set_hash_code(tmp, h, cache_hash_code());
 	tmp->next = first;
-	buckets[n] = tmp;
+	head = tmp;
 	++num_elements;
 	return iterator(tmp, this);
 }
 
-template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
-void hashtable<V, K, HF, Ex, Eq, A>::clear()
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+template <typename ForwardIterator>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::insert_unique(ForwardIterator first,
+                                                       ForwardIterator last,
+                                                       forward_iterator_tag)
+{
+	size_type n = 0;
+	distance(first, last, n);
+	resize(num_elements + n);
+	
+	size_type h[__hashtable_batch];
+	while (first != last) {
+		ForwardIterator window = first;
+		size_type k = 0;
+		for (; k < __hashtable_batch && first != last; ++k, ++first)
+			h[k] = hash(get_key(*first));
+		prefetch_buckets(h, k);
+		for (size_type i = 0; i < k; ++i, ++window)
+			insert_unique_noresize(*window, h[i]);
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+template <typename ForwardIterator>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::insert_equal(ForwardIterator first,
+                                                      ForwardIterator last,
+                                                      forward_iterator_tag)
+{
+	size_type n = 0;
+	distance(first, last, n);
+	resize(num_elements + n);
+	
+	size_type h[__hashtable_batch];
+	while (first != last) {
+		ForwardIterator window = first;
+		size_type k = 0;
+		for (; k < __hashtable_batch && first != last; ++k, ++first)
+			h[k] = hash(get_key(*first));
+		prefetch_buckets(h, k);
+		for (size_type i = 0; i < k; ++i, ++window)
+			insert_equal_noresize(*window, h[i]);
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+template <typename ForwardIterator, typename OutputIterator>
+OutputIterator
+hashtable<V, K, HF, Ex, Eq, A, BP>::find_many(ForwardIterator first,
+                                              ForwardIterator last,
+                                              OutputIterator out)
+{
+	size_type h[__hashtable_batch];
+	while (first != last) {
+		ForwardIterator window = first;
+		size_type k = 0;
+		for (; k < __hashtable_batch && first != last; ++k, ++first)
+			h[k] = hash(*first);
+		prefetch_buckets(h, k);
+		for (size_type i = 0; i < k; ++i, ++window, ++out) {
+			node* cur = bucket_of_hash(h[i]);
+			while (cur && !node_equals(cur, *window, h[i]))
+				cur = cur->next;
+			*out = iterator(cur, this);
+		}
+	}
+	return out;
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+template <typename ForwardIterator, typename OutputIterator>
+OutputIterator
+hashtable<V, K, HF, Ex, Eq, A, BP>::count_many(ForwardIterator first,
+                                               ForwardIterator last,
+                                               OutputIterator out) const
+{
+	size_type h[__hashtable_batch];
+	while (first != last) {
+		ForwardIterator window = first;
+		size_type k = 0;
+		for (; k < __hashtable_batch && first != last; ++k, ++first)
+			h[k] = hash(*first);
+		prefetch_buckets(h, k);
+		for (size_type i = 0; i < k; ++i, ++window, ++out)
+			*out = count_with_hash(*window, h[i]);
+	}
+	return out;
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::clear()
 {
 	for (size_type i = 0; i < buckets.size(); ++i) {
 		node* cur = buckets[i];
@@ -250,27 +725,53 @@ void hashtable<V, K, HF, Ex, Eq, A>::clear()
 		}
 		buckets[i] = 0;
 	}
+	for (size_type i = rehash_pos; i < old_buckets.size(); ++i) {
+		node* cur = old_buckets[i];
+		while (cur != 0) {
+			node* next = cur->next;
+			delete_node(cur);
+			cur = next;
+		}
+	}
+	vector<node*, A> tmp;
+	old_buckets.swap(tmp);
+	rehash_pos = 0;
 	num_elements = 0;
 }
 
-template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A>
-void hashtable<V, K, HF, Ex, Eq, A>::copy_from(const hashtable& ht)
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::copy_buckets(vector<node*, A>& dst,
+                                                      const vector<node*, A>& src,
+                                                      size_type first)
 {
-	buckets.clear();
-	buckets.reserve(ht.buckets.size());
-	buckets.insert(buckets.end(), ht.buckets.size(), (node*) 0);
-	__STL_TRY {
-		for (size_type i = 0; i < ht.buckets.size(); ++i) {
-			if (const node* cur = ht.buckets[i]) {
-				node* copy = new_node(cur->val);
-				buckets[i] = copy;
-				
-				for (node* next = cur->next; next; cur = next, next = cur->next) {
-					copy->next = new_node(next->val);
-					copy = copy->next;
-				}
+	dst.clear();
+	dst.reserve(src.size());
+	dst.insert(dst.end(), src.size(), (node*) 0);
+	for (size_type i = first; i < src.size(); ++i) {
+		if (const node* cur = src[i]) {
+			node* copy = new_node(cur->val);
+			copy_hash_code(copy, cur, cache_hash_code());
+			dst[i] = copy;
+			
+			for (node* next = cur->next; next; cur = next, next = cur->next) {
+				copy->next = new_node(next->val);
+				copy = copy->next;
+				copy_hash_code(copy, next, cache_hash_code());
 			}
 		}
+	}
+}
+
+template <typename V, typename K, typename HF, typename Ex, typename Eq, typename A,
+          typename BP>
+void hashtable<V, K, HF, Ex, Eq, A, BP>::copy_from(const hashtable& ht)
+{
+	__STL_TRY {
+		copy_buckets(buckets, ht.buckets, 0);
+		rehash_pos = ht.rehash_pos;
+		rehash_step = ht.rehash_step;
+		copy_buckets(old_buckets, ht.old_buckets, ht.rehash_pos);
 		num_elements = ht.num_elements;
 	}
 	__STL_UNWIND(clear());
@@ -68,14 +68,45 @@ protected:
 	typedef simple_alloc<list_node, Alloc> list_node_allocator;
 public:
 	typedef list_node* link_type;
-	typedef link_type iterator;
-	typedef __list_iterator<T, T, T>::iterator iterator;
+	typedef __list_iterator<T, T&, T*> iterator;
+	typedef __list_iterator<T, const T&, const T*> const_iterator;
+	typedef T value_type;
 	typedef T& reference;
+	typedef const T& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
 	
 	list() { empty_initialize(); }
+
+	list(const list& x)
+	{
+		empty_initialize();
+		__STL_TRY {
+			for (const_iterator i = x.begin(); i != x.end(); ++i)
+				push_back(*i);
+		}
+		__STL_UNWIND(clear(); put_node(node));
+	}
+
+	~list()
+	{
+		clear();
+		put_node(node);
+	}
+
+	list& operator=(const list& x)
+	{
+		if (this != &x) {
+			list tmp(x);
+			swap(tmp);
+		}
+		return *this;
+	}
 	
 	iterator begin() { return (link_type) ((*node).next); }
+	const_iterator begin() const { return (link_type) ((*node).next); }
 	iterator end() { return node; }
+	const_iterator end() const { return node; }
 	
 	bool empty() const { return node->next == node; }
 	
@@ -93,6 +124,7 @@ public:
 	{
 		link_type tmp = create_node(x);
 		tmp->next = position.node;
+		tmp->prev = position.node->prev;
 		(link_type(position.node->prev))->next = tmp;
 		position.node->prev = tmp;
 		return tmp;
@@ -119,6 +151,20 @@ public:
 	}
 	
 	void clear();
+
+	/*
+	 * empty the list without destroying or freeing its nodes, for an
+	 * __arena_alloc that gives them all back at once with release(). the
+	 * values must not need their destructors.
+	 */
+	void forget_nodes()
+	{
+		node->next = node;
+		node->prev = node;
+	}
+
+	void swap(list& x) { ::swap(node, x.node); }
+
 	void remove(const T& value);
 	
 	/* remove the same value elements which are contiguous */
@@ -226,7 +272,7 @@ void list<T, Alloc>::unique()
 			erase(next);
 		else
 			first = next;
-		next = frist;
+		next = first;
 	}
 }
 
@@ -246,9 +292,9 @@ void list<T, Alloc>::merge(list<T, Alloc>& x)
 		} else {
 			++first1;
 		}
-		if (first2 != last2)
-			transfer(last1, first2, last2);
 	}
+	if (first2 != last2)
+		transfer(last1, first2, last2);
 }
 
 template <typename T, typename Alloc>
@@ -0,0 +1,572 @@
+#ifndef _PERSISTENT_RB_TREE_IMPL_H_
+#define _PERSISTENT_RB_TREE_IMPL_H_
+
+#include <atomic>
+#include <mutex>
+
+/*
+ * red-black tree with path copying: a node is never changed once it is
+ * linked, an update copies the O(log n) nodes on its search path and
+ * shares everything else with the old version. copying the tree is O(1),
+ * so a reader takes a snapshot by copying and keeps it as long as it
+ * likes. nodes have no parent pointer (it could not be shared) and carry
+ * an atomic reference count, the last version holding a node frees it.
+ *
+ * one thread may update a tree while others take snapshots of it: the
+ * root is read and retained, or swapped for a new one, under root_lock,
+ * and the old root is released after the lock is dropped. the snapshot
+ * then holds its own reference. anything else on a tree being updated
+ * (find, iteration, a second writer) needs the caller's own locking.
+ *
+ * insert is Okasaki's, erase is Germane and Might's, which needs a double
+ * black color and a double black empty tree (the shared sentinel ee).
+ */
+enum __persistent_rb_color {
+	__persistent_rb_red,
+	__persistent_rb_black,
+	__persistent_rb_dblack
+};
+
+struct __persistent_rb_node_base {
+	typedef __persistent_rb_node_base* base_ptr;
+
+	atomic<size_t> refs;
+	__persistent_rb_color color;
+	base_ptr left;
+	base_ptr right;
+};
+
+template <typename Value>
+struct __persistent_rb_node : public __persistent_rb_node_base {
+	Value value_field;
+};
+
+/*
+ * forward iterator holding the pending ancestors on a stack. it does not
+ * own the nodes: it stays valid as long as the tree it came from (or any
+ * copy of it) is alive.
+ */
+template <typename Value>
+struct __persistent_rb_iterator {
+	typedef Value value_type;
+	typedef const Value& reference;
+	typedef const Value* pointer;
+	typedef forward_iterator_tag iterator_category;
+	typedef ptrdiff_t difference_type;
+	typedef __persistent_rb_iterator<Value> self;
+	typedef __persistent_rb_node<Value>* link_type;
+
+	enum { max_height = 2 * sizeof(size_t) * 8 };
+
+	link_type stack[max_height];
+	int depth;
+
+	__persistent_rb_iterator() : depth(0) {}
+
+	void push_left(link_type x)
+	{
+		for (; x != 0; x = (link_type) x->left)
+			stack[depth++] = x;
+	}
+
+	reference operator*() const { return stack[depth - 1]->value_field; }
+	pointer operator->() const { return &(operator*()); }
+
+	self& operator++()
+	{
+		link_type x = stack[--depth];
+		push_left((link_type) x->right);
+		return *this;
+	}
+
+	self operator++(int)
+	{
+		self tmp = *this;
+		++*this;
+		return tmp;
+	}
+
+	bool operator==(const self& x) const
+	{
+		return depth == x.depth &&
+				(depth == 0 || stack[depth - 1] == x.stack[x.depth - 1]);
+	}
+	bool operator!=(const self& x) const { return !(*this == x); }
+};
+
+template <typename Key, typename Value, typename KeyOfValue, typename Compare,
+		  typename Alloc = alloc>
+class persistent_rb_tree {
+public:
+	typedef Key key_type;
+	typedef Value value_type;
+	typedef const value_type* const_pointer;
+	typedef const value_type& const_reference;
+	typedef size_t size_type;
+	typedef ptrdiff_t difference_type;
+	typedef __persistent_rb_iterator<Value> const_iterator;
+	typedef const_iterator iterator;
+protected:
+	typedef __persistent_rb_node_base node_base;
+	typedef __persistent_rb_node<Value> node;
+	typedef node* link_type;
+	typedef __persistent_rb_color color_type;
+	typedef simple_alloc<node, Alloc> node_allocator;
+
+	typedef unique_lock<mutex> root_guard;
+
+	link_type root;
+	size_type node_count;
+	Compare key_compare;
+	mutable mutex root_lock;
+
+	/* the double black empty tree, compared against, never dereferenced */
+	static link_type ee()
+	{
+		static node_base e;
+		return (link_type) &e;
+	}
+
+	static link_type left(link_type x) { return (link_type) x->left; }
+	static link_type right(link_type x) { return (link_type) x->right; }
+	static const Key& key(link_type x) { return KeyOfValue() (x->value_field); }
+
+	static link_type retain(link_type x)
+	{
+		if (x != 0 && x != ee())
+			x->refs.fetch_add(1, memory_order_relaxed);
+		return x;
+	}
+
+	static void release(link_type x)
+	{
+		if (x == 0 || x == ee() ||
+				x->refs.fetch_sub(1, memory_order_acq_rel) != 1)
+			return;
+		release(left(x));
+		release(right(x));
+		destroy(&x->value_field);
+		node_allocator::deallocate(x);
+	}
+
+	static bool is_red(link_type x)
+	{ return x != 0 && x != ee() && x->color == __persistent_rb_red; }
+	static bool is_black(link_type x)
+	{ return x != 0 && x != ee() && x->color == __persistent_rb_black; }
+	static bool is_dblack(link_type x)
+	{ return x == ee() || (x != 0 && x->color == __persistent_rb_dblack); }
+	static bool is_leaf(link_type x)
+	{ return x->left == 0 && x->right == 0; }
+
+	/* new node owning the references l and r */
+	static link_type make(color_type c, link_type l, const Value& v, link_type r)
+	{
+		link_type x = 0;
+		__STL_TRY {
+			x = node_allocator::allocate();
+			construct(&x->value_field, v);
+		}
+		__STL_UNWIND(if (x) node_allocator::deallocate(x);
+		             release(l);
+		             release(r));
+		x->refs.store(1, memory_order_relaxed);
+		x->color = c;
+		x->left = l;
+		x->right = r;
+		return x;
+	}
+
+	/* T c (T B a x b) y (T B c z d), a..d are borrowed */
+	static link_type make_split(color_type c, link_type a, const Value& x,
+	        link_type b, const Value& y, link_type cc, const Value& z, link_type d)
+	{
+		link_type l = make(__persistent_rb_black, retain(a), x, retain(b));
+		link_type r;
+		__STL_TRY {
+			r = make(__persistent_rb_black, retain(cc), z, retain(d));
+		}
+		__STL_UNWIND(release(l));
+		return make(c, l, y, r);
+	}
+
+	/* take one black away from a double black tree, consumes x */
+	static link_type unblack(link_type x)
+	{
+		if (x == ee())
+			return 0;
+		if (x->refs.load(memory_order_relaxed) == 1) {  /* fresh, not shared */
+			x->color = __persistent_rb_black;
+			return x;
+		}
+		link_type y;
+		__STL_TRY {
+			y = make(__persistent_rb_black, retain(left(x)), x->value_field,
+					retain(right(x)));
+		}
+		__STL_UNWIND(release(x));
+		release(x);
+		return y;
+	}
+
+	link_type balance(color_type c, link_type l, const Value& v, link_type r);
+	link_type rotate(color_type c, link_type l, const Value& v, link_type r);
+	link_type insert(link_type t, const Value& v);
+	link_type del(link_type t, const Key& k);
+	link_type min_del(link_type t, link_type& min);
+	link_type lower_bound_node(const Key& k) const;
+
+	/* a new reference to the root of x, with its size */
+	static link_type acquire_root(const persistent_rb_tree& x, size_type& n)
+	{
+		root_guard guard(x.root_lock);
+		n = x.node_count;
+		return retain(x.root);
+	}
+
+	/* make t the root, consumes t, drops the old root outside the lock */
+	void publish(link_type t, size_type n)
+	{
+		link_type old;
+		{
+			root_guard guard(root_lock);
+			old = root;
+			root = t;
+			node_count = n;
+		}
+		release(old);
+	}
+
+	bool contains(const Key& k) const
+	{
+		link_type y = lower_bound_node(k);
+		return y != 0 && !key_compare(k, key(y));
+	}
+
+public:
+	persistent_rb_tree(const Compare& comp = Compare())
+		: root(0), node_count(0), key_compare(comp) {}
+
+	/* a snapshot: O(1), shares every node */
+	persistent_rb_tree(const persistent_rb_tree& x)
+		: key_compare(x.key_compare)
+	{ root = acquire_root(x, node_count); }
+
+	~persistent_rb_tree() { release(root); }
+
+	persistent_rb_tree& operator=(const persistent_rb_tree& x)
+	{
+		if (this != &x) {
+			size_type n;
+			link_type t = acquire_root(x, n);
+			key_compare = x.key_compare;
+			publish(t, n);
+		}
+		return *this;
+	}
+
+	void swap(persistent_rb_tree& x)
+	{
+		if (this == &x)
+			return;
+		/* both locks, in address order */
+		root_guard g1(this < &x ? root_lock : x.root_lock);
+		root_guard g2(this < &x ? x.root_lock : root_lock);
+		link_type r = root; root = x.root; x.root = r;
+		size_type n = node_count; node_count = x.node_count; x.node_count = n;
+		Compare c = key_compare; key_compare = x.key_compare; x.key_compare = c;
+	}
+
+	Compare key_comp() const { return key_compare; }
+	bool empty() const { return node_count == 0; }
+	size_type size() const { return node_count; }
+	size_type max_size() const { return size_type(-1); }
+
+	const_iterator begin() const
+	{
+		const_iterator it;
+		it.push_left(root);
+		return it;
+	}
+	const_iterator end() const { return const_iterator(); }
+
+	void clear() { publish(0, 0); }
+
+	/* false if the key is already there, nothing is copied then */
+	bool insert_unique(const value_type& v);
+	size_type erase(const key_type& k);
+
+	const_iterator lower_bound(const key_type& k) const;
+	const_iterator upper_bound(const key_type& k) const;
+	const_iterator find(const key_type& k) const;
+	size_type count(const key_type& k) const { return contains(k) ? 1 : 0; }
+};
+
+/* Okasaki's four red-red cases, plus the two double black ones, consumes l and r */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::link_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	balance(color_type c, link_type l, const Value& v, link_type r)
+{
+	if (c == __persistent_rb_red)
+		return make(c, l, v, r);
+
+	color_type top = c == __persistent_rb_black ? __persistent_rb_red
+	                                            : __persistent_rb_black;
+	link_type result = 0;
+	__STL_TRY {
+		if (c == __persistent_rb_black && is_red(l) && is_red(left(l))) {
+			link_type ll = left(l);
+			result = make_split(top, left(ll), ll->value_field, right(ll),
+					l->value_field, right(l), v, r);
+		} else if (is_red(l) && is_red(right(l))) {
+			link_type lr = right(l);
+			result = make_split(top, left(l), l->value_field, left(lr),
+					lr->value_field, right(lr), v, r);
+		} else if (is_red(r) && is_red(left(r))) {
+			link_type rl = left(r);
+			result = make_split(top, l, v, left(rl), rl->value_field,
+					right(rl), r->value_field, right(r));
+		} else if (c == __persistent_rb_black && is_red(r) && is_red(right(r))) {
+			link_type rr = right(r);
+			result = make_split(top, l, v, left(r), r->value_field,
+					left(rr), rr->value_field, right(rr));
+		}
+	}
+	__STL_UNWIND(release(l); release(r));
+	if (result == 0)
+		return make(c, l, v, r);
+	release(l);
+	release(r);
+	return result;
+}
+
+/* push a double black on one side up or away, consumes l and r */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::link_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	rotate(color_type c, link_type l, const Value& v, link_type r)
+{
+	/*
+	 * one call per statement: an argument that throws must not leave a
+	 * retained sibling behind. l or r, whichever is kept for its
+	 * children, is released by the unwind.
+	 */
+	link_type result, t;
+	color_type up = c == __persistent_rb_red ? __persistent_rb_black
+	                                         : __persistent_rb_dblack;
+	if (is_dblack(l) && is_black(r)) {
+		__STL_TRY {
+			t = unblack(l);
+			t = make(__persistent_rb_red, t, v, retain(left(r)));
+			result = balance(up, t, r->value_field, retain(right(r)));
+		}
+		__STL_UNWIND(release(r));
+		release(r);
+	} else if (is_black(l) && is_dblack(r)) {
+		__STL_TRY {
+			t = unblack(r);
+			t = make(__persistent_rb_red, retain(right(l)), v, t);
+			result = balance(up, retain(left(l)), l->value_field, t);
+		}
+		__STL_UNWIND(release(l));
+		release(l);
+	} else if (c == __persistent_rb_black && is_dblack(l) && is_red(r) &&
+			is_black(left(r))) {
+		link_type rl = left(r);
+		__STL_TRY {
+			t = unblack(l);
+			t = make(__persistent_rb_red, t, v, retain(left(rl)));
+			t = balance(__persistent_rb_black, t, rl->value_field, retain(right(rl)));
+			result = make(__persistent_rb_black, t, r->value_field, retain(right(r)));
+		}
+		__STL_UNWIND(release(r));
+		release(r);
+	} else if (c == __persistent_rb_black && is_red(l) && is_black(right(l)) &&
+			is_dblack(r)) {
+		link_type lr = right(l);
+		__STL_TRY {
+			t = unblack(r);
+			t = make(__persistent_rb_red, retain(right(lr)), v, t);
+			t = balance(__persistent_rb_black, retain(left(lr)), lr->value_field, t);
+			result = make(__persistent_rb_black, retain(left(l)), l->value_field, t);
+		}
+		__STL_UNWIND(release(l));
+		release(l);
+	} else {
+		result = make(c, l, v, r);
+	}
+	return result;
+}
+
+/* t is borrowed, the key is known to be absent */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::link_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	insert(link_type t, const Value& v)
+{
+	if (t == 0)
+		return make(__persistent_rb_red, 0, v, 0);
+	if (key_compare(KeyOfValue() (v), key(t))) {
+		link_type l = insert(left(t), v);
+		return balance(t->color, l, t->value_field, retain(right(t)));
+	} else {
+		link_type r = insert(right(t), v);
+		return balance(t->color, retain(left(t)), t->value_field, r);
+	}
+}
+
+/* remove the smallest node of t into min, t is borrowed */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::link_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	min_del(link_type t, link_type& min)
+{
+	if (t->left == 0) {
+		min = t;
+		if (t->right == 0)
+			return t->color == __persistent_rb_red ? 0 : ee();
+		/* a black node with a single red leaf */
+		return make(__persistent_rb_black, 0, right(t)->value_field, 0);
+	}
+	link_type l = min_del(left(t), min);
+	return rotate(t->color, l, t->value_field, retain(right(t)));
+}
+
+/* t is borrowed, the key is known to be present */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::link_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	del(link_type t, const Key& k)
+{
+	const bool less = key_compare(k, key(t));
+	const bool greater = key_compare(key(t), k);
+
+	if (is_leaf(t))  /* then it holds k */
+		return t->color == __persistent_rb_red ? 0 : ee();
+	if (t->color == __persistent_rb_black && t->right == 0) {
+		/* a black node with a single red leaf on the left */
+		if (less)
+			return make(__persistent_rb_black, 0, t->value_field, 0);
+		return make(__persistent_rb_black, 0, left(t)->value_field, 0);
+	}
+	if (less) {
+		link_type l = del(left(t), k);
+		return rotate(t->color, l, t->value_field, retain(right(t)));
+	}
+	if (greater) {
+		link_type r = del(right(t), k);
+		return rotate(t->color, retain(left(t)), t->value_field, r);
+	}
+	link_type min;
+	link_type r = min_del(right(t), min);
+	return rotate(t->color, retain(left(t)), min->value_field, r);
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+bool persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	insert_unique(const Value& v)
+{
+	if (contains(KeyOfValue() (v)))
+		return false;
+	link_type t = insert(root, v);
+	t->color = __persistent_rb_black;  /* fresh copy, not shared yet */
+	publish(t, node_count + 1);
+	return true;
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::size_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::erase(const Key& k)
+{
+	if (!contains(k))
+		return 0;
+	link_type t = root;
+	/* a root with two black children turns red first */
+	if (is_black(t) && is_black(left(t)) && is_black(right(t)))
+		t = make(__persistent_rb_red, retain(left(t)), t->value_field,
+				retain(right(t)));
+	else
+		retain(t);
+	link_type result;
+	__STL_TRY {
+		result = del(t, k);
+	}
+	__STL_UNWIND(release(t));
+	release(t);
+	if (is_dblack(result))
+		result = unblack(result);
+	publish(result, node_count - 1);
+	return 1;
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::const_iterator
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	lower_bound(const Key& k) const
+{
+	const_iterator it;
+	for (link_type x = root; x != 0; ) {
+		if (key_compare(key(x), k)) {
+			x = right(x);
+		} else {
+			it.stack[it.depth++] = x;
+			x = left(x);
+		}
+	}
+	return it;
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::const_iterator
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	upper_bound(const Key& k) const
+{
+	const_iterator it;
+	for (link_type x = root; x != 0; ) {
+		if (key_compare(k, key(x))) {
+			it.stack[it.depth++] = x;
+			x = left(x);
+		} else {
+			x = right(x);
+		}
+	}
+	return it;
+}
+
+/* the last node on the lower_bound path, without building an iterator */
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::link_type
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
+	lower_bound_node(const Key& k) const
+{
+	link_type y = 0;
+	for (link_type x = root; x != 0; ) {
+		if (key_compare(key(x), k)) {
+			x = right(x);
+		} else {
+			y = x;
+			x = left(x);
+		}
+	}
+	return y;
+}
+
+template <typename Key, typename Value, typename KeyOfValue,
+          typename Compare, typename Alloc>
+typename persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::const_iterator
+persistent_rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::find(const Key& k) const
+{
+	return contains(k) ? lower_bound(k) : end();
+}
+
+#endif
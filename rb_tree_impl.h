@@ -1,6 +1,9 @@
 #ifndef _RB_TREE_IMPL_H_
 #define _RB_TREE_IMPL_H_
 
+#include <exception>
+#include <thread>
+
 typedef bool __rb_tree_color_type;
 const __rb_tree_color_type __rb_tree_red = false;
 const __rb_tree_color_type __rb_tree_black = true;
@@ -21,20 +24,89 @@ struct __rb_tree_node_base
 		return x;
 	}
 	
-	static base_ptr maxmum(base_ptr x)
+	static base_ptr maximum(base_ptr x)
 	{
 		while (x->right != 0) x = x->right;
 		return x;
 	}
 };
 
-template <typename Value>
-struct __rb_tree_node : public __rb_tree_node_base
+/* node base for order statistics: every node knows the size of its subtree */
+struct __rb_tree_os_node_base : public __rb_tree_node_base
 {
-	typedef __rb_tree_node<Value>* link_type;
-	Value value_field;
+	size_t subtree_size;
+};
+
+/* whether a node base keeps subtree sizes, which select and rank need */
+template <typename NodeBase>
+struct __rb_tree_has_size {
+	enum { value = false };
+};
+
+template <>
+struct __rb_tree_has_size<__rb_tree_os_node_base> {
+	enum { value = true };
+};
+
+inline size_t __rb_tree_os_size(__rb_tree_node_base* x)
+{
+	return x ? static_cast<__rb_tree_os_node_base*>(x)->subtree_size : 0;
 }
 
+/*
+ * recompute the augmented field of x from its children. the last argument
+ * is only a tag selecting the node base, plain nodes carry nothing.
+ */
+inline void __rb_tree_augment(__rb_tree_node_base*, __rb_tree_node_base*) {}
+
+inline void __rb_tree_augment(__rb_tree_node_base* x, __rb_tree_os_node_base*)
+{
+	static_cast<__rb_tree_os_node_base*>(x)->subtree_size =
+			1 + __rb_tree_os_size(x->left) + __rb_tree_os_size(x->right);
+}
+
+/* copy the augmented field of x to its clone y */
+inline void __rb_tree_clone_augment(__rb_tree_node_base*, __rb_tree_node_base*,
+            __rb_tree_node_base*) {}
+
+inline void __rb_tree_clone_augment(__rb_tree_node_base* y, __rb_tree_node_base* x,
+            __rb_tree_os_node_base*)
+{
+	static_cast<__rb_tree_os_node_base*>(y)->subtree_size =
+			static_cast<__rb_tree_os_node_base*>(x)->subtree_size;
+}
+
+/* recompute x and all its ancestors below header */
+inline void __rb_tree_augment_path(__rb_tree_node_base*, __rb_tree_node_base*,
+            __rb_tree_node_base*) {}
+
+template <typename NodeBase>
+inline void __rb_tree_augment_path(__rb_tree_node_base* x,
+            __rb_tree_node_base* header, NodeBase* tag)
+{
+	for (; x != header; x = x->parent)
+		__rb_tree_augment(x, tag);
+}
+
+inline __rb_tree_node_base* __rb_tree_parent(__rb_tree_node_base* x)
+{ return x->parent; }
+
+inline void __rb_tree_set_parent(__rb_tree_node_base* x, __rb_tree_node_base* p)
+{ x->parent = p; }
+
+inline __rb_tree_color_type __rb_tree_color(__rb_tree_node_base* x)
+{ return x->color; }
+
+inline void __rb_tree_set_color(__rb_tree_node_base* x, __rb_tree_color_type c)
+{ x->color = c; }
+
+template <typename Value, typename Base = __rb_tree_node_base>
+struct __rb_tree_node : public Base
+{
+	typedef __rb_tree_node<Value, Base>* link_type;
+	Value value_field;
+};
+
 struct __rb_tree_base_iterator
 {
 	typedef __rb_tree_node_base::base_ptr base_ptr;
@@ -83,16 +155,26 @@ struct __rb_tree_base_iterator
 	}
 };
 
-template <typename Value, typename Ref, typename Ptr>
+inline bool operator==(const __rb_tree_base_iterator& x,
+                       const __rb_tree_base_iterator& y)
+{ return x.node == y.node; }
+
+inline bool operator!=(const __rb_tree_base_iterator& x,
+                       const __rb_tree_base_iterator& y)
+{ return x.node != y.node; }
+
+template <typename Value, typename Ref, typename Ptr,
+		  typename NodeBase = __rb_tree_node_base>
 struct __rb_tree_iterator : public __rb_tree_base_iterator
 {
 	typedef Value value_type;
 	typedef Ref reference;
 	typedef Ptr pointer;
-	typedef __rb_tree_iterator<Value, Value&, Value*> iterator;
-	typedef __rb_tree_iterator<Value, const Value&, const Value*> const_iterator;
-	typedef __rb_tree_iterator<Value, Ref, Ptr> self;
-	typedef __rb_tree_node<Value>* link_type;
+	typedef __rb_tree_iterator<Value, Value&, Value*, NodeBase> iterator;
+	typedef __rb_tree_iterator<Value, const Value&, const Value*, NodeBase>
+			const_iterator;
+	typedef __rb_tree_iterator<Value, Ref, Ptr, NodeBase> self;
+	typedef __rb_tree_node<Value, NodeBase>* link_type;
 	
 	__rb_tree_iterator() {}
 	__rb_tree_iterator(link_type x) { node = x; }
@@ -105,7 +187,7 @@ struct __rb_tree_iterator : public __rb_tree_base_iterator
 #endif
 
 	self& operator++() { increment(); return *this; }
-	self& operator++(int) {
+	self operator++(int) {
 		self tmp = *this;
 		increment();
 		return tmp;
@@ -119,13 +201,36 @@ struct __rb_tree_iterator : public __rb_tree_base_iterator
 	}
 };
 
+/*
+ * copy and clear of trees with at least this many nodes split the top of
+ * the tree among up to __rb_tree_max_threads threads. Alloc must then be
+ * thread safe, as the default alloc is. __STL_RB_TREE_THREADS, if defined,
+ * replaces the hardware thread count (it may name a variable).
+ */
+const size_t __rb_tree_parallel_threshold = 1 << 16;
+const int __rb_tree_max_threads = 16;
+
+inline int __rb_tree_threads()
+{
+#ifdef __STL_RB_TREE_THREADS
+	int n = __STL_RB_TREE_THREADS;
+#else
+	int n = (int) thread::hardware_concurrency();
+#endif
+	return n < 1 ? 1 : (n > __rb_tree_max_threads ? __rb_tree_max_threads : n);
+}
+
+/*
+ * NodeBase = __rb_tree_os_node_base keeps subtree sizes, which gives
+ * select, rank and distance in O(log n).
+ */
 template <typename Key, typename Value, typename KeyOfValue, typename Compare,
-		  typename Alloc = alloc>
+		  typename Alloc = alloc, typename NodeBase = __rb_tree_node_base>
 class rb_tree {
 protected:
 	typedef void* void_pointer;
 	typedef __rb_tree_node_base* base_ptr;
-	typedef __rb_tree_node<Value> rb_tree_node;
+	typedef __rb_tree_node<Value, NodeBase> rb_tree_node;
 	typedef simple_alloc<rb_tree_node, Alloc> rb_tree_node_allocator;
 	typedef __rb_tree_color_type color_type;
 public:
@@ -133,6 +238,8 @@ public:
 	typedef Value value_type;
 	typedef value_type* pointer;
 	typedef const value_type* const_pointer;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
 	typedef rb_tree_node* link_type;
 	typedef size_t size_type;
 	typedef ptrdiff_t difference_type;
@@ -158,6 +265,7 @@ protected:
 		tmp->color = x->color;
 		tmp->left = 0;
 		tmp->right = 0;
+		__rb_tree_clone_augment(tmp, x, (NodeBase*) 0);
 		return tmp;
 	}
 	
@@ -222,12 +330,52 @@ protected:
 	}
 	
 public:
-	typedef __rb_tree_iterator<value_type, reference, pointer> iterator;
+	typedef __rb_tree_iterator<value_type, reference, pointer, NodeBase> iterator;
 	
 private:
+	static NodeBase* augment_tag() { return (NodeBase*) 0; }
+
 	iterator __insert(base_ptr x, base_ptr y, const value_type& v);
+	iterator __link(base_ptr x, base_ptr y, link_type z);
+	void __move_in(link_type z, bool before_equal);
+
+	/* take z out of the tree without destroying it */
+	link_type __unlink(link_type z)
+	{
+		__rb_tree_rebalance_for_erase((base_ptr) z, header->parent, header->left,
+				header->right, augment_tag());
+		--node_count;
+		return z;
+	}
+
+	/* whether m node by node insertions into n nodes beat an O(n + m) merge */
+	static bool __merge_by_node(size_type m, size_type n)
+	{
+		size_type lg = 1;
+		for (size_type k = n + m; k > 1; k >>= 1)
+			++lg;
+		return m * lg < n + m;
+	}
 	link_type __copy(link_type x, link_type p);
 	void __erase(link_type x);
+	link_type __copy_parallel(link_type x, link_type p, int threads);
+	void __erase_parallel(link_type x, int threads);
+	void __erase_all(link_type x)
+	{
+		if (node_count >= __rb_tree_parallel_threshold)
+			__erase_parallel(x, __rb_tree_threads());
+		else
+			__erase(x);
+	}
+	size_type __rank(base_ptr x) const;
+
+	typedef simple_alloc<link_type, Alloc> link_allocator;
+	link_type* __flatten(link_type* result) const;
+	link_type __build(link_type* nodes, size_type n, base_ptr p,
+	                  size_type depth, size_type black_depth);
+	void __rebuild(link_type* nodes, size_type n);
+	template <typename ForwardIterator>
+	void __assign_sorted(ForwardIterator first, ForwardIterator last, bool unique);
 	
 	void init()
 	{
@@ -235,13 +383,30 @@ private:
 		color(header) = __rb_tree_red;
 		root() = 0;
 		leftmost() = header;
-		rightmost = header;
+		rightmost() = header;
 	}
 	
 public:
 	rb_tree(const Compare& comp = Compare())
 		: node_count(0), key_compare(comp)
 	{ init(); }
+
+	rb_tree(const rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>& x)
+		: node_count(0), key_compare(x.key_compare)
+	{
+		init();
+		if (x.root() != 0) {
+			__STL_TRY {
+				root() = x.node_count >= __rb_tree_parallel_threshold
+						? __copy_parallel(x.root(), header, __rb_tree_threads())
+						: __copy(x.root(), header);
+			}
+			__STL_UNWIND(put_node(header));
+			leftmost() = minimum(root());
+			rightmost() = maximum(root());
+			node_count = x.node_count;
+		}
+	}
 	
 	~rb_tree()
 	{
@@ -249,8 +414,8 @@ public:
 		put_node(header);
 	}
 	
-	rb_tree<Key, Value, KeyOfValue, Compare, Alloc>&
-	operator=(const rb_tree<Key, Value, KeyOfValue, Compare, Alloc>& x);
+	rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>&
+	operator=(const rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>& x);
 	
 	Compare key_comp() const { return key_compare; }
 	iterator begin() { return leftmost(); }
@@ -259,14 +424,99 @@ public:
 	size_type size() const { return node_count; }
 	size_type max_size() const { return size_type(-1); }
 
+	void clear()
+	{
+		if (node_count != 0) {
+			__erase_all(root());
+			leftmost() = header;
+			root() = 0;
+			rightmost() = header;
+			node_count = 0;
+		}
+	}
+
+	/*
+	 * empty the tree without destroying or freeing its nodes, for an
+	 * __arena_alloc that gives them all back at once with release(). the
+	 * values must not need their destructors.
+	 */
+	void forget_nodes()
+	{
+		leftmost() = header;
+		root() = 0;
+		rightmost() = header;
+		node_count = 0;
+	}
+
 	pair<iterator, bool> insert_unique(const value_type& x);
 	iterator insert_equal(const value_type& x);
+
+	/*
+	 * position is a hint: the element that should follow x. a right hint
+	 * costs O(1) comparisons, a wrong one falls back to a full descent.
+	 */
+	iterator insert_unique(iterator position, const value_type& x);
+	iterator insert_equal(iterator position, const value_type& x);
+
+	/* order statistics, only for NodeBase = __rb_tree_os_node_base */
+	iterator select(size_type k);
+	size_type rank(const key_type& k) const;
+	difference_type distance(iterator first, iterator last) const
+	{ return difference_type(__rank(last.node)) - difference_type(__rank(first.node)); }
+
+	/* replace the contents with [first, last), which must be sorted, in O(n) */
+	template <typename ForwardIterator>
+	void assign_sorted_unique(ForwardIterator first, ForwardIterator last)
+	{ __assign_sorted(first, last, true); }
+
+	template <typename ForwardIterator>
+	void assign_sorted_equal(ForwardIterator first, ForwardIterator last)
+	{ __assign_sorted(first, last, false); }
+
+	void swap(rb_tree& t)
+	{
+		::swap(header, t.header);
+		::swap(node_count, t.node_count);
+		::swap(key_compare, t.key_compare);
+	}
+
+	/*
+	 * move the nodes of x into this tree, no node is copied. merge_unique
+	 * leaves the keys already present here in x. O(n + x.size()) by
+	 * flattening both, or node by node in O(m log n) when one side is so
+	 * small that this is cheaper.
+	 */
+	void merge_unique(rb_tree& x);
+	void merge_equal(rb_tree& x);
+
+	void erase(iterator position)
+	{
+		link_type y = (link_type) __rb_tree_rebalance_for_erase(position.node,
+				header->parent, header->left, header->right, augment_tag());
+		destroy_node(y);
+		--node_count;
+	}
+
+	size_type erase(const key_type& x);
+	void erase(iterator first, iterator last);
+	void erase(const key_type* first, const key_type* last)
+	{
+		while (first != last)
+			erase(*first++);
+	}
+
+	iterator find(const key_type& x);
+	size_type count(const key_type& x);
+	iterator lower_bound(const key_type& x);
+	iterator upper_bound(const key_type& x);
+	pair<iterator, iterator> equal_range(const key_type& x)
+	{ return pair<iterator, iterator>(lower_bound(x), upper_bound(x)); }
 };
 
 template <typename Key, typename Value, typename KeyOfValue, 
-          typename Compare, typename Alloc>
-typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
-rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::insert_equal(const Value& v)
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::insert_equal(const Value& v)
 {
 	link_type y = header;
 	link_type x = root();
@@ -278,9 +528,9 @@ rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::insert_equal(const Value& v)
 }
 
 template <typename Key, typename Value, typename KeyOfValue, 
-          typename Compare, typename Alloc>
-pair<typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::iterator, bool>
-rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::insert_unique(const Value& v)
+          typename Compare, typename Alloc, typename NodeBase>
+pair<typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator, bool>
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::insert_unique(const Value& v)
 {
 	link_type y = header;
 	link_type x = root();
@@ -305,97 +555,284 @@ rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::insert_unique(const Value& v)
 	return pair<iterator, bool>(j, false);
 }
 
-inline void __rb_tree_rotate_left(__rb_tree_node_base* x,
-            __rb_tree_node_base*& root)
+/*
+ * the helpers below are templates over the node base, they reach parent
+ * and color only through __rb_tree_parent/__rb_tree_color and their
+ * setters, so a layout packing the two together can share them. the tag
+ * recomputes the augmented fields of the nodes moved.
+ */
+template <typename Base, typename Tag>
+inline void __rb_tree_rotate_left(Base* x, Base*& root, Tag* tag)
 {
-    __rb_tree_node_base* y = x->right;
+    Base* y = x->right;
+    Base* p = __rb_tree_parent(x);
     x->right = y->left;
     if (y->left != 0)
-        y->left->parent = x;
-    y->parent = x->parent;
+        __rb_tree_set_parent(y->left, x);
+    __rb_tree_set_parent(y, p);
 
     if (x == root)
         root = y;
-    else if (x == x->parent->left)
-        x->parent->left = y;
+    else if (x == p->left)
+        p->left = y;
     else
-        x->parent->right = y;
+        p->right = y;
     y->left = x;
-    x->parent = y;
+    __rb_tree_set_parent(x, y);
+    __rb_tree_augment(x, tag);
+    __rb_tree_augment(y, tag);
+}
+
+template <typename Base>
+inline void __rb_tree_rotate_left(Base* x, Base*& root)
+{
+    __rb_tree_rotate_left(x, root, (Base*) 0);
 }
 
-inline void __rb_tree_rotate_right(__rb_tree_node_base* x,
-            __rb_tree_node_base*& root)
+template <typename Base, typename Tag>
+inline void __rb_tree_rotate_right(Base* x, Base*& root, Tag* tag)
 {
-    __rb_tree_node_base* y = x->left;
+    Base* y = x->left;
+    Base* p = __rb_tree_parent(x);
     x->left = y->right;
     if (y->right != 0)
-        y->rigth->parent = x;
-    y->parent = x->parent;
+        __rb_tree_set_parent(y->right, x);
+    __rb_tree_set_parent(y, p);
     
     if (x == root)
         root = y;
-    else if (x == x->parent->right)
-        x->parent->right = y;
+    else if (x == p->right)
+        p->right = y;
     else
-        x->parent->left = y;
+        p->left = y;
     y->right = x;
-    x->parent = y;
+    __rb_tree_set_parent(x, y);
+    __rb_tree_augment(x, tag);
+    __rb_tree_augment(y, tag);
 }
 
-inline void __rb_tree_rebalance(__rb_tree_node_base* x, __rb_tree_node_base*& root)
+template <typename Base>
+inline void __rb_tree_rotate_right(Base* x, Base*& root)
 {
-	x->color = __rb_tree_red;
-	while (x != root && x->parent->color == __rb_tree_red) {
-		if (x->parent == x->parent->parent->left) {
-			__rb_tree_node_base* y = x->parent->parent->right;
-			if (y && y->color == __rb_tree_red) {
-				x->parent->color = __rb_tree_black;
-				y->color = __rb_tree_black;
-				x->parent->parent->color = __rb_tree_red;
-				x = x->parent->parent;
+    __rb_tree_rotate_right(x, root, (Base*) 0);
+}
+
+template <typename Base>
+inline bool __rb_tree_is_red(Base* x)
+{
+	return x != 0 && __rb_tree_color(x) == __rb_tree_red;
+}
+
+/* the ancestors of x must already be up to date when this is called */
+template <typename Base, typename Tag>
+inline void __rb_tree_rebalance(Base* x, Base*& root, Tag* tag)
+{
+	__rb_tree_set_color(x, __rb_tree_red);
+	while (x != root && __rb_tree_is_red(__rb_tree_parent(x))) {
+		Base* xp = __rb_tree_parent(x);
+		Base* xpp = __rb_tree_parent(xp);
+		if (xp == xpp->left) {
+			Base* y = xpp->right;
+			if (__rb_tree_is_red(y)) {
+				__rb_tree_set_color(xp, __rb_tree_black);
+				__rb_tree_set_color(y, __rb_tree_black);
+				__rb_tree_set_color(xpp, __rb_tree_red);
+				x = xpp;
 			} else {
-				if (x == x->parent->right) {
-					x = x->parent;
-					__rb_tree_rotate_left(x, root);
+				if (x == xp->right) {
+					x = xp;
+					__rb_tree_rotate_left(x, root, tag);
+					xp = __rb_tree_parent(x);
 				}
-				x->parent->color = __rb_tree_black;
-				x->parent->parent->color = __rb_tree_red;
-				__rb_tree_rotate_right(x->parent->parent, root);
+				__rb_tree_set_color(xp, __rb_tree_black);
+				__rb_tree_set_color(xpp, __rb_tree_red);
+				__rb_tree_rotate_right(xpp, root, tag);
 			}
 		} else {
-			__rb_tree_node_base* y = x->parent->parent->left;
-			if (y && y->color == __rb_tree_red) {
-				x->parent->color == __rb_tree_black;
-				y->color = __rb_tree_black;
-				x->parent->parent->color = __rb_tree_red;
-				x = x->parent->parent;
+			Base* y = xpp->left;
+			if (__rb_tree_is_red(y)) {
+				__rb_tree_set_color(xp, __rb_tree_black);
+				__rb_tree_set_color(y, __rb_tree_black);
+				__rb_tree_set_color(xpp, __rb_tree_red);
+				x = xpp;
 			} else {
-				if (x == x->parent->left) {
-					x = x->parent;
-					__rb_tree_rotate_right(x, root);
+				if (x == xp->left) {
+					x = xp;
+					__rb_tree_rotate_right(x, root, tag);
+					xp = __rb_tree_parent(x);
 				}
-				x->parent->color = __rb_tree_black;
-				x->parent->parent->color = __rb_tree_red;
-				__rb_tree_rotate_left(x->parent->parent, root);
+				__rb_tree_set_color(xp, __rb_tree_black);
+				__rb_tree_set_color(xpp, __rb_tree_red);
+				__rb_tree_rotate_left(xpp, root, tag);
 			}
 		}
 	}
-	root->color = __rb_tree_black;
+	__rb_tree_set_color(root, __rb_tree_black);
+}
+
+template <typename Base>
+inline void __rb_tree_rebalance(Base* x, Base*& root)
+{
+	__rb_tree_rebalance(x, root, (Base*) 0);
+}
+
+/*
+ * unlink z and restore the red-black properties, return the node to free.
+ * a z with two children is replaced by its successor y. the augmented
+ * fields are recomputed from where the tree changed up to the root before
+ * the fixup, whose rotations then keep them right.
+ */
+template <typename Base, typename Tag>
+inline Base* __rb_tree_rebalance_for_erase(Base* z, Base*& root, Base*& leftmost,
+                                           Base*& rightmost, Tag* tag)
+{
+	Base* header = __rb_tree_parent(root);
+	Base* zp = __rb_tree_parent(z);
+	Base* y = z;
+	Base* x = 0;
+	Base* x_parent = 0;
+
+	if (y->left == 0) {
+		x = y->right;
+	} else if (y->right == 0) {
+		x = y->left;
+	} else {
+		y = y->right;
+		while (y->left != 0)
+			y = y->left;
+		x = y->right;
+	}
+
+	if (y != z) {  /* relink y in place of z */
+		__rb_tree_set_parent(z->left, y);
+		y->left = z->left;
+		if (y != z->right) {
+			x_parent = __rb_tree_parent(y);
+			if (x)
+				__rb_tree_set_parent(x, x_parent);
+			x_parent->left = x;
+			y->right = z->right;
+			__rb_tree_set_parent(z->right, y);
+		} else {
+			x_parent = y;
+		}
+		if (root == z)
+			root = y;
+		else if (zp->left == z)
+			zp->left = y;
+		else
+			zp->right = y;
+		__rb_tree_set_parent(y, zp);
+		__rb_tree_color_type c = __rb_tree_color(y);
+		__rb_tree_set_color(y, __rb_tree_color(z));
+		__rb_tree_set_color(z, c);
+		y = z;  /* y now points to the node to be deleted */
+	} else {
+		x_parent = zp;
+		if (x)
+			__rb_tree_set_parent(x, zp);
+		if (root == z)
+			root = x;
+		else if (zp->left == z)
+			zp->left = x;
+		else
+			zp->right = x;
+		if (leftmost == z)
+			leftmost = z->right == 0 ? zp : Base::minimum(x);
+		if (rightmost == z)
+			rightmost = z->left == 0 ? zp : Base::maximum(x);
+	}
+	__rb_tree_augment_path(x_parent, header, tag);
+
+	if (__rb_tree_color(y) != __rb_tree_red) {
+		while (x != root && !__rb_tree_is_red(x)) {
+			if (x == x_parent->left) {
+				Base* w = x_parent->right;
+				if (__rb_tree_is_red(w)) {
+					__rb_tree_set_color(w, __rb_tree_black);
+					__rb_tree_set_color(x_parent, __rb_tree_red);
+					__rb_tree_rotate_left(x_parent, root, tag);
+					w = x_parent->right;
+				}
+				if (!__rb_tree_is_red(w->left) && !__rb_tree_is_red(w->right)) {
+					__rb_tree_set_color(w, __rb_tree_red);
+					x = x_parent;
+					x_parent = __rb_tree_parent(x_parent);
+				} else {
+					if (!__rb_tree_is_red(w->right)) {
+						__rb_tree_set_color(w->left, __rb_tree_black);
+						__rb_tree_set_color(w, __rb_tree_red);
+						__rb_tree_rotate_right(w, root, tag);
+						w = x_parent->right;
+					}
+					__rb_tree_set_color(w, __rb_tree_color(x_parent));
+					__rb_tree_set_color(x_parent, __rb_tree_black);
+					if (w->right)
+						__rb_tree_set_color(w->right, __rb_tree_black);
+					__rb_tree_rotate_left(x_parent, root, tag);
+					break;
+				}
+			} else {  /* same as above, with right <-> left */
+				Base* w = x_parent->left;
+				if (__rb_tree_is_red(w)) {
+					__rb_tree_set_color(w, __rb_tree_black);
+					__rb_tree_set_color(x_parent, __rb_tree_red);
+					__rb_tree_rotate_right(x_parent, root, tag);
+					w = x_parent->left;
+				}
+				if (!__rb_tree_is_red(w->right) && !__rb_tree_is_red(w->left)) {
+					__rb_tree_set_color(w, __rb_tree_red);
+					x = x_parent;
+					x_parent = __rb_tree_parent(x_parent);
+				} else {
+					if (!__rb_tree_is_red(w->left)) {
+						__rb_tree_set_color(w->right, __rb_tree_black);
+						__rb_tree_set_color(w, __rb_tree_red);
+						__rb_tree_rotate_left(w, root, tag);
+						w = x_parent->left;
+					}
+					__rb_tree_set_color(w, __rb_tree_color(x_parent));
+					__rb_tree_set_color(x_parent, __rb_tree_black);
+					if (w->left)
+						__rb_tree_set_color(w->left, __rb_tree_black);
+					__rb_tree_rotate_right(x_parent, root, tag);
+					break;
+				}
+			}
+		}
+		if (x)
+			__rb_tree_set_color(x, __rb_tree_black);
+	}
+	return y;
+}
+
+template <typename Base>
+inline Base* __rb_tree_rebalance_for_erase(Base* z, Base*& root, Base*& leftmost,
+                                           Base*& rightmost)
+{
+	return __rb_tree_rebalance_for_erase(z, root, leftmost, rightmost, (Base*) 0);
 }
 
 template <typename Key, typename Value, typename KeyOfValue, 
-          typename Compare, typename Alloc>
-typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::iterator
-rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
-	__insert(base_ptr x__, base_ptr y__, const Value& v)
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__insert(base_ptr x, base_ptr y, const Value& v)
+{
+	return __link(x, y, create_node(v));
+}
+
+/* link node z as a child of y: the left one if x != 0, as in __insert */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__link(base_ptr x__, base_ptr y__, link_type z)
 {
 	link_type x = (link_type) x__;
 	link_type y = (link_type) y__;
-	link_type z;
 	
-	if (y == header || x != 0 || key_compare(KeyOfValue() (v), key(y))) {
-		z = create_node(v);
+	if (y == header || x != 0 || key_compare(key(z), key(y))) {
 		left(y) = z;
 		if (y == header) {
 			root() = z;
@@ -404,7 +841,6 @@ rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
 			leftmost() = z;
 		}
 	} else {
-		z = create_node(v);
 		right(y) = z;
 		if (y == rightmost())
 			rightmost() = z;
@@ -413,9 +849,552 @@ rb_tree<Key, Value, KeyOfValue, Compare, Alloc>::
 	left(z) = 0;
 	right(z) = 0;
 
-	__rb_tree_rebalance(z, header->parent);
+	__rb_tree_augment_path(z, header, augment_tag());
+	__rb_tree_rebalance((base_ptr) z, header->parent, augment_tag());
 	++node_count;
 	return iterator(z);
 }
 
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	insert_unique(iterator position, const Value& v)
+{
+	if (position.node == header->left) {  /* begin() */
+		if (node_count > 0 && key_compare(KeyOfValue() (v), key(position.node)))
+			return __insert(position.node, position.node, v);
+		return insert_unique(v).first;
+	} else if (position.node == header) {  /* end() */
+		if (key_compare(key(rightmost()), KeyOfValue() (v)))
+			return __insert(0, rightmost(), v);
+		return insert_unique(v).first;
+	} else {
+		iterator before = position;
+		--before;
+		if (key_compare(key(before.node), KeyOfValue() (v)) &&
+				key_compare(KeyOfValue() (v), key(position.node))) {
+			/* one of the two has a free slot next to v */
+			if (right(before.node) == 0)
+				return __insert(0, before.node, v);
+			else
+				return __insert(position.node, position.node, v);
+		}
+		return insert_unique(v).first;
+	}
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	insert_equal(iterator position, const Value& v)
+{
+	if (position.node == header->left) {  /* begin() */
+		if (node_count > 0 && !key_compare(key(position.node), KeyOfValue() (v)))
+			return __insert(position.node, position.node, v);
+		return insert_equal(v);
+	} else if (position.node == header) {  /* end() */
+		if (!key_compare(KeyOfValue() (v), key(rightmost())))
+			return __insert(0, rightmost(), v);
+		return insert_equal(v);
+	} else {
+		iterator before = position;
+		--before;
+		if (!key_compare(KeyOfValue() (v), key(before.node)) &&
+				!key_compare(key(position.node), KeyOfValue() (v))) {
+			if (right(before.node) == 0)
+				return __insert(0, before.node, v);
+			else
+				return __insert(position.node, position.node, v);
+		}
+		return insert_equal(v);
+	}
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::__erase(link_type x)
+{
+	/* erase without rebalancing */
+	while (x != 0) {
+		__erase(right(x));
+		link_type y = left(x);
+		destroy_node(x);
+		x = y;
+	}
+}
+
+/* clone the subtree x under p, recursing only on right children */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::link_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__copy(link_type x, link_type p)
+{
+	link_type top = clone_node(x);
+	top->parent = p;
+
+	__STL_TRY {
+		if (x->right)
+			top->right = __copy(right(x), top);
+		p = top;
+		x = left(x);
+
+		while (x != 0) {
+			link_type y = clone_node(x);
+			p->left = y;
+			y->parent = p;
+			if (x->right)
+				y->right = __copy(right(x), y);
+			p = y;
+			x = left(x);
+		}
+	}
+	__STL_UNWIND(__erase(top));
+	return top;
+}
+
+/*
+ * the right subtree goes to a new thread, the left one stays here, each
+ * with its share of the threads. an exception in either side frees what
+ * both have built and is rethrown here. if no thread can be started the
+ * right subtree is copied here first, like __erase_parallel does.
+ */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::link_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__copy_parallel(link_type x, link_type p, int threads)
+{
+	if (threads <= 1 || x->left == 0 || x->right == 0)
+		return __copy(x, p);
+
+	link_type top = clone_node(x);
+	top->parent = p;
+	link_type r = 0;
+	exception_ptr error;
+	thread t;
+
+	__STL_TRY {
+		__STL_TRY {
+			t = thread([&] {
+				__STL_TRY {
+					r = __copy_parallel(right(x), top, threads / 2);
+				}
+				__STL_CATCH_ALL {
+					error = current_exception();
+				}
+			});
+		}
+		__STL_CATCH_ALL {  /* no thread could be started, do it here */
+			r = __copy(right(x), top);
+		}
+		__STL_TRY {
+			top->left = __copy_parallel(left(x), top, threads - threads / 2);
+		}
+		__STL_UNWIND(if (t.joinable())
+		                 t.join();
+		             __erase(r));
+		if (t.joinable())
+			t.join();
+	}
+	__STL_UNWIND(destroy_node(top));
+
+	top->right = r;
+	if (error) {
+		__erase(top);
+		rethrow_exception(error);
+	}
+	return top;
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__erase_parallel(link_type x, int threads)
+{
+	if (threads <= 1 || x == 0) {
+		__erase(x);
+		return;
+	}
+	link_type l = left(x), r = right(x);
+	destroy_node(x);
+	thread t;
+	__STL_TRY {
+		t = thread([=] { __erase_parallel(r, threads / 2); });
+	}
+	__STL_CATCH_ALL {  /* no thread could be started, do it here */
+		__erase(r);
+	}
+	__erase_parallel(l, threads - threads / 2);
+	if (t.joinable())
+		t.join();
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>&
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	operator=(const rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>& x)
+{
+	if (this != &x) {
+		clear();
+		key_compare = x.key_compare;
+		if (x.root() != 0) {
+			root() = x.node_count >= __rb_tree_parallel_threshold
+					? __copy_parallel(x.root(), header, __rb_tree_threads())
+					: __copy(x.root(), header);
+			leftmost() = minimum(root());
+			rightmost() = maximum(root());
+			node_count = x.node_count;
+		}
+	}
+	return *this;
+}
+
+/* store the nodes in order at result, return the end of what was stored */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::link_type*
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__flatten(link_type* result) const
+{
+	__rb_tree_base_iterator it;
+	for (it.node = leftmost(); it.node != header; it.increment())
+		*result++ = link_type(it.node);
+	return result;
+}
+
+/*
+ * link nodes[0, n) into a perfectly balanced tree under p. the depths of
+ * its empty children differ by at most one, so coloring the incomplete
+ * bottom level (depth >= black_depth) red gives every path the same
+ * number of black nodes.
+ */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::link_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__build(link_type* nodes, size_type n, base_ptr p,
+	        size_type depth, size_type black_depth)
+{
+	if (n == 0)
+		return 0;
+	size_type mid = n / 2;
+	link_type x = nodes[mid];
+	x->parent = p;
+	x->color = depth < black_depth ? __rb_tree_black : __rb_tree_red;
+	x->left = __build(nodes, mid, x, depth + 1, black_depth);
+	x->right = __build(nodes + mid + 1, n - mid - 1, x, depth + 1, black_depth);
+	__rb_tree_augment(x, augment_tag());
+	return x;
+}
+
+/* make the sorted nodes[0, n) the whole content of the tree */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__rebuild(link_type* nodes, size_type n)
+{
+	size_type black_depth = 0;  /* number of complete levels */
+	while ((size_type(2) << black_depth) - 1 <= n)
+		++black_depth;
+	root() = __build(nodes, n, header, 0, black_depth);
+	leftmost() = n == 0 ? header : nodes[0];
+	rightmost() = n == 0 ? header : nodes[n - 1];
+	node_count = n;
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+template <typename ForwardIterator>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__assign_sorted(ForwardIterator first, ForwardIterator last, bool unique)
+{
+	clear();
+	size_type n = 0;
+	for (ForwardIterator i = first; i != last; ++i)
+		++n;
+	link_type* nodes = link_allocator::allocate(n);
+	size_type k = 0;
+	__STL_TRY {
+		for (; first != last; ++first) {
+			if (unique && k != 0 &&
+					!key_compare(key(nodes[k - 1]), KeyOfValue() (*first)))
+				continue;
+			nodes[k++] = create_node(*first);
+		}
+	}
+	__STL_UNWIND(while (k != 0) destroy_node(nodes[--k]);
+	             link_allocator::deallocate(nodes, n));
+	__rebuild(nodes, k);
+	link_allocator::deallocate(nodes, n);
+}
+
+/* link z, which belongs to no tree, next to the nodes with its key */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	__move_in(link_type z, bool before_equal)
+{
+	link_type y = header;
+	link_type x = root();
+	bool go_left = true;
+	while (x != 0) {
+		y = x;
+		go_left = before_equal ? !key_compare(key(x), key(z))
+		                       : key_compare(key(z), key(x));
+		x = go_left ? left(x) : right(x);
+	}
+	__link(go_left ? y : 0, y, z);
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::merge_equal(rb_tree& x)
+{
+	if (this == &x || x.node_count == 0)
+		return;
+	const size_type na = node_count, nb = x.node_count, n = na + nb;
+
+	/* equal keys: ours first, then the ones from x */
+	if (__merge_by_node(nb, na)) {
+		while (x.node_count != 0)
+			__move_in(x.__unlink(x.leftmost()), false);
+		return;
+	}
+	if (__merge_by_node(na, nb)) {
+		swap(x);
+		while (x.node_count != 0)
+			__move_in(x.__unlink(x.rightmost()), true);
+		return;
+	}
+
+	link_type* buf = link_allocator::allocate(2 * n);
+	link_type* a = buf;
+	link_type* b = __flatten(a);
+	x.__flatten(b);
+	link_type* result = buf + n;
+	size_type i = 0, j = 0, k = 0;
+
+	while (i < na && j < nb)
+		result[k++] = key_compare(key(b[j]), key(a[i])) ? b[j++] : a[i++];
+	while (i < na)
+		result[k++] = a[i++];
+	while (j < nb)
+		result[k++] = b[j++];
+
+	__rebuild(result, n);
+	x.__rebuild(0, 0);
+	link_allocator::deallocate(buf, 2 * n);
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::merge_unique(rb_tree& x)
+{
+	if (this == &x || x.node_count == 0)
+		return;
+	const size_type na = node_count, nb = x.node_count, n = na + nb;
+
+	if (__merge_by_node(nb, na)) {
+		for (link_type z = x.leftmost(); z != x.header; ) {
+			iterator next(z);
+			++next;
+			iterator j = lower_bound(key(z));
+			if (j == end() || key_compare(key(z), key(j.node)))
+				__move_in(x.__unlink(z), false);
+			z = link_type(next.node);
+		}
+		return;
+	}
+	if (__merge_by_node(na, nb)) {
+		/* ours are in x now, a node of ours takes the place of its equal */
+		swap(x);
+		for (link_type z = x.leftmost(); z != x.header; ) {
+			iterator next(z);
+			++next;
+			iterator j = lower_bound(key(z));
+			x.__unlink(z);
+			if (j != end() && !key_compare(key(z), key(j.node)))
+				x.__move_in(__unlink(link_type(j.node)), false);
+			__move_in(z, false);
+			z = link_type(next.node);
+		}
+		return;
+	}
+
+	link_type* buf = link_allocator::allocate(2 * n);
+	link_type* a = buf;
+	link_type* b = __flatten(a);
+	x.__flatten(b);
+	link_type* result = buf + n;
+	size_type i = 0, j = 0, k = 0, kept = 0;
+
+	/* the duplicates are packed at the front of b, behind j */
+	while (i < na && j < nb) {
+		if (key_compare(key(b[j]), key(a[i])))
+			result[k++] = b[j++];
+		else if (key_compare(key(a[i]), key(b[j])))
+			result[k++] = a[i++];
+		else {
+			result[k++] = a[i++];
+			b[kept++] = b[j++];
+		}
+	}
+	while (i < na)
+		result[k++] = a[i++];
+	while (j < nb)
+		result[k++] = b[j++];
+
+	__rebuild(result, k);
+	x.__rebuild(b, kept);
+	link_allocator::deallocate(buf, 2 * n);
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::size_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::erase(const Key& x)
+{
+	iterator first = lower_bound(x);
+	iterator last = upper_bound(x);
+	size_type n = 0;
+	while (first != last) {
+		erase(first++);
+		++n;
+	}
+	return n;
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+void rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::
+	erase(iterator first, iterator last)
+{
+	if (first == begin() && last == end())
+		clear();
+	else
+		while (first != last)
+			erase(first++);
+}
+
+/*
+ * the descents below pick the next node with a select instead of an if,
+ * the compiler turns them into conditional moves.
+ */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::lower_bound(const Key& k)
+{
+	link_type y = header;  /* last node which is not less than k */
+	link_type x = root();
+	while (x != 0) {
+		bool less = key_compare(key(x), k);
+		y = less ? y : x;
+		x = less ? right(x) : left(x);
+	}
+	return iterator(y);
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::upper_bound(const Key& k)
+{
+	link_type y = header;  /* last node which is greater than k */
+	link_type x = root();
+	while (x != 0) {
+		bool greater = key_compare(k, key(x));
+		y = greater ? x : y;
+		x = greater ? left(x) : right(x);
+	}
+	return iterator(y);
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::find(const Key& k)
+{
+	iterator j = lower_bound(k);
+	return (j == end() || key_compare(k, key(j.node))) ? end() : j;
+}
+
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::size_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::count(const Key& k)
+{
+	size_type n = 0;
+	for (iterator first = lower_bound(k), last = upper_bound(k);
+			first != last; ++first)
+		++n;
+	return n;
+}
+
+/* the k-th smallest element counting from 0, end() if there is none */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::iterator
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::select(size_type k)
+{
+	static_assert(__rb_tree_has_size<NodeBase>::value,
+	              "select, rank and distance need NodeBase = __rb_tree_os_node_base");
+	if (k >= node_count)
+		return end();
+	base_ptr x = root();
+	for (;;) {
+		size_type l = __rb_tree_os_size(x->left);
+		if (k < l) {
+			x = x->left;
+		} else if (k == l) {
+			return iterator(link_type(x));
+		} else {
+			k -= l + 1;
+			x = x->right;
+		}
+	}
+}
+
+/* number of elements whose key is less than k */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::size_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::rank(const Key& k) const
+{
+	static_assert(__rb_tree_has_size<NodeBase>::value,
+	              "select, rank and distance need NodeBase = __rb_tree_os_node_base");
+	size_type result = 0;
+	base_ptr x = root();
+	while (x != 0) {
+		if (key_compare(key(x), k)) {
+			result += __rb_tree_os_size(x->left) + 1;
+			x = x->right;
+		} else {
+			x = x->left;
+		}
+	}
+	return result;
+}
+
+/* position of node x in the sequence, size() for header */
+template <typename Key, typename Value, typename KeyOfValue, 
+          typename Compare, typename Alloc, typename NodeBase>
+typename rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::size_type
+rb_tree<Key, Value, KeyOfValue, Compare, Alloc, NodeBase>::__rank(base_ptr x) const
+{
+	static_assert(__rb_tree_has_size<NodeBase>::value,
+	              "select, rank and distance need NodeBase = __rb_tree_os_node_base");
+	if (x == header)
+		return node_count;
+	size_type result = __rb_tree_os_size(x->left);
+	for (; x != root(); x = x->parent)
+		if (x == x->parent->right)
+			result += __rb_tree_os_size(x->parent->left) + 1;
+	return result;
+}
+
 #endif
\ No newline at end of file
@@ -0,0 +1,332 @@
+#ifndef _RING_QUEUE_IMPL_H_
+#define _RING_QUEUE_IMPL_H_
+
+#include <atomic>
+
+/* shared with the other concurrent headers, whichever comes first */
+#ifndef __STL_CACHE_LINE_SIZE
+#define __STL_CACHE_LINE_SIZE 64
+const size_t __cache_line_size = __STL_CACHE_LINE_SIZE;
+#endif
+
+/* the rings index with a mask, so the capacity is a power of two */
+inline size_t __ring_capacity(size_t n)
+{
+	size_t c = 2;
+	while (c < n)
+		c <<= 1;
+	return c;
+}
+
+/*
+ * bounded queue between exactly one producer thread and one consumer
+ * thread. head is written only by the consumer and tail only by the
+ * producer, each on a cache line of its own. both sides also keep a stale
+ * copy of the other's index and reload it only when the copy says empty or
+ * full, so in the steady state a push or a pop touches no line the other
+ * side writes.
+ */
+template <typename T, typename Alloc = alloc>
+class spsc_queue {
+public:
+	typedef T value_type;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
+	typedef size_t size_type;
+protected:
+	typedef simple_alloc<value_type, Alloc> data_allocator;
+
+	value_type* buffer;
+	size_type mask;
+
+	/* consumer side */
+	alignas(__cache_line_size) atomic<size_type> head;
+	size_type cached_tail;
+
+	/* producer side */
+	alignas(__cache_line_size) atomic<size_type> tail;
+	size_type cached_head;
+
+	spsc_queue(const spsc_queue&);
+	spsc_queue& operator=(const spsc_queue&);
+
+public:
+	explicit spsc_queue(size_type n)
+		: mask(__ring_capacity(n) - 1), head(0), cached_tail(0),
+		  tail(0), cached_head(0)
+	{ buffer = data_allocator::allocate(mask + 1); }
+
+	~spsc_queue()
+	{
+		size_type t = tail.load(memory_order_relaxed);
+		for (size_type h = head.load(memory_order_relaxed); h != t; ++h)
+			destroy(buffer + (h & mask));
+		data_allocator::deallocate(buffer, mask + 1);
+	}
+
+	size_type capacity() const { return mask + 1; }
+
+	/* exact on either side, a snapshot from any other thread */
+	size_type size() const
+	{
+		size_type h = head.load(memory_order_acquire);
+		size_type n = tail.load(memory_order_acquire) - h;
+		return n < capacity() ? n : capacity();
+	}
+
+	bool empty() const { return size() == 0; }
+
+	/* producer: false when full */
+	bool push(const value_type& x)
+	{
+		const size_type t = tail.load(memory_order_relaxed);
+		if (t - cached_head == capacity()) {
+			cached_head = head.load(memory_order_acquire);
+			if (t - cached_head == capacity())
+				return false;
+		}
+		construct(buffer + (t & mask), x);
+		tail.store(t + 1, memory_order_release);
+		return true;
+	}
+
+	/* producer: as much of [first, last) as fits, published at once */
+	template <typename InputIterator>
+	size_type push(InputIterator first, InputIterator last)
+	{
+		const size_type t = tail.load(memory_order_relaxed);
+		cached_head = head.load(memory_order_acquire);
+		const size_type room = capacity() - (t - cached_head);
+		size_type n = 0;
+		__STL_TRY {
+			for (; n < room && first != last; ++n, ++first)
+				construct(buffer + ((t + n) & mask), *first);
+		}
+		__STL_UNWIND(for (size_type i = 0; i < n; ++i)
+		                 destroy(buffer + ((t + i) & mask)));
+		tail.store(t + n, memory_order_release);
+		return n;
+	}
+
+	/* consumer, after empty() said false */
+	reference front() { return buffer[head.load(memory_order_relaxed) & mask]; }
+
+	void pop()
+	{
+		const size_type h = head.load(memory_order_relaxed);
+		if (h == cached_tail)
+			cached_tail = h + 1;  /* the others count on cached_tail >= head */
+		destroy(buffer + (h & mask));
+		head.store(h + 1, memory_order_release);
+	}
+
+	/* consumer: false when empty */
+	bool pop(value_type& x)
+	{
+		const size_type h = head.load(memory_order_relaxed);
+		if (h == cached_tail) {
+			cached_tail = tail.load(memory_order_acquire);
+			if (h == cached_tail)
+				return false;
+		}
+		value_type* p = buffer + (h & mask);
+		x = *p;
+		destroy(p);
+		head.store(h + 1, memory_order_release);
+		return true;
+	}
+
+	/* consumer: up to n values to result, released at once */
+	template <typename OutputIterator>
+	size_type pop(OutputIterator result, size_type n)
+	{
+		const size_type h = head.load(memory_order_relaxed);
+		if (cached_tail - h < n)
+			cached_tail = tail.load(memory_order_acquire);
+		if (n > cached_tail - h)
+			n = cached_tail - h;
+		size_type i = 0;
+		__STL_TRY {
+			for (; i < n; ++i, ++result) {
+				value_type* p = buffer + ((h + i) & mask);
+				*result = *p;
+				destroy(p);
+			}
+		}
+		__STL_UNWIND(head.store(h + i, memory_order_release));
+		head.store(h + n, memory_order_release);
+		return n;
+	}
+};
+
+template <typename T>
+struct __mpmc_cell
+{
+	atomic<size_t> sequence;
+	T value_field;
+};
+
+/*
+ * bounded queue for any number of producers and consumers. every cell
+ * has a sequence number saying which lap of the ring it is on: pos while
+ * it waits for the producer of position pos, pos + 1 once it holds that
+ * value, pos + capacity after it was consumed. a thread claims positions
+ * with one CAS on enqueue_pos or dequeue_pos and then owns those cells,
+ * so threads working on different cells don't wait for each other. a
+ * batch claims a run of ready cells with a single CAS.
+ *
+ * a claimed cell has to be completed, so copying a value_type in or out
+ * must not throw.
+ *
+ * there is no front(): with several consumers the head cell can be taken
+ * and reused between a peek and the pop after it, a reference to it would
+ * dangle. pop(x) claims the cell and copies the value out in one step.
+ */
+template <typename T, typename Alloc = alloc>
+class mpmc_queue {
+public:
+	typedef T value_type;
+	typedef value_type& reference;
+	typedef const value_type& const_reference;
+	typedef size_t size_type;
+protected:
+	typedef __mpmc_cell<T> cell;
+	typedef simple_alloc<cell, Alloc> cell_allocator;
+
+	cell* buffer;
+	size_type mask;
+
+	alignas(__cache_line_size) atomic<size_type> enqueue_pos;
+	alignas(__cache_line_size) atomic<size_type> dequeue_pos;
+
+	/* how many cells from pos on are at sequence pos + i + lap, at most n */
+	size_type ready(size_type pos, size_type n, size_type lap) const
+	{
+		size_type i = 0;
+		while (i < n && buffer[(pos + i) & mask].sequence.load(memory_order_acquire)
+				== pos + i + lap)
+			++i;
+		return i;
+	}
+
+	/*
+	 * claim up to n positions of index, lap 0 for producers and 1 for
+	 * consumers. 0 means full or empty: the first cell is a lap behind.
+	 */
+	size_type claim(atomic<size_type>& index, size_type n, size_type lap,
+	                size_type& pos)
+	{
+		if (n == 0)
+			return 0;
+		if (n > capacity())
+			n = capacity();
+		pos = index.load(memory_order_relaxed);
+		for (;;) {
+			size_type m = ready(pos, n, lap);
+			if (m == 0) {
+				size_type seq = buffer[pos & mask].sequence.load(memory_order_acquire);
+				if (ptrdiff_t(seq - (pos + lap)) < 0)
+					return 0;
+				pos = index.load(memory_order_relaxed);  /* someone got there first */
+			} else if (index.compare_exchange_weak(pos, pos + m,
+					memory_order_relaxed, memory_order_relaxed)) {
+				return m;
+			}
+		}
+	}
+
+	void put(size_type pos, const value_type& x)
+	{
+		cell* c = buffer + (pos & mask);
+		construct(&c->value_field, x);
+		c->sequence.store(pos + 1, memory_order_release);
+	}
+
+	template <typename OutputIterator>
+	void take(size_type pos, OutputIterator result)
+	{
+		cell* c = buffer + (pos & mask);
+		*result = c->value_field;
+		destroy(&c->value_field);
+		c->sequence.store(pos + mask + 1, memory_order_release);
+	}
+
+	mpmc_queue(const mpmc_queue&);
+	mpmc_queue& operator=(const mpmc_queue&);
+
+public:
+	explicit mpmc_queue(size_type n)
+		: mask(__ring_capacity(n) - 1), enqueue_pos(0), dequeue_pos(0)
+	{
+		buffer = cell_allocator::allocate(mask + 1);
+		for (size_type i = 0; i <= mask; ++i)
+			new (&buffer[i].sequence) atomic<size_type>(i);
+	}
+
+	/* not thread safe, like the destruction of any container */
+	~mpmc_queue()
+	{
+		size_type e = enqueue_pos.load(memory_order_relaxed);
+		for (size_type d = dequeue_pos.load(memory_order_relaxed); d != e; ++d)
+			destroy(&buffer[d & mask].value_field);
+		cell_allocator::deallocate(buffer, mask + 1);
+	}
+
+	size_type capacity() const { return mask + 1; }
+
+	/* a snapshot, claimed cells count as full */
+	size_type size() const
+	{
+		size_type d = dequeue_pos.load(memory_order_acquire);
+		size_type n = enqueue_pos.load(memory_order_acquire) - d;
+		return n < capacity() ? n : capacity();
+	}
+
+	bool empty() const { return size() == 0; }
+
+	/* false when full */
+	bool push(const value_type& x)
+	{
+		size_type pos;
+		if (claim(enqueue_pos, 1, 0, pos) == 0)
+			return false;
+		put(pos, x);
+		return true;
+	}
+
+	/* a prefix of [first, last) as long as there are free cells */
+	template <typename ForwardIterator>
+	size_type push(ForwardIterator first, ForwardIterator last)
+	{
+		size_type n = 0;
+		distance(first, last, n);
+		size_type pos;
+		n = claim(enqueue_pos, n, 0, pos);
+		for (size_type i = 0; i < n; ++i, ++first)
+			put(pos + i, *first);
+		return n;
+	}
+
+	/* false when empty */
+	bool pop(value_type& x)
+	{
+		size_type pos;
+		if (claim(dequeue_pos, 1, 1, pos) == 0)
+			return false;
+		take(pos, &x);
+		return true;
+	}
+
+	/* up to n values to result */
+	template <typename OutputIterator>
+	size_type pop(OutputIterator result, size_type n)
+	{
+		size_type pos;
+		n = claim(dequeue_pos, n, 1, pos);
+		for (size_type i = 0; i < n; ++i, ++result)
+			take(pos + i, result);
+		return n;
+	}
+};
+
+#endif
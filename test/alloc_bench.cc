@@ -0,0 +1,60 @@
+#include "test_env.h"
+#include <functional>
+#include "../hashtable_impl.h"
+
+/*
+ * build a hashtable of n random long keys, look every key up and destroy
+ * it, with nodes from malloc and from each allocator of alloc_impl.h.
+ * heap is what the allocator took from the system; malloc's own per
+ * block overhead is not counted. the arena drops the table with
+ * forget_nodes() and release() instead of freeing node by node. build
+ * with -O2.
+ */
+struct malloc_node_alloc {
+	static void* allocate(size_t n) { return __malloc_alloc::allocate(n); }
+	static void deallocate(void* p, size_t n) { __malloc_alloc::deallocate(p, n); }
+};
+
+template <typename Alloc> size_t heap_of() { return Alloc::heap_bytes(); }
+template <> size_t heap_of<malloc_node_alloc>() { return 0; }
+template <> size_t heap_of<__thread_cache_alloc<6> >()
+{ return __pool_alloc<true, 6>::heap_bytes(); }
+
+template <typename Alloc>
+void run(const char* name, long n, bool arena = false)
+{
+	typedef hashtable<long, long, std::hash<long>, test_identity,
+			std::equal_to<long>, Alloc> table;
+	double t0 = test_seconds(), t1, t2;
+	size_t bytes, found = 0;
+	{
+		table ht(n, std::hash<long>(), std::equal_to<long>());
+		for (long i = 0; i < n; ++i)
+			ht.insert_unique(long(test_rand() >> 1));
+		t1 = test_seconds();
+		for (typename table::iterator it = ht.begin(); it != ht.end(); ++it)
+			found += ht.count(*it);
+		t2 = test_seconds();
+		bytes = heap_of<Alloc>();
+		if (arena)
+			ht.forget_nodes();
+	}
+	if (arena)
+		__arena_alloc<9>::release();
+	double t3 = test_seconds();
+	printf("%-12s n=%-8ld insert %6.1f  find %5.1f  destroy %5.1f ns/node"
+	       "  heap %6.1f MB  (%lu)\n", name, n, (t1 - t0) * 1e9 / n,
+	       (t2 - t1) * 1e9 / n, (t3 - t2) * 1e9 / n, bytes / 1048576.0,
+	       (unsigned long) found);
+}
+
+int main()
+{
+	for (long n = 100000; n <= 1600000; n *= 4) {
+		run<malloc_node_alloc>("malloc", n);
+		run<__pool_alloc<false, 8> >("pool", n);
+		run<__pool_alloc<true, 7> >("locked pool", n);
+		run<__thread_cache_alloc<6> >("thread cache", n);
+		run<__arena_alloc<9> >("arena", n, true);
+	}
+}
@@ -0,0 +1,261 @@
+#include "test_env.h"
+#include <functional>
+#include <list>
+#include <unordered_set>
+#include "../hashtable_impl.h"
+#include "../rb_tree_impl.h"
+#include "../list_impl.h"
+
+/*
+ * random allocate/deallocate of every size class: each live block is
+ * filled with its own byte and must still hold it when it is freed, so
+ * two blocks handed out twice or overlapping show up. then the node
+ * containers on each allocator, list against std::list, and the arena's
+ * drop path: forget_nodes() and release() without visiting a node.
+ */
+template <typename Alloc>
+void check_blocks(const char* name)
+{
+	struct live { unsigned char* p; size_t n; unsigned char c; };
+	std::vector<live> blocks;
+
+	for (int i = 0; i < 200000; ++i) {
+		if (blocks.empty() || test_rand() % 5 < 3) {
+			size_t n = 1 + test_rand() % (__MAX_BYTES + 64);
+			live b = { (unsigned char*) Alloc::allocate(n), n,
+			           (unsigned char) test_rand() };
+			assert(((uintptr_t) b.p & (__ALIGN - 1)) == 0);
+			memset(b.p, b.c, n);
+			blocks.push_back(b);
+		} else {
+			size_t k = test_rand() % blocks.size();
+			live b = blocks[k];
+			for (size_t j = 0; j < b.n; ++j)
+				assert(b.p[j] == b.c);
+			Alloc::deallocate(b.p, b.n);
+			blocks[k] = blocks.back();
+			blocks.pop_back();
+		}
+	}
+	for (size_t k = 0; k < blocks.size(); ++k)
+		Alloc::deallocate(blocks[k].p, blocks[k].n);
+	printf("%s: ok\n", name);
+}
+
+/* the node containers run unchanged on each allocator */
+template <typename Alloc>
+void check_hashtable(const char* name)
+{
+	struct hash_s {
+		size_t operator()(const test_string& x) const
+		{ return std::hash<std::string>()(x.s); }
+	};
+	hashtable<test_string, test_string, hash_s, test_identity,
+			std::equal_to<test_string>, Alloc> ht(10, hash_s(),
+			std::equal_to<test_string>());
+	std::unordered_set<std::string> ref;
+
+	for (int i = 0; i < 50000; ++i) {
+		test_string k(long(test_rand() % 10000));
+		if (test_rand() % 3)
+			assert(ht.insert_unique(k).second == ref.insert(k.s).second);
+		else
+			assert(ht.erase(k) == ref.erase(k.s));
+	}
+	assert(ht.size() == ref.size());
+	printf("%s hashtable: ok\n", name);
+}
+
+template <typename Alloc>
+void check_list(const char* name)
+{
+	typedef list<test_string, Alloc> seq;
+	seq l;
+	std::list<test_string> ref;
+	long next = 0;
+
+	for (int i = 0; i < 30000; ++i) {
+		switch (test_rand() % 10) {
+		case 0:
+			l.push_back(test_string(next));
+			ref.push_back(test_string(next++));
+			break;
+		case 1:
+			l.push_front(test_string(next));
+			ref.push_front(test_string(next++));
+			break;
+		case 2: {
+			/* at a random position, the same one in both */
+			size_t k = size_t(test_rand() % (ref.size() + 1));
+			typename seq::iterator p = l.begin();
+			std::list<test_string>::iterator q = ref.begin();
+			for (size_t j = 0; j < k; ++j, ++p, ++q)
+				;
+			if (test_rand() % 2) {
+				assert(*l.insert(p, test_string(next)) == test_string(next));
+				ref.insert(q, test_string(next++));
+			} else if (k < ref.size()) {
+				l.erase(p);
+				ref.erase(q);
+			}
+			break;
+		}
+		case 3:
+			if (!ref.empty()) {
+				l.pop_front();
+				ref.pop_front();
+			}
+			break;
+		case 4:
+			if (!ref.empty()) {
+				l.pop_back();
+				ref.pop_back();
+			}
+			break;
+		case 5: {
+			/* duplicates for unique and remove */
+			test_string x(long(test_rand() % 8));
+			l.push_back(x);
+			l.push_back(x);
+			ref.push_back(x);
+			ref.push_back(x);
+			if (test_rand() % 2) {
+				l.unique();
+				ref.unique();
+			} else {
+				l.remove(x);
+				ref.remove(x);
+			}
+			break;
+		}
+		case 6:
+			if (test_rand() % 20 == 0) {
+				l.sort();
+				ref.sort();
+			} else {
+				l.reverse();
+				ref.reverse();
+			}
+			break;
+		case 7: {
+			seq a, b;
+			std::list<test_string> ra, rb;
+			for (int j = int(test_rand() % 6); j > 0; --j) {
+				test_string x(next++);
+				(test_rand() % 2 ? a : b).push_back(x);
+				(a.size() > ra.size() ? ra : rb).push_back(x);
+			}
+			a.sort();
+			b.sort();
+			a.merge(b);
+			ra.sort();
+			rb.sort();
+			ra.merge(rb);
+			assert(b.empty() && a.size() == ra.size());
+			assert(std::equal(a.begin(), a.end(), ra.begin()));
+			l.splice(l.end(), a);
+			ref.splice(ref.end(), ra);
+			break;
+		}
+		case 8:
+			if (test_rand() % 100 == 0) {
+				l.clear();
+				ref.clear();
+			}
+			break;
+		default: {
+			seq c(l), d;
+			d = c;
+			assert(d.size() == ref.size());
+			assert(std::equal(d.begin(), d.end(), ref.begin()));
+			break;
+		}
+		}
+		assert(l.size() == ref.size() && l.empty() == ref.empty());
+		if (!ref.empty())
+			assert(l.front() == ref.front() && l.back() == ref.back());
+	}
+	assert(std::equal(l.begin(), l.end(), ref.begin()));
+	printf("%s list: ok\n", name);
+}
+
+/* a value that counts its destructors, none of which forget_nodes runs */
+struct counted {
+	long v;
+	static long destroyed;
+	counted(long x) : v(x) {}
+	~counted() { ++destroyed; }
+	bool operator<(const counted& x) const { return v < x.v; }
+	bool operator==(const counted& x) const { return v == x.v; }
+};
+
+long counted::destroyed = 0;
+
+struct counted_key {
+	const long& operator()(const counted& x) const { return x.v; }
+};
+
+void check_arena_drop()
+{
+	typedef __arena_alloc<5> arena;
+	long before;
+	{
+		hashtable<counted, long, std::hash<long>, counted_key,
+				std::equal_to<long>, arena> ht(10, std::hash<long>(),
+				std::equal_to<long>());
+		rb_tree<long, counted, counted_key, std::less<long>, arena> t;
+		list<counted, arena> l;
+		for (long i = 0; i < 20000; ++i) {
+			ht.insert_unique(counted(i));
+			t.insert_unique(counted(i));
+			l.push_back(counted(i));
+		}
+		before = counted::destroyed;
+		ht.forget_nodes();
+		t.forget_nodes();
+		l.forget_nodes();
+		assert(counted::destroyed == before);
+		assert(ht.size() == 0 && t.size() == 0 && l.empty());
+
+		/* they work on as empty containers */
+		ht.insert_unique(counted(1));
+		t.insert_unique(counted(1));
+		l.push_back(counted(1));
+		assert(ht.size() == 1 && t.size() == 1 && l.size() == 1);
+		ht.forget_nodes();
+		t.forget_nodes();
+		l.forget_nodes();
+		before = counted::destroyed;
+	}
+	assert(counted::destroyed == before);  /* the destructors had none to visit */
+	assert(arena::heap_bytes() > 0);
+	arena::release();
+	assert(arena::heap_bytes() == 0);
+	printf("arena drop: ok\n");
+}
+
+int main()
+{
+	check_blocks<__pool_alloc<false, 1> >("pool");
+	check_blocks<__pool_alloc<true, 2> >("locked pool");
+	check_blocks<alloc>("thread cache");
+
+	check_hashtable<__pool_alloc<false, 3> >("pool");
+	check_hashtable<alloc>("thread cache");
+	check_hashtable<__arena_alloc<4> >("arena");
+
+	check_list<__pool_alloc<false, 3> >("pool");
+	check_list<alloc>("thread cache");
+	check_list<__arena_alloc<4> >("arena");
+
+	/* an arena gives everything back at once */
+	assert(__arena_alloc<4>::heap_bytes() > 0);
+	__arena_alloc<4>::release();
+	assert(__arena_alloc<4>::heap_bytes() == 0);
+	void* p = __arena_alloc<4>::allocate(3 * __ARENA_BLOCK);
+	memset(p, 1, 3 * __ARENA_BLOCK);
+	__arena_alloc<4>::release();
+	printf("arena release: ok\n");
+
+	check_arena_drop();
+}
@@ -0,0 +1,131 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../btree_impl.h"
+
+/*
+ * random inserts and bound queries checked against multiset, then
+ * inserts whose value copy or assignment throws part way through a
+ * shift or a split.
+ */
+template <typename T>
+void check(const char* name, long keys)
+{
+	typedef btree<T, T, test_identity, std::less<T> > tree;
+	tree t;
+	std::multiset<T> ref;
+
+	for (int i = 0; i < 60000; ++i) {
+		T k = T(long(test_rand() % keys));
+		switch (test_rand() % 4) {
+		case 0: {
+			pair<typename tree::iterator, bool> r = t.insert_unique(k);
+			assert(r.second == (ref.count(k) == 0) && *r.first == k);
+			if (r.second)
+				ref.insert(k);
+			break;
+		}
+		case 1:
+			assert(*t.insert_equal(k) == k);
+			ref.insert(k);
+			break;
+		default: {
+			assert(t.count(k) == ref.count(k));
+			assert((t.find(k) == t.end()) == (ref.count(k) == 0));
+			typename std::multiset<T>::iterator lo = ref.lower_bound(k);
+			typename std::multiset<T>::iterator hi = ref.upper_bound(k);
+			typename tree::iterator tlo = t.lower_bound(k), thi = t.upper_bound(k);
+			assert((tlo == t.end()) == (lo == ref.end()));
+			assert((thi == t.end()) == (hi == ref.end()));
+			if (lo != ref.end())
+				assert(*tlo == *lo);
+			if (hi != ref.end())
+				assert(*thi == *hi);
+			break;
+		}
+		}
+		assert(t.size() == ref.size());
+	}
+
+	/* both directions visit the values in order */
+	assert(std::equal(t.begin(), t.end(), ref.begin()));
+	typename tree::iterator it = t.end();
+	for (typename std::multiset<T>::reverse_iterator r = ref.rbegin();
+			r != ref.rend(); ++r)
+		assert(*--it == *r);
+	assert(it == t.begin());
+
+	tree copy(t), assigned;
+	assigned = copy;
+	assert(copy.size() == ref.size() && std::equal(copy.begin(), copy.end(), ref.begin()));
+	assert(assigned.size() == ref.size() &&
+	       std::equal(assigned.begin(), assigned.end(), ref.begin()));
+	t.clear();
+	assert(t.empty() && t.begin() == t.end());
+	printf("%s: ok (%d values per node)\n", name, int(tree::slots));
+}
+
+struct counted {
+	long v;
+	static long live;
+	static long budget;  /* copies and assignments left before one throws */
+
+	counted(long x) : v(x) { ++live; }
+	counted(const counted& x) : v(x.v)
+	{
+		if (budget-- == 0)
+			throw 1;
+		++live;
+	}
+	counted& operator=(const counted& x)
+	{
+		if (budget-- == 0)
+			throw 1;
+		v = x.v;
+		return *this;
+	}
+	~counted() { --live; }
+	bool operator<(const counted& x) const { return v < x.v; }
+};
+
+long counted::live = 0;
+long counted::budget = -1;
+
+struct counted_key {
+	const long& operator()(const counted& x) const { return x.v; }
+};
+
+void throwing()
+{
+	typedef btree<long, counted, counted_key, std::less<long> > tree;
+	{
+		tree t;
+		std::multiset<long> ref;
+		for (int i = 0; i < 20000; ++i) {
+			long k = long(test_rand() % 5000);
+			counted::budget = long(test_rand() % 8);
+			try {
+				t.insert_equal(counted(k));
+				ref.insert(k);
+			} catch (int) {
+			}
+			counted::budget = -1;
+			assert(t.size() == ref.size() && counted::live == long(ref.size()));
+			if (i % 500 == 0) {
+				std::multiset<long>::iterator r = ref.begin();
+				for (tree::iterator it = t.begin(); it != t.end(); ++it, ++r)
+					assert(it->v == *r);
+			}
+		}
+	}
+	assert(counted::live == 0);
+	printf("throwing copy: ok\n");
+}
+
+int main()
+{
+	check<long>("long", 20000);
+	check<long>("long, many duplicates", 50);
+	check<test_string>("string", 20000);
+	throwing();
+}
@@ -0,0 +1,57 @@
+#include "test_env.h"
+#include <functional>
+#include "../compact_rb_tree_impl.h"
+
+/*
+ * footprint and speed of rb_tree against compact_rb_tree on int keys:
+ * bytes asked of the allocator per node, then random insert, find,
+ * in-order walk and destroy, with nodes from the thread cache. build
+ * with -O2.
+ */
+template <int inst>
+struct counting_alloc {
+	static size_t bytes;
+	static void* allocate(size_t n) { bytes += n; return alloc::allocate(n); }
+	static void deallocate(void* p, size_t n) { bytes -= n; alloc::deallocate(p, n); }
+};
+
+template <int inst> size_t counting_alloc<inst>::bytes = 0;
+
+template <typename Tree, typename Alloc>
+void run(const char* name, int n)
+{
+	double t0 = test_seconds(), t1, t2, t3;
+	size_t bytes, found = 0;
+	long sum = 0;
+	{
+		Tree t;
+		for (int i = 0; i < n; ++i)
+			t.insert_unique(int(test_rand() >> 1));
+		bytes = Alloc::bytes;
+		t1 = test_seconds();
+		for (int i = 0; i < n; ++i)
+			found += t.find(int(test_rand() >> 1)) != t.end();
+		t2 = test_seconds();
+		for (typename Tree::iterator it = t.begin(); it != t.end(); ++it)
+			sum += *it;
+		t3 = test_seconds();
+	}
+	double t4 = test_seconds();
+	printf("%-8s n=%-8d %5.1f B/node  insert %6.1f  find %6.1f  walk %5.1f"
+	       "  destroy %5.1f ns/node  (%lu %ld)\n", name, n, double(bytes) / n,
+	       (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n, (t3 - t2) * 1e9 / n,
+	       (t4 - t3) * 1e9 / n, (unsigned long) found, sum);
+}
+
+int main()
+{
+	typedef counting_alloc<0> a0;
+	typedef counting_alloc<1> a1;
+	printf("node size: rb_tree %lu, compact %lu bytes\n",
+	       (unsigned long) sizeof(__rb_tree_node<int>),
+	       (unsigned long) sizeof(__compact_rb_tree_node<int>));
+	for (int n = 100000; n <= 6400000; n *= 4) {
+		run<rb_tree<int, int, test_identity, std::less<int>, a0>, a0>("rb_tree", n);
+		run<compact_rb_tree<int, int, test_identity, std::less<int>, a1>, a1>("compact", n);
+	}
+}
@@ -0,0 +1,114 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../compact_rb_tree_impl.h"
+
+/*
+ * inserts, erases and bound queries against multiset, with the red-black
+ * invariants checked through the packed parent/color word, and the node
+ * size the packing is for.
+ */
+typedef compact_rb_tree<long, long, test_identity, std::less<long> > tree;
+typedef __rb_tree_compact_node_base* base_ptr;
+
+int check_node(base_ptr x, base_ptr p, size_t& size)
+{
+	if (x == 0) {
+		size = 0;
+		return 1;
+	}
+	assert(__rb_tree_parent(x) == p);
+	if (__rb_tree_color(x) == __rb_tree_red)
+		assert((!x->left || __rb_tree_color(x->left) == __rb_tree_black) &&
+		       (!x->right || __rb_tree_color(x->right) == __rb_tree_black));
+	size_t l, r;
+	int bl = check_node(x->left, x, l);
+	int br = check_node(x->right, x, r);
+	assert(bl == br);
+	size = l + r + 1;
+	return bl + (__rb_tree_color(x) == __rb_tree_black);
+}
+
+void check(tree& t, const std::multiset<long>& ref)
+{
+	base_ptr header = t.end().node;
+	base_ptr root = __rb_tree_parent(header);
+	assert(__rb_tree_color(header) == __rb_tree_red);
+	size_t n;
+	if (root) {
+		assert(__rb_tree_color(root) == __rb_tree_black);
+		assert(header->left == __rb_tree_compact_node_base::minimum(root));
+		assert(header->right == __rb_tree_compact_node_base::maximum(root));
+	}
+	check_node(root, header, n);
+	assert(n == ref.size() && t.size() == ref.size());
+	assert(std::equal(t.begin(), t.end(), ref.begin()));
+	if (!ref.empty()) {
+		tree::iterator last = t.end();
+		assert(*--last == *ref.rbegin());
+	}
+}
+
+int main()
+{
+	assert(sizeof(__compact_rb_tree_node<int>) + sizeof(void*) ==
+			sizeof(__rb_tree_node<int>));
+
+	tree t;
+	std::multiset<long> ref;
+	for (int i = 0; i < 60000; ++i) {
+		long k = long(test_rand() % 3000);
+		switch (test_rand() % 6) {
+		case 0:
+			t.insert_equal(k);
+			ref.insert(k);
+			break;
+		case 1: {
+			pair<tree::iterator, bool> r = t.insert_unique(k);
+			assert(*r.first == k && r.second == (ref.count(k) == 0));
+			if (r.second)
+				ref.insert(k);
+			break;
+		}
+		case 2:
+			assert(t.erase(k) == ref.erase(k));
+			break;
+		case 3: {
+			tree::iterator it = t.find(k);
+			assert((it == t.end()) == (ref.count(k) == 0));
+			if (it != t.end()) {
+				t.erase(it);
+				ref.erase(ref.find(k));
+			}
+			break;
+		}
+		default: {
+			assert(t.count(k) == ref.count(k));
+			tree::iterator lo = t.lower_bound(k), hi = t.upper_bound(k);
+			std::multiset<long>::iterator rlo = ref.lower_bound(k), rhi = ref.upper_bound(k);
+			assert((lo == t.end()) == (rlo == ref.end()));
+			assert((hi == t.end()) == (rhi == ref.end()));
+			if (rlo != ref.end())
+				assert(*lo == *rlo);
+			if (rhi != ref.end())
+				assert(*hi == *rhi);
+			assert(t.equal_range(k).first == lo && t.equal_range(k).second == hi);
+			break;
+		}
+		}
+		if (i % 1000 == 0)
+			check(t, ref);
+	}
+	check(t, ref);
+
+	/* walk back from end to begin */
+	std::multiset<long>::reverse_iterator r = ref.rbegin();
+	for (tree::iterator it = t.end(); it != t.begin(); ++r)
+		assert(*--it == *r);
+	assert(r == ref.rend());
+
+	t.clear();
+	ref.clear();
+	check(t, ref);
+	printf("compact rb_tree: ok\n");
+}
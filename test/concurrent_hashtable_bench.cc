@@ -0,0 +1,58 @@
+#include "test_env.h"
+#include <functional>
+#include "../concurrent_hashtable_impl.h"
+
+/*
+ * operations per second of 1 to 8 threads on a mix of 90% find and 10%
+ * insert or erase, with one shard (a single reader/writer lock around a
+ * hashtable) and with the default 64. the scaling only shows on a
+ * machine with as many cores as threads. build with -O2.
+ */
+typedef concurrent_hashtable<long, long, std::hash<long>, test_identity,
+		std::equal_to<long> > table;
+
+const long keys = 1 << 20;
+const long ops = 2000000;
+
+void worker(table* ht, int id, long n)
+{
+	unsigned long s = 77 + id;
+	long v;
+	for (long i = 0; i < n; ++i) {
+		s = s * 6364136223846793005UL + 1442695040888963407UL;
+		long k = long((s >> 33) % keys);
+		unsigned op = (s >> 16) % 20;
+		if (op == 0)
+			ht->insert_unique(k);
+		else if (op == 1)
+			ht->erase(k);
+		else
+			ht->find(k, v);
+	}
+}
+
+void run(size_t shards, int threads)
+{
+	table ht(keys, std::hash<long>(), std::equal_to<long>(), shards);
+	for (long k = 0; k < keys; k += 2)
+		ht.insert_unique(k);
+
+	std::vector<std::thread> t;
+	double t0 = test_seconds();
+	for (int i = 0; i < threads; ++i)
+		t.push_back(std::thread(worker, &ht, i, ops / threads));
+	for (int i = 0; i < threads; ++i)
+		t[i].join();
+	double t1 = test_seconds();
+	printf("shards=%-3lu threads=%d  %6.2f Mops/s\n", (unsigned long) shards,
+	       threads, ops / (t1 - t0) / 1e6);
+}
+
+int main()
+{
+	printf("%u hardware threads\n", std::thread::hardware_concurrency());
+	for (int threads = 1; threads <= 8; threads *= 2) {
+		run(1, threads);
+		run(__concurrent_hashtable_shards, threads);
+	}
+}
@@ -0,0 +1,85 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../concurrent_hashtable_impl.h"
+
+/*
+ * writers own disjoint key ranges and check every result against their
+ * own std::set, readers look keys up everywhere meanwhile. build with
+ * -fsanitize=thread as well.
+ */
+typedef concurrent_hashtable<long, long, std::hash<long>, test_identity,
+		std::equal_to<long> > table;
+
+const int writers = 4;
+const int readers = 4;
+const long range = 2000;
+
+void writer(table* ht, int id, std::set<long>* ref)
+{
+	unsigned long s = 12345 + id;
+	for (int i = 0; i < 40000; ++i) {
+		s = s * 6364136223846793005UL + 1442695040888963407UL;
+		long k = id * range + long((s >> 33) % range);
+		switch ((s >> 20) % 3) {
+		case 0:
+			assert(ht->insert_unique(k) == ref->insert(k).second);
+			break;
+		case 1:
+			assert(ht->erase(k) == ref->erase(k));
+			break;
+		default: {
+			long v = -1;
+			assert(ht->find(k, v) == (ref->count(k) == 1));
+			assert(ht->count(k) == ref->count(k));
+			if (ref->count(k))
+				assert(v == k);
+			break;
+		}
+		}
+		if (i % 512 == 0)
+			std::this_thread::yield();
+	}
+}
+
+void reader(table* ht, int id, std::atomic<bool>* stop)
+{
+	unsigned long s = 999 + id;
+	while (!stop->load()) {
+		s = s * 6364136223846793005UL + 1442695040888963407UL;
+		long k = long((s >> 33) % (writers * range)), v = -1;
+		if (ht->find(k, v))
+			assert(v == k);
+		std::this_thread::yield();
+	}
+}
+
+int main()
+{
+	table ht(1000, std::hash<long>(), std::equal_to<long>(), 16);
+	std::set<long> ref[writers];
+	std::atomic<bool> stop(false);
+	std::vector<std::thread> w, r;
+
+	for (int i = 0; i < readers; ++i)
+		r.push_back(std::thread(reader, &ht, i, &stop));
+	for (int i = 0; i < writers; ++i)
+		w.push_back(std::thread(writer, &ht, i, &ref[i]));
+	for (int i = 0; i < writers; ++i)
+		w[i].join();
+	stop = true;
+	for (int i = 0; i < readers; ++i)
+		r[i].join();
+
+	size_t total = 0;
+	for (int i = 0; i < writers; ++i) {
+		total += ref[i].size();
+		for (std::set<long>::iterator it = ref[i].begin(); it != ref[i].end(); ++it)
+			assert(ht.count(*it) == 1);
+	}
+	assert(ht.size() == total);
+	ht.clear();
+	assert(ht.size() == 0);
+	printf("concurrent hashtable: ok (%lu keys left before clear)\n",
+	       (unsigned long) total);
+}
@@ -0,0 +1,103 @@
+#include "test_env.h"
+#include <deque>
+#include "../concurrent_queue_impl.h"
+
+/*
+ * values per second through concurrent_queue, with p producers and as
+ * many consumers, against a std::deque behind a mutex. a consumer that
+ * finds the queue empty yields, which on a machine with fewer cores than
+ * threads is what lets the producers run. first the cost of a push and a
+ * pop on one thread, which is where the per-operation overhead shows.
+ * build with -O2.
+ */
+const long total = 4000000;
+
+struct locked_deque {
+	mutex m;
+	std::deque<long> d;
+
+	void push(long x)
+	{
+		unique_lock<mutex> g(m);
+		d.push_back(x);
+	}
+
+	bool pop(long& x)
+	{
+		unique_lock<mutex> g(m);
+		if (d.empty())
+			return false;
+		x = d.front();
+		d.pop_front();
+		return true;
+	}
+};
+
+template <typename Queue>
+void produce(Queue* q, long n)
+{
+	for (long i = 0; i < n; ++i)
+		q->push(i);
+}
+
+template <typename Queue>
+void consume(Queue* q, atomic<long>* left, long* sum)
+{
+	long s = 0, x;
+	while (left->load(memory_order_relaxed) > 0) {
+		if (q->pop(x)) {
+			s += x;
+			left->fetch_sub(1, memory_order_relaxed);
+		} else {
+			std::this_thread::yield();
+		}
+	}
+	*sum += s;
+}
+
+template <typename Queue>
+void run(const char* name, int threads)
+{
+	Queue q;
+	atomic<long> left(total);
+	long sums[16] = { 0 };
+	std::vector<thread> ts;
+	double t0 = test_seconds();
+	for (int i = 0; i < threads; ++i)
+		ts.push_back(thread(produce<Queue>, &q, total / threads));
+	for (int i = 0; i < threads; ++i)
+		ts.push_back(thread(consume<Queue>, &q, &left, &sums[i]));
+	for (size_t i = 0; i < ts.size(); ++i)
+		ts[i].join();
+	double t = test_seconds() - t0;
+	printf("%-16s %d+%d threads  %6.1f M values/s\n", name, threads, threads,
+	       total / t / 1e6);
+}
+
+template <typename Queue>
+void one_thread(const char* name)
+{
+	Queue q;
+	long s = 0, x;
+	double t0 = test_seconds();
+	for (long i = 0; i < total; ++i) {
+		q.push(i);
+		if (i % 4 == 3)
+			for (int j = 0; j < 4; ++j)
+				s += q.pop(x) ? x : 0;
+	}
+	double t = test_seconds() - t0;
+	printf("%-16s one thread    %6.1f ns per push + pop (%ld)\n", name,
+	       t * 1e9 / total, s);
+}
+
+int main()
+{
+	printf("%u hardware threads\n", thread::hardware_concurrency());
+	one_thread<concurrent_queue<long> >("concurrent_queue");
+	one_thread<locked_deque>("mutex + deque");
+	for (int p = 1; p <= 4; p *= 2) {
+		run<concurrent_queue<long> >("concurrent_queue", p);
+		run<locked_deque>("mutex + deque", p);
+	}
+}
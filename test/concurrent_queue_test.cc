@@ -0,0 +1,105 @@
+#include "test_env.h"
+#include <deque>
+#include "../concurrent_queue_impl.h"
+
+/*
+ * concurrent_queue against std::deque on one thread with segments of 4
+ * values, so that segments fill, retire and come back from the pool, and
+ * two queues in turn to share the thread's hazard record. then producers
+ * and consumers on a queue, every value seen once and each producer's
+ * values in order, with threads that come and go so that records are
+ * handed on. build with -fsanitize=thread as well.
+ */
+void sequential()
+{
+	concurrent_queue<test_string, alloc, 4> q, q2;
+	std::deque<test_string> ref, ref2;
+	long next = 0;
+	for (int i = 0; i < 50000; ++i) {
+		bool second = test_rand() % 3 == 0;
+		concurrent_queue<test_string, alloc, 4>& c = second ? q2 : q;
+		std::deque<test_string>& r = second ? ref2 : ref;
+		if (test_rand() % 2) {
+			c.push(test_string(next));
+			r.push_back(test_string(next++));
+		} else {
+			test_string x(-1);
+			assert(c.pop(x) == !r.empty());
+			if (!r.empty()) {
+				assert(x == r.front());
+				r.pop_front();
+			}
+		}
+		assert(c.empty() == r.empty());
+	}
+	/* the destructors free what is left */
+	printf("concurrent_queue: ok\n");
+}
+
+const int producers = 4;
+const int consumers = 4;
+const long per_producer = 20000;
+atomic<long> consumed(0);
+atomic<int> seen[producers * per_producer];
+
+typedef concurrent_queue<long, alloc, 16> queue;
+
+/* a value is producer * per_producer + i */
+void producer(queue* q, int id, long from, long to)
+{
+	for (long i = from; i < to; ++i) {
+		q->push(id * per_producer + i);
+		if (i % 64 == 0)
+			std::this_thread::yield();
+	}
+}
+
+/* pops until the total is reached or it has taken quota values */
+void consumer(queue* q, long quota)
+{
+	long last[producers];
+	for (int p = 0; p < producers; ++p)
+		last[p] = -1;
+	const long total = producers * per_producer;
+	long mine = 0;
+	while (mine < quota && consumed.load(memory_order_relaxed) < total) {
+		long x;
+		if (!q->pop(x)) {
+			std::this_thread::yield();
+			continue;
+		}
+		int p = int(x / per_producer);
+		assert(x % per_producer > last[p]);  /* one consumer sees order */
+		last[p] = x % per_producer;
+		seen[x].fetch_add(1, memory_order_relaxed);
+		consumed.fetch_add(1, memory_order_relaxed);
+		++mine;
+	}
+}
+
+int main()
+{
+	sequential();
+
+	/* each producer in two halves on two threads, one after the other */
+	queue q;
+	thread p[producers], c[consumers];
+	for (int i = 0; i < producers; ++i)
+		p[i] = thread(producer, &q, i, 0, per_producer / 2);
+	for (int i = 0; i < consumers; ++i)
+		c[i] = thread(consumer, &q, i == 0 ? per_producer : producers * per_producer);
+	for (int i = 0; i < producers; ++i) {
+		p[i].join();
+		p[i] = thread(producer, &q, i, per_producer / 2, per_producer);
+	}
+	for (int i = 0; i < producers; ++i)
+		p[i].join();
+	c[0].join();
+	c[0] = thread(consumer, &q, producers * per_producer);
+	for (int i = 0; i < consumers; ++i)
+		c[i].join();
+	assert(q.empty());
+	for (long v = 0; v < producers * per_producer; ++v)
+		assert(seen[v].load() == 1);
+	printf("threaded concurrent_queue: ok\n");
+}
@@ -0,0 +1,103 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../concurrent_skiplist_impl.h"
+
+/*
+ * inserts and bound queries against set on one thread, then writers
+ * racing on overlapping keys while readers scan. every key must be won
+ * by exactly one writer and a scan must always be sorted. build with
+ * -fsanitize=thread too.
+ */
+typedef concurrent_skiplist<long, long, test_identity, std::less<long> > skiplist;
+
+void sequential()
+{
+	skiplist s;
+	std::set<long> ref;
+
+	for (int i = 0; i < 40000; ++i) {
+		long k = long(test_rand() % 10000);
+		if (test_rand() % 2 == 0) {
+			pair<skiplist::iterator, bool> r = s.insert_unique(k);
+			assert(r.second == ref.insert(k).second);
+			assert(*r.first == k);
+		} else {
+			assert(s.count(k) == ref.count(k));
+			skiplist::const_iterator lo = s.lower_bound(k), hi = s.upper_bound(k);
+			std::set<long>::iterator rlo = ref.lower_bound(k), rhi = ref.upper_bound(k);
+			assert((lo == s.end()) == (rlo == ref.end()));
+			assert((hi == s.end()) == (rhi == ref.end()));
+			if (rlo != ref.end())
+				assert(*lo == *rlo);
+			if (rhi != ref.end())
+				assert(*hi == *rhi);
+		}
+	}
+	assert(s.size() == ref.size());
+	assert(std::equal(s.begin(), s.end(), ref.begin()));
+	printf("skiplist: ok\n");
+}
+
+const int writers = 4;
+const long keys = 4000;
+atomic<int> wins[keys];
+atomic<int> writing(writers);
+
+/* every writer inserts every key, each from its own starting point */
+void writer(skiplist* s, int id)
+{
+	for (long i = 0; i < keys; ++i) {
+		long k = (i * 7 + id * (keys / writers)) % keys;
+		pair<skiplist::iterator, bool> r = s->insert_unique(k);
+		assert(*r.first == k);
+		if (r.second)
+			wins[k].fetch_add(1, memory_order_relaxed);
+		assert(s->find(k) != s->end());
+		if (i % 32 == 0)
+			std::this_thread::yield();
+	}
+	writing.fetch_sub(1, memory_order_release);
+}
+
+void reader(skiplist* s)
+{
+	while (writing.load(memory_order_acquire) > 0) {
+		long prev = -1;
+		size_t n = 0;
+		for (skiplist::const_iterator it = s->begin(); it != s->end(); ++it, ++n) {
+			assert(*it > prev);
+			prev = *it;
+		}
+		assert(n <= size_t(keys));
+		long k = long(test_rand() % keys);
+		skiplist::const_iterator it = s->lower_bound(k);
+		assert(it == s->end() || *it >= k);
+		std::this_thread::yield();
+	}
+}
+
+int main()
+{
+	sequential();
+
+	skiplist s;
+	thread w[writers], r[2];
+	for (int i = 0; i < writers; ++i)
+		w[i] = thread(writer, &s, i);
+	for (int i = 0; i < 2; ++i)
+		r[i] = thread(reader, &s);
+	for (int i = 0; i < writers; ++i)
+		w[i].join();
+	for (int i = 0; i < 2; ++i)
+		r[i].join();
+
+	assert(s.size() == size_t(keys));
+	long k = 0;
+	for (skiplist::const_iterator it = s.begin(); it != s.end(); ++it, ++k) {
+		assert(*it == k);
+		assert(wins[k].load() == 1);
+	}
+	assert(k == keys);
+	printf("threaded skiplist: ok\n");
+}
@@ -0,0 +1,39 @@
+#include "test_env.h"
+#include <deque>
+#include "../deque_impl.h"
+
+/*
+ * a sliding window: 2M push_back, each followed by a pop_front once the
+ * window is full, so buffers are freed at the front as fast as they are
+ * needed at the back. deque keeps the freed one as its spare. against
+ * std::deque, for a few window sizes. build with -O2.
+ */
+const long total = 2000000;
+
+template <typename Deque>
+double slide(long window, long& sink)
+{
+	Deque d;
+	double t0 = test_seconds();
+	for (long i = 0; i < total; ++i) {
+		d.push_back(i);
+		if (i >= window) {
+			sink += d.front();
+			d.pop_front();
+		}
+	}
+	return (test_seconds() - t0) * 1e9 / total;
+}
+
+int main()
+{
+	long sink = 0;
+	for (long w = 16; w <= 1000000; w *= 250) {
+		slide<deque<long> >(w, sink);  /* warm up */
+		double ours = slide<deque<long> >(w, sink);
+		double theirs = slide<std::deque<long> >(w, sink);
+		printf("window %-8ld deque %5.2f  std::deque %5.2f ns per step\n", w,
+		       ours, theirs);
+	}
+	printf("(%ld)\n", sink);
+}
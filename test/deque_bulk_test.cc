@@ -0,0 +1,147 @@
+#include "test_env.h"
+#include <deque>
+#include <iterator>
+#include <sstream>
+#include "../deque_impl.h"
+
+/*
+ * append, prepend and pop_front_n, mixed with the single element calls,
+ * against std::deque, on tiny and default buffers, from forward and from
+ * input iterators. a value whose copy throws after a set number of copies
+ * checks that a failed append or prepend leaves the deque as it was.
+ */
+template <typename Deque>
+void check(Deque& d, const std::deque<long>& ref)
+{
+	assert(d.size() == ref.size());
+	assert(std::equal(d.begin(), d.end(), ref.begin()));
+	if (!ref.empty())
+		assert(d.front() == ref.front() && d.back() == ref.back());
+}
+
+template <size_t BufSize>
+void run(const char* name)
+{
+	typedef deque<long, alloc, BufSize> seq;
+	seq d;
+	std::deque<long> ref;
+	long next = 0;
+
+	for (int i = 0; i < 20000; ++i) {
+		size_t n = size_t(test_rand() % 40);
+		std::vector<long> v;
+		for (size_t j = 0; j < n; ++j)
+			v.push_back(next++);
+		switch (test_rand() % 8) {
+		case 0:
+			d.append(v.begin(), v.end());
+			ref.insert(ref.end(), v.begin(), v.end());
+			break;
+		case 1:
+			d.prepend(v.begin(), v.end());
+			ref.insert(ref.begin(), v.begin(), v.end());
+			break;
+		case 2: {
+			/* input iterators, which can't be counted first */
+			std::ostringstream out;
+			for (size_t j = 0; j < n; ++j)
+				out << v[j] << ' ';
+			std::istringstream in(out.str());
+			if (test_rand() % 2) {
+				d.append(std::istream_iterator<long>(in), std::istream_iterator<long>());
+				ref.insert(ref.end(), v.begin(), v.end());
+			} else {
+				d.prepend(std::istream_iterator<long>(in), std::istream_iterator<long>());
+				ref.insert(ref.begin(), v.begin(), v.end());
+			}
+			break;
+		}
+		case 3:
+		case 4: {
+			/* sometimes more than there is */
+			size_t k = size_t(test_rand() % (ref.size() + 20));
+			d.pop_front_n(k);
+			ref.erase(ref.begin(), ref.begin() + (k < ref.size() ? k : ref.size()));
+			break;
+		}
+		case 5:
+			d.push_back(next);
+			ref.push_back(next++);
+			break;
+		case 6:
+			d.push_front(next);
+			ref.push_front(next++);
+			break;
+		default:
+			if (!ref.empty()) {
+				d.pop_back();
+				ref.pop_back();
+			}
+			break;
+		}
+		if (i % 100 == 0)
+			check(d, ref);
+	}
+	check(d, ref);
+
+	seq c(d), a;
+	a = c;
+	check(c, ref);
+	check(a, ref);
+	printf("%s: ok\n", name);
+}
+
+struct counted {
+	long v;
+	static long live;
+	static long budget;  /* copies left before one throws */
+
+	counted(long x) : v(x) { ++live; }
+	counted(const counted& x) : v(x.v)
+	{
+		if (budget-- == 0)
+			throw 1;
+		++live;
+	}
+	counted& operator=(const counted& x) { v = x.v; return *this; }
+	~counted() { --live; }
+};
+
+long counted::live = 0;
+long counted::budget = -1;
+
+void throwing()
+{
+	deque<counted, alloc, 4> d;
+	std::vector<counted> v;
+	for (long i = 0; i < 50; ++i)
+		v.push_back(counted(i));
+	d.append(v.begin(), v.begin() + 10);
+
+	for (int i = 0; i < 200; ++i) {
+		long before = counted::live;
+		counted::budget = long(test_rand() % 50);
+		bool thrown = false;
+		try {
+			if (i % 2)
+				d.append(v.begin(), v.end());
+			else
+				d.prepend(v.begin(), v.end());
+		} catch (int) {
+			thrown = true;
+		}
+		counted::budget = -1;
+		assert(thrown && counted::live == before && d.size() == 10);
+		for (long k = 0; k < 10; ++k)
+			assert(d[k].v == k);
+	}
+	printf("throwing append and prepend: ok\n");
+}
+
+int main()
+{
+	run<2>("deque bulk, 2 per buffer");
+	run<7>("deque bulk, 7 per buffer");
+	run<0>("deque bulk, default buffer");
+	throwing();
+}
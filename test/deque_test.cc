@@ -0,0 +1,166 @@
+#include "test_env.h"
+#include <deque>
+#include "../deque_impl.h"
+
+/*
+ * push and pop at both ends, insert, erase, clear and copies against
+ * std::deque, on tiny and default buffers, through an allocator that
+ * counts the bytes out. then fill constructors whose copy throws and
+ * whose allocator fails part way: every element and every byte has to
+ * come back.
+ */
+struct counting_alloc {
+	static long bytes;
+	static long budget;  /* allocations left before one fails */
+
+	static void* allocate(size_t n)
+	{
+		if (budget-- == 0)
+			throw bad_alloc();
+		bytes += long(n);
+		return malloc(n);
+	}
+
+	static void deallocate(void* p, size_t n)
+	{
+		bytes -= long(n);
+		free(p);
+	}
+};
+
+long counting_alloc::bytes = 0;
+long counting_alloc::budget = -1;
+
+template <typename Deque>
+void check(Deque& d, const std::deque<test_string>& ref)
+{
+	assert(d.size() == ref.size() && d.empty() == ref.empty());
+	assert(std::equal(d.begin(), d.end(), ref.begin()));
+	if (!ref.empty()) {
+		assert(d.front() == ref.front() && d.back() == ref.back());
+		size_t k = size_t(test_rand() % ref.size());
+		assert(d[k] == ref[k]);
+	}
+}
+
+template <size_t BufSize>
+void run(const char* name)
+{
+	typedef deque<test_string, counting_alloc, BufSize> seq;
+	{
+		seq d;
+		std::deque<test_string> ref;
+		long next = 0;
+		for (int i = 0; i < 30000; ++i) {
+			size_t k = ref.empty() ? 0 : size_t(test_rand() % (ref.size() + 1));
+			switch (test_rand() % 10) {
+			case 0:
+			case 1:
+				d.push_back(test_string(next));
+				ref.push_back(test_string(next++));
+				break;
+			case 2:
+			case 3:
+				d.push_front(test_string(next));
+				ref.push_front(test_string(next++));
+				break;
+			case 4:
+				if (!ref.empty()) {
+					d.pop_back();
+					ref.pop_back();
+				}
+				break;
+			case 5:
+				if (!ref.empty()) {
+					d.pop_front();
+					ref.pop_front();
+				}
+				break;
+			case 6:
+				assert(*d.insert(d.begin() + k, test_string(next)) == test_string(next));
+				ref.insert(ref.begin() + k, test_string(next++));
+				break;
+			case 7:
+				if (k < ref.size()) {
+					d.erase(d.begin() + k);
+					ref.erase(ref.begin() + k);
+				}
+				break;
+			case 8: {
+				size_t m = k + size_t(test_rand() % (ref.size() - k + 1));
+				d.erase(d.begin() + k, d.begin() + m);
+				ref.erase(ref.begin() + k, ref.begin() + m);
+				break;
+			}
+			default:
+				if (test_rand() % 50 == 0) {
+					d.clear();
+					ref.clear();
+				}
+				break;
+			}
+			if (i % 100 == 0)
+				check(d, ref);
+		}
+		check(d, ref);
+		seq c(d), a;
+		a = c;
+		check(c, ref);
+		check(a, ref);
+	}
+	assert(counting_alloc::bytes == 0);
+	printf("%s: ok\n", name);
+}
+
+struct counted {
+	long v;
+	static long live;
+	static long budget;  /* copies left before one throws */
+
+	counted(long x) : v(x) { ++live; }
+	counted(const counted& x) : v(x.v)
+	{
+		if (budget-- == 0)
+			throw 1;
+		++live;
+	}
+	~counted() { --live; }
+};
+
+long counted::live = 0;
+long counted::budget = -1;
+
+void throwing()
+{
+	typedef deque<counted, counting_alloc, 4> seq;
+	counted x(7);
+	for (int i = 0; i < 300; ++i) {
+		int n = int(test_rand() % 40);
+		bool thrown = false;
+		if (i % 2)
+			counted::budget = long(test_rand() % (n + 1));
+		else
+			counting_alloc::budget = long(test_rand() % (n / 4 + 2));
+		try {
+			seq d(n, x);
+			assert(int(d.size()) == n);
+		} catch (int) {
+			thrown = true;
+		} catch (bad_alloc&) {
+			thrown = true;
+		}
+		assert(thrown == ((i % 2 ? counted::budget : counting_alloc::budget) < 0));
+		counted::budget = -1;
+		counting_alloc::budget = -1;
+		assert(counted::live == 1 && counting_alloc::bytes == 0);
+	}
+	printf("throwing fill constructor: ok\n");
+}
+
+int main()
+{
+	run<2>("deque, 2 per buffer");
+	run<7>("deque, 7 per buffer");
+	run<0>("deque, default buffers");
+	throwing();
+}
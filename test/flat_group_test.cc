@@ -0,0 +1,36 @@
+#include "test_env.h"
+#include "../flat_hashtable_impl.h"
+
+/*
+ * the group matches of whichever of AVX2, SSE2 or the byte loop this is
+ * built with, against a plain loop. build it plain, with -mavx2 and with
+ * -U__SSE2__ to cover all three.
+ */
+int main()
+{
+	__flat_ctrl_t ctrl[__flat_group_width];
+	const __flat_ctrl_t special[3] = { __flat_empty, __flat_deleted, __flat_sentinel };
+
+	for (int round = 0; round < 100000; ++round) {
+		for (size_t i = 0; i < __flat_group_width; ++i) {
+			unsigned long r = test_rand();
+			ctrl[i] = r % 4 == 0 ? special[(r >> 8) % 3] : __flat_h2(r >> 8);
+		}
+		__flat_group g(ctrl);
+		__flat_ctrl_t h2 = __flat_h2(test_rand());
+
+		unsigned match = 0, empty = 0, empty_or_deleted = 0;
+		for (size_t i = 0; i < __flat_group_width; ++i) {
+			if (ctrl[i] == h2)
+				match |= 1u << i;
+			if (ctrl[i] == __flat_empty)
+				empty |= 1u << i;
+			if (ctrl[i] == __flat_empty || ctrl[i] == __flat_deleted)
+				empty_or_deleted |= 1u << i;
+		}
+		assert(g.match(h2) == match);
+		assert(g.match_empty() == empty);
+		assert(g.match_empty_or_deleted() == empty_or_deleted);
+	}
+	printf("%d byte groups: ok\n", int(__flat_group_width));
+}
@@ -0,0 +1,136 @@
+#include "test_env.h"
+#include <functional>
+#include <unordered_set>
+#include "../flat_hashtable_impl.h"
+
+struct test_string_hash {
+	size_t operator()(const test_string& x) const
+	{ return std::hash<std::string>()(x.s); }
+};
+
+/* random inserts, finds and erases checked against unordered_set */
+template <typename T, typename Hash>
+void check(const char* name, int keys)
+{
+	typedef flat_hashtable<T, T, Hash, test_identity, std::equal_to<T>, alloc> table;
+	table ht(0, Hash(), std::equal_to<T>());
+	std::unordered_set<T, Hash> ref;
+
+	for (int i = 0; i < 100000; ++i) {
+		T k = T(long(test_rand() % keys));
+		switch (test_rand() % 3) {
+		case 0:
+			assert(ht.insert_unique(k).second == ref.insert(k).second);
+			break;
+		case 1:
+			assert(ht.erase(k) == ref.erase(k));
+			break;
+		default:
+			assert(ht.count(k) == ref.count(k));
+			assert((ht.find(k) == ht.end()) == (ref.count(k) == 0));
+			if (ref.count(k))
+				assert(*ht.find(k) == k);
+			break;
+		}
+		assert(ht.size() == ref.size());
+	}
+
+	size_t n = 0;
+	for (typename table::iterator it = ht.begin(); it != ht.end(); ++it, ++n)
+		assert(ref.count(*it) == 1);
+	assert(n == ref.size());
+
+	table copy(ht);
+	table assigned(0, Hash(), std::equal_to<T>());
+	assigned = copy;
+	for (typename std::unordered_set<T, Hash>::iterator it = ref.begin();
+			it != ref.end(); ++it)
+		assert(copy.count(*it) == 1 && assigned.count(*it) == 1);
+	assert(copy.size() == ref.size() && assigned.size() == ref.size());
+
+	ht.clear();
+	assert(ht.empty() && ht.begin() == ht.end());
+	printf("%s: ok\n", name);
+}
+
+/* a key whose copy throws after a set number of copies */
+struct counted {
+	long v;
+	static long live;
+	static long budget;  /* copies left before one throws */
+
+	counted(long x) : v(x) { ++live; }
+	counted(const counted& x) : v(x.v)
+	{
+		if (budget-- == 0)
+			throw 1;
+		++live;
+	}
+	~counted() { --live; }
+	bool operator==(const counted& x) const { return v == x.v; }
+};
+
+long counted::live = 0;
+long counted::budget = -1;
+
+struct counted_hash {
+	size_t operator()(const counted& x) const { return std::hash<long>()(x.v); }
+};
+
+struct counting_alloc {
+	static long bytes;
+	static void* allocate(size_t n) { bytes += long(n); return malloc(n); }
+	static void deallocate(void* p, size_t n) { bytes -= long(n); free(p); }
+};
+
+long counting_alloc::bytes = 0;
+
+/* a copy that throws in a rehash or a copy constructor loses nothing */
+void throwing()
+{
+	typedef flat_hashtable<counted, counted, counted_hash, test_identity,
+			std::equal_to<counted>, counting_alloc> table;
+	for (int round = 0; round < 200; ++round) {
+		{
+			table ht(0, counted_hash(), std::equal_to<counted>());
+			long n = 0;
+			/* fill up to just before a rehash, then one more insert */
+			size_t cap = ht.bucket_count();
+			while (ht.bucket_count() == cap) {
+				size_t before = ht.size();
+				counted::budget = long(test_rand() % (before + 2));
+				try {
+					ht.insert_unique(counted(n));
+				} catch (int) {
+					assert(ht.size() == before);
+					for (long k = 0; k < n; ++k)
+						assert(ht.count(counted(k)) == 1);
+					assert(counted::live == long(before));
+					counted::budget = -1;
+					continue;
+				}
+				counted::budget = -1;
+				++n;
+			}
+
+			counted::budget = long(test_rand() % (ht.size() + 1));
+			try {
+				table copy(ht);
+				assert(copy.size() == ht.size());
+			} catch (int) {
+			}
+			counted::budget = -1;
+			assert(counted::live == long(ht.size()));
+		}
+		assert(counted::live == 0 && counting_alloc::bytes == 0);
+	}
+	printf("throwing rehash and copy: ok\n");
+}
+
+int main()
+{
+	check<long, std::hash<long> >("long keys", 3000);
+	check<test_string, test_string_hash>("string keys", 3000);
+	check<long, std::hash<long> >("dense long keys", 64);
+	throwing();
+}
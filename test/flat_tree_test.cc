@@ -0,0 +1,207 @@
+#include "test_env.h"
+#include <functional>
+#include <map>
+#include <set>
+#include "../flat_tree_impl.h"
+
+/*
+ * single and batch inserts, erases and the branch-free searches against
+ * multimap and set. a value is a key and a serial number, so the order of
+ * equal keys (old ones first, a batch in input order) is checked too.
+ * then batch inserts whose allocations fail part way, which must leave
+ * the tree as it was and give every byte back.
+ */
+typedef pair<long, long> value;
+
+struct select_key {
+	const long& operator()(const value& x) const { return x.first; }
+};
+
+typedef flat_tree<long, value, select_key, std::less<long> > tree;
+typedef flat_tree<long, long, test_identity, std::less<long> > unique_tree;
+
+long serial = 0;
+
+void check_bounds(const tree& t, const std::multimap<long, long>& ref, long k)
+{
+	tree::const_iterator lo = t.lower_bound(k), hi = t.upper_bound(k);
+	assert(size_t(lo - t.begin()) == size_t(std::distance(ref.begin(), ref.lower_bound(k))));
+	assert(size_t(hi - t.begin()) == size_t(std::distance(ref.begin(), ref.upper_bound(k))));
+	assert(t.count(k) == ref.count(k));
+	assert((t.find(k) == t.end()) == (ref.find(k) == ref.end()));
+	if (t.find(k) != t.end())
+		assert(t.find(k) == lo);
+}
+
+void equal_keys()
+{
+	tree t;
+	std::multimap<long, long> ref;  /* keeps equal keys in insertion order */
+
+	for (int i = 0; i < 20000; ++i) {
+		long k = long(test_rand() % 500);
+		switch (test_rand() % 8) {
+		case 0:
+		case 1: {
+			value v(k, serial++);
+			tree::iterator it = t.insert_equal(v);
+			assert(*it == v);
+			ref.insert(v);
+			break;
+		}
+		case 2: {
+			/* a batch, unsorted, with repeats */
+			std::vector<value> batch;
+			for (int j = int(test_rand() % 40); j > 0; --j)
+				batch.push_back(value(long(test_rand() % 500), serial++));
+			t.insert_equal(batch.begin(), batch.end());
+			for (size_t j = 0; j < batch.size(); ++j)
+				ref.insert(batch[j]);
+			break;
+		}
+		case 3:
+			assert(t.erase(k) == ref.erase(k));
+			break;
+		case 4: {
+			tree::iterator it = t.find(k);
+			if (it != t.end()) {
+				t.erase(it);
+				ref.erase(ref.find(k));
+			}
+			break;
+		}
+		case 5: {
+			tree::iterator lo = t.lower_bound(k), hi = t.upper_bound(k + 3);
+			t.erase(lo, hi);
+			ref.erase(ref.lower_bound(k), ref.upper_bound(k + 3));
+			break;
+		}
+		default:
+			check_bounds(t, ref, k);
+			break;
+		}
+		assert(t.size() == ref.size());
+	}
+	std::vector<value> expect(ref.begin(), ref.end());
+	assert(std::equal(t.begin(), t.end(), expect.begin()));
+
+	/* copy, assignment and swap */
+	tree c(t), a;
+	a = c;
+	assert(std::equal(a.begin(), a.end(), expect.begin()) && a.size() == t.size());
+	tree e;
+	e.swap(a);
+	assert(a.empty() && e.size() == t.size());
+	t.clear();
+	assert(t.empty() && t.begin() == t.end());
+	tree z(t);
+	assert(z.empty());
+	printf("flat_tree equal keys: ok\n");
+}
+
+void unique_keys()
+{
+	unique_tree t;
+	std::set<long> ref;
+
+	for (int i = 0; i < 20000; ++i) {
+		long k = long(test_rand() % 3000);
+		switch (test_rand() % 4) {
+		case 0: {
+			pair<unique_tree::iterator, bool> r = t.insert_unique(k);
+			assert(*r.first == k && r.second == ref.insert(k).second);
+			break;
+		}
+		case 1: {
+			std::vector<long> batch;
+			for (int j = int(test_rand() % 60); j > 0; --j)
+				batch.push_back(long(test_rand() % 3000));
+			t.insert_unique(batch.begin(), batch.end());
+			ref.insert(batch.begin(), batch.end());
+			break;
+		}
+		case 2:
+			assert(t.erase(k) == ref.erase(k));
+			break;
+		default: {
+			unique_tree::const_iterator lo = t.lower_bound(k);
+			std::set<long>::iterator r = ref.lower_bound(k);
+			assert((lo == t.end()) == (r == ref.end()));
+			if (r != ref.end())
+				assert(*lo == *r);
+			break;
+		}
+		}
+		assert(t.size() == ref.size());
+	}
+	assert(std::equal(t.begin(), t.end(), ref.begin()));
+
+	/* a big sorted batch into an empty tree, then reserve keeps it all */
+	unique_tree s;
+	std::vector<long> v;
+	for (long k = 0; k < 10000; ++k)
+		v.push_back(k / 2);
+	s.insert_unique(v.begin(), v.end());
+	assert(s.size() == 5000 && s[0] == 0 && s[4999] == 4999);
+	s.reserve(20000);
+	assert(s.capacity() >= 20000 && s.size() == 5000 && s[2500] == 2500);
+	printf("flat_tree unique keys: ok\n");
+}
+
+struct failing_alloc {
+	static long bytes;
+	static long budget;  /* allocations left before one fails */
+
+	static void* allocate(size_t n)
+	{
+		if (budget-- == 0)
+			throw bad_alloc();
+		bytes += long(n);
+		return malloc(n);
+	}
+
+	static void deallocate(void* p, size_t n)
+	{
+		bytes -= long(n);
+		free(p);
+	}
+};
+
+long failing_alloc::bytes = 0;
+long failing_alloc::budget = -1;
+
+void failing_batches()
+{
+	typedef flat_tree<long, long, test_identity, std::less<long>, failing_alloc> ftree;
+	{
+		ftree t;
+		std::set<long> ref;
+		for (int i = 0; i < 300; ++i) {
+			std::vector<long> batch;
+			for (int j = int(test_rand() % 50) + 1; j > 0; --j)
+				batch.push_back(long(test_rand() % 4000));
+			failing_alloc::budget = long(test_rand() % 8);
+			bool thrown = false;
+			try {
+				t.insert_unique(batch.begin(), batch.end());
+			} catch (bad_alloc&) {
+				thrown = true;
+			}
+			assert(thrown == (failing_alloc::budget < 0));
+			failing_alloc::budget = -1;
+			if (!thrown)
+				ref.insert(batch.begin(), batch.end());
+			assert(t.size() == ref.size());
+			assert(std::equal(t.begin(), t.end(), ref.begin()));
+		}
+	}
+	assert(failing_alloc::bytes == 0);
+	printf("flat_tree failing allocations: ok\n");
+}
+
+int main()
+{
+	equal_keys();
+	unique_keys();
+	failing_batches();
+}
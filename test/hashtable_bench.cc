@@ -0,0 +1,44 @@
+#include "test_env.h"
+#include <functional>
+#include "../hashtable_impl.h"
+
+/*
+ * prime buckets (h % n) against power of 2 buckets (mix and mask) on the
+ * identity hash of long: insert n keys, then find each of them and as
+ * many missing ones. sequential keys favour h % n, which keeps them in
+ * neighbouring buckets, so random keys are timed as well. build with -O2.
+ */
+template <typename Policy>
+void run(const char* name, long n, bool random)
+{
+	typedef hashtable<long, long, std::hash<long>, test_identity,
+			std::equal_to<long>, alloc, Policy> table;
+	table ht(10, std::hash<long>(), std::equal_to<long>());
+
+	std::vector<long> keys(2 * n);
+	for (long i = 0; i < 2 * n; ++i)
+		keys[i] = random ? long(test_rand() >> 1) : i;
+
+	double t0 = test_seconds();
+	for (long i = 0; i < n; ++i)
+		ht.insert_unique(keys[2 * i]);
+	double t1 = test_seconds();
+	size_t found = 0;
+	for (int round = 0; round < 4; ++round)
+		for (long i = 0; i < 2 * n; ++i)
+			found += ht.count(keys[i]);
+	double t2 = test_seconds();
+
+	printf("%-6s %-10s n=%-8ld insert %6.1f ns/op  find %6.1f ns/op  (%lu)\n",
+	       name, random ? "random" : "sequential", n, (t1 - t0) * 1e9 / n,
+	       (t2 - t1) * 1e9 / (8 * n), (unsigned long) found);
+}
+
+int main()
+{
+	for (int random = 0; random < 2; ++random)
+		for (long n = 1000; n <= 1000000; n *= 10) {
+			run<__hashtable_prime_policy>("prime", n, random);
+			run<__hashtable_pow2_policy>("pow2", n, random);
+		}
+}
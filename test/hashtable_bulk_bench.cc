@@ -0,0 +1,53 @@
+#include "test_env.h"
+#include <functional>
+#include "../hashtable_impl.h"
+
+/*
+ * find_many and count_many against a loop of find on random keys, for
+ * tables that fit in cache and tables that don't. half the keys are
+ * missing. build with -O2.
+ */
+typedef hashtable<long, long, std::hash<long>, test_identity,
+		std::equal_to<long>, alloc> table;
+
+void run(long n)
+{
+	table ht(10, std::hash<long>(), std::equal_to<long>());
+	std::vector<long> keys(n);
+	for (long i = 0; i < n; ++i)
+		keys[i] = long(test_rand() >> 1);
+
+	double t0 = test_seconds();
+	for (long i = 0; i < n; ++i)
+		ht.insert_unique(keys[i]);
+	double t1 = test_seconds();
+	table bulk(10, std::hash<long>(), std::equal_to<long>());
+	bulk.insert_unique(keys.begin(), keys.end());
+	double t2 = test_seconds();
+
+	std::vector<long> probes(n);
+	for (long i = 0; i < n; ++i)
+		probes[i] = i & 1 ? keys[test_rand() % n] : long(test_rand() >> 1);
+	std::vector<table::iterator> out(n);
+	std::vector<size_t> counts(n);
+
+	double t3 = test_seconds();
+	for (long i = 0; i < n; ++i)
+		out[i] = ht.find(probes[i]);
+	double t4 = test_seconds();
+	ht.find_many(probes.begin(), probes.end(), out.begin());
+	double t5 = test_seconds();
+	ht.count_many(probes.begin(), probes.end(), counts.begin());
+	double t6 = test_seconds();
+
+	printf("n=%-8ld insert loop %6.1f  bulk %6.1f   find loop %6.1f  find_many %6.1f"
+	       "  count_many %6.1f ns/key\n", n,
+	       (t1 - t0) * 1e9 / n, (t2 - t1) * 1e9 / n, (t4 - t3) * 1e9 / n,
+	       (t5 - t4) * 1e9 / n, (t6 - t5) * 1e9 / n);
+}
+
+int main()
+{
+	for (long n = 10000; n <= 4000000; n *= 20)
+		run(n);
+}
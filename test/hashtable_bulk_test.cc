@@ -0,0 +1,66 @@
+#include "test_env.h"
+#include <functional>
+#include <sstream>
+#include <unordered_set>
+#include "../hashtable_impl.h"
+
+typedef hashtable<long, long, std::hash<long>, test_identity,
+		std::equal_to<long>, alloc> table;
+
+int main()
+{
+	table ht(10, std::hash<long>(), std::equal_to<long>());
+	std::unordered_multiset<long> ref;
+
+	for (int round = 0; round < 200; ++round) {
+		/* ranges of every length around the batch size */
+		size_t n = test_rand() % (3 * __hashtable_batch + 2);
+		std::vector<long> keys(n);
+		for (size_t i = 0; i < n; ++i)
+			keys[i] = long(test_rand() % 4000);
+
+		switch (round % 3) {
+		case 0:
+			ht.insert_equal(keys.begin(), keys.end());
+			ref.insert(keys.begin(), keys.end());
+			break;
+		case 1:
+			ht.insert_unique(keys.begin(), keys.end());
+			for (size_t i = 0; i < n; ++i)
+				if (ref.count(keys[i]) == 0)
+					ref.insert(keys[i]);
+			break;
+		default: {
+			/* an input range goes one element at a time */
+			std::ostringstream os;
+			for (size_t i = 0; i < n; ++i)
+				os << keys[i] << ' ';
+			std::istringstream is(os.str());
+			ht.insert_unique(std::istream_iterator<long>(is),
+			                 std::istream_iterator<long>());
+			for (size_t i = 0; i < n; ++i)
+				if (ref.count(keys[i]) == 0)
+					ref.insert(keys[i]);
+			break;
+		}
+		}
+		assert(ht.size() == ref.size());
+
+		std::vector<table::iterator> found(n);
+		std::vector<size_t> counts(n);
+		assert(ht.find_many(keys.begin(), keys.end(), found.begin()) == found.end());
+		assert(ht.count_many(keys.begin(), keys.end(), counts.begin()) == counts.end());
+		for (size_t i = 0; i < n; ++i) {
+			assert(found[i] == ht.find(keys[i]));
+			assert(counts[i] == ref.count(keys[i]));
+		}
+
+		std::vector<long> missing(n);
+		for (size_t i = 0; i < n; ++i)
+			missing[i] = -1 - keys[i];
+		ht.find_many(missing.begin(), missing.end(), found.begin());
+		for (size_t i = 0; i < n; ++i)
+			assert(found[i] == ht.end());
+	}
+	printf("bulk insert and lookup: ok\n");
+}
@@ -0,0 +1,59 @@
+#include "test_env.h"
+#include <functional>
+#include <unordered_set>
+#include "../hashtable_impl.h"
+
+/* a string hasher which counts its calls */
+struct counting_hash {
+	static long calls;
+	size_t operator()(const test_string& x) const
+	{
+		++calls;
+		return std::hash<std::string>()(x.s);
+	}
+};
+long counting_hash::calls = 0;
+
+template <>
+struct __hashtable_traits<counting_hash> {
+	typedef __true_type cache_hash_code;
+};
+
+int main()
+{
+	typedef hashtable<test_string, test_string, counting_hash, test_identity,
+			std::equal_to<test_string>, alloc> table;
+	table ht(10, counting_hash(), std::equal_to<test_string>());
+	std::unordered_multiset<std::string> ref;
+
+	/* one hash per insert, none while the buckets grow */
+	const long n = 20000;
+	for (long i = 0; i < n; ++i) {
+		test_string k(long(test_rand() % 5000));
+		ht.insert_equal(k);
+		ref.insert(k.s);
+	}
+	assert(counting_hash::calls == n);
+
+	/* one per lookup or erase, none for the nodes they pass */
+	counting_hash::calls = 0;
+	for (long i = 0; i < 5000; ++i) {
+		test_string k(i);
+		assert(ht.count(k) == ref.count(k.s));
+		if (i % 3 == 0)
+			assert(ht.erase(k) == ref.erase(k.s));
+	}
+	assert(counting_hash::calls == 5000 + 5000 / 3 + 1);
+
+	/* iteration and copies don't hash again either */
+	counting_hash::calls = 0;
+	size_t seen = 0;
+	for (table::iterator it = ht.begin(); it != ht.end(); ++it, ++seen)
+		assert(ref.count(it->s) > 0);
+	assert(seen == ref.size());
+	table copy(ht);
+	assert(copy.size() == ref.size());
+	assert(counting_hash::calls == 0);
+
+	printf("cached hash codes: ok\n");
+}
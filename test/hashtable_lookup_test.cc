@@ -0,0 +1,61 @@
+#include "test_env.h"
+#include <functional>
+#include <string_view>
+#include <unordered_map>
+#include "../hashtable_impl.h"
+
+/* hash and compare std::string keys and string_view probes alike */
+struct sv_hash {
+	typedef void is_transparent;
+	size_t operator()(std::string_view s) const
+	{ return std::hash<std::string_view>()(s); }
+};
+
+struct sv_equal {
+	typedef void is_transparent;
+	bool operator()(std::string_view a, std::string_view b) const
+	{ return a == b; }
+};
+
+struct select_key {
+	const std::string& operator()(const std::pair<std::string, long>& x) const
+	{ return x.first; }
+};
+
+int main()
+{
+	typedef std::pair<std::string, long> value;
+	typedef hashtable<value, std::string, sv_hash, select_key, sv_equal, alloc> table;
+	table ht(10, sv_hash(), sv_equal());
+	std::unordered_map<std::string, long> ref;
+
+	char buf[32];
+	for (int i = 0; i < 50000; ++i) {
+		long n = long(test_rand() % 8000);
+		int len = snprintf(buf, sizeof(buf), "key-%ld", n);
+		std::string_view probe(buf, len);
+		size_t h = sv_hash()(probe);
+
+		switch (test_rand() % 4) {
+		case 0:
+			assert(ht.insert_unique_with_hash(value(buf, n), h).second ==
+			       ref.insert(value(buf, n)).second);
+			break;
+		case 1:
+			assert(ht.erase_with_hash(probe, h) == ref.erase(std::string(probe)));
+			break;
+		case 2:
+			/* no std::string is made for the probe */
+			assert(ht.count(probe) == ref.count(std::string(probe)));
+			break;
+		default:
+			table::iterator it = ht.find_with_hash(probe, h);
+			assert((it == ht.end()) == (ref.count(std::string(probe)) == 0));
+			if (it != ht.end())
+				assert(it->second == n && ht.find(probe) == it);
+			break;
+		}
+		assert(ht.size() == ref.size());
+	}
+	printf("heterogeneous and precomputed hash lookups: ok\n");
+}
@@ -0,0 +1,110 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../hashtable_impl.h"
+
+typedef hashtable<long, long, std::hash<long>, test_identity,
+		std::equal_to<long>, alloc> table;
+
+/* the bucket vectors come from operator new, which fails while this is set */
+bool fail_new = false;
+
+void* operator new(size_t n)
+{
+	void* p = fail_new ? 0 : malloc(n != 0 ? n : 1);
+	if (p == 0)
+		throw bad_alloc();
+	return p;
+}
+
+void operator delete(void* p) noexcept { free(p); }
+void operator delete(void* p, size_t) noexcept { free(p); }
+
+/* iterate while looking keys up, every element must come once */
+void check_iteration(table& ht, const std::multiset<long>& ref)
+{
+	std::multiset<long> seen;
+	for (table::iterator it = ht.begin(); it != ht.end(); ++it) {
+		seen.insert(*it);
+		assert(ht.find(*it) != ht.end());
+		assert(ht.find(-1 - *it) == ht.end());
+	}
+	assert(seen == ref);
+}
+
+int main()
+{
+	table ht(10, std::hash<long>(), std::equal_to<long>());
+	std::multiset<long> ref;
+	ht.set_incremental_rehash(2);
+
+	int rehashes = 0;
+	for (int i = 0; i < 100000; ++i) {
+		long k = test_rand() % 20000;
+		switch (test_rand() % 4) {
+		case 0:
+		case 1:
+			ht.insert_equal(k);
+			ref.insert(k);
+			break;
+		case 2:
+			assert(ht.erase(k) == ref.erase(k));
+			break;
+		default:
+			assert(ht.count(k) == ref.count(k));
+			break;
+		}
+		assert(ht.size() == ref.size());
+		if (ht.rehashing() && i % 1009 == 0) {
+			++rehashes;
+			check_iteration(ht, ref);
+
+			/*
+			 * a copy keeps rehashing with the same step: the old buckets
+			 * are about half as many as the new ones, so a quarter of
+			 * bucket_count() inserts finish the move before a new growth.
+			 */
+			table copy(ht);
+			check_iteration(copy, ref);
+			for (size_t j = 0; j <= copy.bucket_count() / 4; ++j)
+				copy.insert_equal(-7);
+			assert(!copy.rehashing());
+		}
+	}
+	assert(rehashes > 0);
+
+	/* step 0 finishes a rehash that is still running */
+	while (!ht.rehashing()) {
+		long k = 20000 + long(test_rand() % 1000000);
+		ht.insert_equal(k);
+		ref.insert(k);
+	}
+	ht.set_incremental_rehash(0);
+	assert(!ht.rehashing());
+	check_iteration(ht, ref);
+
+	/* growth whose new bucket vector can't be had leaves the table as it was */
+	ht.set_incremental_rehash(2);
+	for (int failures = 0; failures < 3; ) {
+		long k = 20000 + long(test_rand() % 1000000);
+		if (ht.size() + 1 > ht.bucket_count()) {
+			size_t buckets = ht.bucket_count();
+			fail_new = true;
+			bool thrown = false;
+			try {
+				ht.insert_equal(k);
+			} catch (bad_alloc&) {
+				thrown = true;
+			}
+			fail_new = false;
+			assert(thrown && ht.bucket_count() == buckets);
+			check_iteration(ht, ref);
+			++failures;
+		}
+		ht.insert_equal(k);
+		ref.insert(k);
+	}
+	check_iteration(ht, ref);
+	printf("incremental rehash: ok (%d checks during a rehash)\n", rehashes);
+	printf("failed bucket allocation: ok\n");
+}
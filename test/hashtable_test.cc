@@ -0,0 +1,59 @@
+#include "test_env.h"
+#include <functional>
+#include <unordered_set>
+#include "../hashtable_impl.h"
+
+/* random inserts, finds and erases checked against unordered_multiset */
+template <typename Policy>
+void check_policy(const char* name)
+{
+	typedef hashtable<long, long, std::hash<long>, test_identity,
+			std::equal_to<long>, alloc, Policy> table;
+	table ht(10, std::hash<long>(), std::equal_to<long>());
+	std::unordered_multiset<long> ref;
+
+	for (int i = 0; i < 200000; ++i) {
+		long k = test_rand() % 5000;
+		switch (test_rand() % 4) {
+		case 0:
+			if (ht.insert_unique(k).second != (ref.count(k) == 0))
+				assert(!"insert_unique");
+			if (ref.count(k) == 0)
+				ref.insert(k);
+			break;
+		case 1:
+			ht.insert_equal(k);
+			ref.insert(k);
+			break;
+		case 2:
+			assert(ht.erase(k) == ref.erase(k));
+			break;
+		default:
+			assert(ht.count(k) == ref.count(k));
+			assert((ht.find(k) == ht.end()) == (ref.count(k) == 0));
+			break;
+		}
+		assert(ht.size() == ref.size());
+	}
+
+	/* power of 2 bucket counts stay powers of 2 */
+	if (Policy::next_size(3) == 8)
+		assert((ht.bucket_count() & (ht.bucket_count() - 1)) == 0);
+
+	std::unordered_multiset<long> seen(ht.begin(), ht.end());
+	assert(seen == ref);
+
+	table copy(ht);
+	assert(copy.size() == ht.size());
+	for (long k = 0; k < 5000; ++k)
+		assert(copy.count(k) == ref.count(k));
+	ht.clear();
+	assert(ht.size() == 0 && ht.begin() == ht.end());
+	printf("%s: ok\n", name);
+}
+
+int main()
+{
+	check_policy<__hashtable_prime_policy>("prime buckets");
+	check_policy<__hashtable_pow2_policy>("power of 2 buckets");
+}
@@ -0,0 +1,225 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../persistent_rb_tree_impl.h"
+
+/*
+ * random inserts and erases against set, with the red-black invariants
+ * checked as it goes (the iterator's fixed stack counts on them) and
+ * snapshots kept along the way that must not change, then reader threads
+ * taking snapshots while one thread updates the tree. build with
+ * -fsanitize=thread too.
+ */
+typedef persistent_rb_tree<long, long, test_identity, std::less<long> > tree;
+
+struct snapshot {
+	tree t;
+	std::set<long> ref;
+};
+
+/*
+ * no red child of a red node, no double black left, one black height and
+ * keys in order, returns the black height of x.
+ */
+int check_rb_node(__persistent_rb_node_base* x, size_t& size)
+{
+	if (x == 0) {
+		size = 0;
+		return 1;
+	}
+	assert(x->refs.load() >= 1);
+	assert(x->color != __persistent_rb_dblack);
+	if (x->color == __persistent_rb_red)
+		assert((!x->left || x->left->color == __persistent_rb_black) &&
+		       (!x->right || x->right->color == __persistent_rb_black));
+	size_t l, r;
+	int bl = check_rb_node(x->left, l);
+	int br = check_rb_node(x->right, r);
+	assert(bl == br);
+	size = l + r + 1;
+	return bl + (x->color == __persistent_rb_black);
+}
+
+/* begin() pushes the root first */
+void check_rb(const tree& t)
+{
+	if (t.empty())
+		return;
+	__persistent_rb_node_base* root = t.begin().stack[0];
+	size_t n;
+	int height = check_rb_node(root, n);
+	assert(n == t.size());
+	assert(height <= int(tree::const_iterator::max_height) / 2);
+}
+
+void check(const tree& t, const std::set<long>& ref)
+{
+	check_rb(t);
+	assert(t.size() == ref.size());
+	assert(std::equal(t.begin(), t.end(), ref.begin()));
+	size_t n = 0;
+	for (tree::const_iterator it = t.begin(); it != t.end(); ++it)
+		++n;
+	assert(n == ref.size());
+}
+
+void sequential()
+{
+	tree t;
+	std::set<long> ref;
+	std::vector<snapshot*> kept;
+
+	for (int i = 0; i < 30000; ++i) {
+		long k = long(test_rand() % 2000);
+		if (test_rand() % 3 != 0)
+			assert(t.insert_unique(k) == ref.insert(k).second);
+		else
+			assert(t.erase(k) == ref.erase(k));
+		if (test_rand() % 7 == 0) {
+			assert(t.count(k) == ref.count(k));
+			tree::const_iterator lo = t.lower_bound(k), hi = t.upper_bound(k);
+			std::set<long>::iterator rlo = ref.lower_bound(k), rhi = ref.upper_bound(k);
+			assert((lo == t.end()) == (rlo == ref.end()));
+			assert((hi == t.end()) == (rhi == ref.end()));
+			if (rlo != ref.end())
+				assert(*lo == *rlo);
+			if (rhi != ref.end())
+				assert(*hi == *rhi);
+			assert((t.find(k) == t.end()) == (ref.find(k) == ref.end()));
+		}
+		if (i % 100 == 0)
+			check_rb(t);
+		if (i % 1500 == 0) {
+			snapshot* s = new snapshot;
+			s->t = t;
+			s->ref = ref;
+			kept.push_back(s);
+		}
+	}
+	check(t, ref);
+	for (size_t i = 0; i < kept.size(); ++i) {
+		check(kept[i]->t, kept[i]->ref);
+		delete kept[i];
+	}
+
+	tree copy(t), other;
+	other.insert_unique(-1);
+	copy.swap(other);
+	check(copy, std::set<long>{ -1 });
+	check(other, ref);
+	t.clear();
+	check(t, std::set<long>());
+	check(other, ref);
+	printf("persistent rb_tree: ok\n");
+}
+
+/*
+ * step i of the writer inserts i and erases i - window, so every version
+ * holds a run of consecutive keys, at most window + 1 between the two.
+ */
+const long window = 64;
+const long steps = 20000;
+atomic<bool> done(false);
+
+void writer(tree* t)
+{
+	for (long i = 0; i < steps; ++i) {
+		t->insert_unique(i);
+		if (i >= window)
+			t->erase(i - window);
+		if (i % 64 == 0)
+			std::this_thread::yield();
+	}
+	done.store(true, memory_order_release);
+}
+
+void reader(tree* t, long* taken)
+{
+	long n = 0;
+	while (!done.load(memory_order_acquire) || n == 0) {
+		tree s(*t);
+		size_t count = 0;
+		long prev = -1;
+		for (tree::const_iterator it = s.begin(); it != s.end(); ++it, ++count) {
+			assert(prev == -1 || *it == prev + 1);
+			prev = *it;
+		}
+		assert(count == s.size());
+		assert(count <= size_t(window) + 1);
+		++n;
+		std::this_thread::yield();
+	}
+	*taken = n;
+}
+
+struct failing_alloc {
+	static long bytes;
+	static long budget;  /* allocations left before one fails */
+
+	static void* allocate(size_t n)
+	{
+		if (budget-- == 0)
+			throw bad_alloc();
+		bytes += long(n);
+		return malloc(n);
+	}
+
+	static void deallocate(void* p, size_t n)
+	{
+		bytes -= long(n);
+		free(p);
+	}
+};
+
+long failing_alloc::bytes = 0;
+long failing_alloc::budget = -1;
+
+/* an update whose allocation fails leaves the tree as it was, leaking nothing */
+void failing()
+{
+	typedef persistent_rb_tree<long, long, test_identity, std::less<long>,
+			failing_alloc> ftree;
+	{
+		ftree t;
+		std::set<long> ref;
+		for (int i = 0; i < 20000; ++i) {
+			long k = long(test_rand() % 500);
+			failing_alloc::budget = long(test_rand() % 12);
+			bool erase = test_rand() % 3 == 0;
+			try {
+				if (erase) {
+					size_t n = t.erase(k);
+					assert(n == ref.erase(k));
+				} else {
+					bool done = t.insert_unique(k);
+					assert(done == ref.insert(k).second);
+				}
+			} catch (bad_alloc&) {
+			}
+			failing_alloc::budget = -1;
+			assert(t.size() == ref.size());
+			assert(std::equal(t.begin(), t.end(), ref.begin()));
+		}
+	}
+	assert(failing_alloc::bytes == 0);
+	printf("failing allocations: ok\n");
+}
+
+int main()
+{
+	failing();
+	sequential();
+
+	tree t;
+	long taken[3];
+	thread w(writer, &t);
+	thread r[3];
+	for (int i = 0; i < 3; ++i)
+		r[i] = thread(reader, &t, &taken[i]);
+	w.join();
+	for (int i = 0; i < 3; ++i)
+		r[i].join();
+	assert(t.size() == size_t(window));
+	printf("snapshots during updates: ok (%ld, %ld, %ld taken)\n",
+			taken[0], taken[1], taken[2]);
+}
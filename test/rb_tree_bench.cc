@@ -0,0 +1,70 @@
+#include "test_env.h"
+#include <functional>
+#include <map>
+#include "../rb_tree_impl.h"
+
+/*
+ * a mixed load on a tree of n keys out of 2n: 50% lookups (find,
+ * lower_bound, upper_bound), 25% inserts and 25% erases by key, so the
+ * size stays near n. throughput comes from the whole run, the latency percentiles
+ * from timing every operation, which adds the clock's own cost to
+ * each. rb_tree against std::map. build with -O2.
+ */
+struct select1st {
+	const long& operator()(const pair<const long, long>& x) const { return x.first; }
+};
+
+typedef rb_tree<long, pair<const long, long>, select1st, std::less<long> > tree;
+
+struct op { int kind; long key; };
+
+template <typename Map>
+void run(const char* name, long n, const std::vector<op>& ops)
+{
+	Map m;
+	for (long i = 0; i < n; ++i)
+		m.insert_unique(pair<const long, long>(i * 2, i));
+
+	std::vector<unsigned> ns(ops.size());
+	size_t hits = 0;
+	double t0 = test_seconds();
+	for (size_t i = 0; i < ops.size(); ++i) {
+		std::chrono::steady_clock::time_point a = std::chrono::steady_clock::now();
+		long k = ops[i].key;
+		switch (ops[i].kind) {
+		case 0: hits += m.find(k) != m.end(); break;
+		case 1: hits += m.lower_bound(k) != m.end(); break;
+		case 2: hits += m.upper_bound(k) != m.end(); break;
+		case 3: m.insert_unique(pair<const long, long>(k, k)); break;
+		default: m.erase(k); break;
+		}
+		ns[i] = unsigned(std::chrono::duration_cast<std::chrono::nanoseconds>(
+				std::chrono::steady_clock::now() - a).count());
+	}
+	double t1 = test_seconds();
+	std::sort(ns.begin(), ns.end());
+	size_t q = ns.size();
+	printf("%-8s n=%-8ld %6.2f Mops/s  p50 %4u  p99 %5u  p99.9 %6u  max %7u ns  (%lu)\n",
+	       name, n, q / (t1 - t0) / 1e6, ns[q / 2], ns[q * 99 / 100],
+	       ns[q * 999 / 1000], ns[q - 1], (unsigned long) hits);
+}
+
+/* std::map with the rb_tree names used above */
+struct std_map : std::map<long, long> {
+	void insert_unique(const pair<const long, long>& v) { insert(v); }
+};
+
+int main()
+{
+	for (long n = 1000; n <= 1000000; n *= 10) {
+		std::vector<op> ops(2000000);
+		for (size_t i = 0; i < ops.size(); ++i) {
+			unsigned long r = test_rand();
+			int kind = int(r % 8);
+			ops[i].kind = kind < 4 ? kind % 3 : (kind < 6 ? 3 : 4);
+			ops[i].key = long((r >> 8) % (2 * n));
+		}
+		run<tree>("rb_tree", n, ops);
+		run<std_map>("std::map", n, ops);
+	}
+}
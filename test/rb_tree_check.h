@@ -0,0 +1,50 @@
+#ifndef _RB_TREE_CHECK_H_
+#define _RB_TREE_CHECK_H_
+
+/*
+ * red-black invariants of a tree built on __rb_tree_node_base: parent
+ * links, no red child of a red node, one black height, and the subtree
+ * sizes of order-statistic nodes. returns the black height of x.
+ */
+inline void __check_size(__rb_tree_node_base*, size_t, __rb_tree_node_base*) {}
+
+inline void __check_size(__rb_tree_node_base* x, size_t size, __rb_tree_os_node_base*)
+{ assert(static_cast<__rb_tree_os_node_base*>(x)->subtree_size == size); }
+
+template <typename NodeBase>
+int check_rb_node(__rb_tree_node_base* x, __rb_tree_node_base* p, size_t& size)
+{
+	if (x == 0) {
+		size = 0;
+		return 1;
+	}
+	assert(x->parent == p);
+	if (x->color == __rb_tree_red)
+		assert((!x->left || x->left->color == __rb_tree_black) &&
+		       (!x->right || x->right->color == __rb_tree_black));
+	size_t l, r;
+	int bl = check_rb_node<NodeBase>(x->left, x, l);
+	int br = check_rb_node<NodeBase>(x->right, x, r);
+	assert(bl == br);
+	size = l + r + 1;
+	__check_size(x, size, (NodeBase*) 0);
+	return bl + (x->color == __rb_tree_black);
+}
+
+/* the invariants, then the contents in order against ref */
+template <typename NodeBase, typename Tree, typename Container>
+void check_rb_tree(Tree& t, const Container& ref)
+{
+	__rb_tree_node_base* header = t.end().node;
+	size_t n;
+	if (header->parent) {
+		assert(header->parent->color == __rb_tree_black);
+		assert(header->left == __rb_tree_node_base::minimum(header->parent));
+		assert(header->right == __rb_tree_node_base::maximum(header->parent));
+	}
+	check_rb_node<NodeBase>(header->parent, header, n);
+	assert(n == ref.size() && t.size() == ref.size());
+	assert(std::equal(t.begin(), t.end(), ref.begin()));
+}
+
+#endif
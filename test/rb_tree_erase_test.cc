@@ -0,0 +1,93 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../rb_tree_impl.h"
+#include "rb_tree_check.h"
+
+/*
+ * every form of erase and the bound queries against multiset, with the
+ * tree invariants checked as it shrinks and grows, for plain nodes and
+ * for nodes with subtree sizes.
+ */
+template <typename NodeBase>
+void check(const char* name)
+{
+	typedef rb_tree<long, long, test_identity, std::less<long>, alloc, NodeBase> tree;
+	typedef typename tree::iterator iterator;
+	tree t;
+	std::multiset<long> ref;
+
+	for (int i = 0; i < 60000; ++i) {
+		long k = long(test_rand() % 2000);
+		switch (test_rand() % 8) {
+		case 0:
+		case 1:
+		case 2:
+			t.insert_equal(k);
+			ref.insert(k);
+			break;
+		case 3:
+			assert(t.erase(k) == ref.erase(k));
+			break;
+		case 4: {
+			iterator it = t.find(k);
+			assert((it == t.end()) == (ref.find(k) == ref.end()));
+			if (it != t.end()) {
+				t.erase(it);
+				ref.erase(ref.find(k));
+			}
+			break;
+		}
+		case 5: {
+			/* a short range from k on */
+			long l = k + long(test_rand() % 20);
+			t.erase(t.lower_bound(k), t.upper_bound(l));
+			ref.erase(ref.lower_bound(k), ref.upper_bound(l));
+			break;
+		}
+		case 6: {
+			long keys[3] = { k, k + 1, k + 7 };
+			t.erase(keys, keys + 3);
+			for (int j = 0; j < 3; ++j)
+				ref.erase(keys[j]);
+			break;
+		}
+		default: {
+			assert(t.count(k) == ref.count(k));
+			pair<iterator, iterator> r = t.equal_range(k);
+			std::multiset<long>::iterator lo = ref.lower_bound(k), hi = ref.upper_bound(k);
+			assert(r.first == t.lower_bound(k) && r.second == t.upper_bound(k));
+			assert((r.first == t.end()) == (lo == ref.end()));
+			assert((r.second == t.end()) == (hi == ref.end()));
+			if (lo != ref.end())
+				assert(*r.first == *lo);
+			if (hi != ref.end())
+				assert(*r.second == *hi);
+			assert(size_t(std::distance(r.first, r.second)) == ref.count(k));
+			break;
+		}
+		}
+		if (i % 1000 == 0)
+			check_rb_tree<NodeBase>(t, ref);
+	}
+	check_rb_tree<NodeBase>(t, ref);
+
+	/* erase everything: both ends, then the whole range */
+	while (ref.size() > 2) {
+		t.erase(t.begin());
+		ref.erase(ref.begin());
+		iterator last = t.end();
+		t.erase(--last);
+		ref.erase(--ref.end());
+	}
+	check_rb_tree<NodeBase>(t, ref);
+	t.erase(t.begin(), t.end());
+	assert(t.empty() && t.begin() == t.end());
+	printf("%s: ok\n", name);
+}
+
+int main()
+{
+	check<__rb_tree_node_base>("erase and bounds");
+	check<__rb_tree_os_node_base>("erase and bounds with subtree sizes");
+}
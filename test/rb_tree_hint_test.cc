@@ -0,0 +1,74 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../rb_tree_impl.h"
+#include "rb_tree_check.h"
+
+/*
+ * hinted inserts with right hints, wrong hints, begin() and end(), then
+ * the tree invariants and contents against multiset and set.
+ */
+typedef rb_tree<long, long, test_identity, std::less<long> > tree;
+
+/* the hint: one of begin, end, the right spot, or any element */
+template <typename Tree, typename Iterator>
+Iterator pick_hint(Tree& t, Iterator right, size_t size)
+{
+	switch (test_rand() % 4) {
+	case 0:
+		return t.begin();
+	case 1:
+		return t.end();
+	case 2:
+		return right;
+	default: {
+		Iterator it = t.begin();
+		for (size_t n = size ? test_rand() % size : 0; n > 0; --n)
+			++it;
+		return it;
+	}
+	}
+}
+
+int main()
+{
+	tree equal, unique;
+	std::multiset<long> requal;
+	std::set<long> runique;
+
+	for (int i = 0; i < 20000; ++i) {
+		long k = long(test_rand() % 500);
+
+		tree::iterator h = pick_hint(equal, equal.upper_bound(k), equal.size());
+		tree::iterator r = equal.insert_equal(h, k);
+		assert(*r == k);
+		requal.insert(k);
+
+		h = pick_hint(unique, unique.lower_bound(k), unique.size());
+		r = unique.insert_unique(h, k);
+		assert(*r == k);
+		runique.insert(k);
+
+		if (i % 10 == 0)
+			equal.erase(equal.begin());
+		if (i % 10 == 0)
+			requal.erase(requal.begin());
+		if (i % 500 == 0) {
+			check_rb_tree<__rb_tree_node_base>(equal, requal);
+			check_rb_tree<__rb_tree_node_base>(unique, runique);
+		}
+	}
+	check_rb_tree<__rb_tree_node_base>(equal, requal);
+	check_rb_tree<__rb_tree_node_base>(unique, runique);
+
+	/* ascending input with end() as hint, the common bulk case */
+	tree sorted;
+	std::vector<long> ref;
+	for (long k = 0; k < 10000; ++k) {
+		sorted.insert_unique(sorted.end(), k / 2);
+		if (k % 2 == 0)
+			ref.push_back(k / 2);
+	}
+	check_rb_tree<__rb_tree_node_base>(sorted, ref);
+	printf("hinted insert: ok\n");
+}
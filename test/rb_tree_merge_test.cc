@@ -0,0 +1,92 @@
+#include "test_env.h"
+#include <functional>
+#include <map>
+#include <set>
+#include "../rb_tree_impl.h"
+#include "rb_tree_check.h"
+
+/*
+ * assign_sorted and merge on sizes that take both the flattening merge
+ * and the node by node one, on trees with subtree sizes. a value is a
+ * key and a serial number, so the order of equal keys can be checked.
+ */
+typedef pair<long, long> value;
+
+struct select_key {
+	const long& operator()(const value& x) const { return x.first; }
+};
+
+typedef rb_tree<long, value, select_key, std::less<long>, alloc,
+		__rb_tree_os_node_base> tree;
+
+void check_tree(tree& t, const std::vector<value>& ref)
+{ check_rb_tree<__rb_tree_os_node_base>(t, ref); }
+
+bool key_less(const value& a, const value& b) { return a.first < b.first; }
+
+long serial = 0;
+
+void fill(tree& t, std::vector<value>& ref, size_t n, long keys, bool unique)
+{
+	std::vector<value> v;
+	for (size_t i = 0; i < n; ++i)
+		v.push_back(value(long(test_rand() % keys), serial++));
+	std::stable_sort(v.begin(), v.end(), key_less);
+	if (unique)
+		v.erase(std::unique(v.begin(), v.end(),
+				[](const value& a, const value& b) { return a.first == b.first; }),
+				v.end());
+	if (unique)
+		t.assign_sorted_unique(v.begin(), v.end());
+	else
+		t.assign_sorted_equal(v.begin(), v.end());
+	ref = v;
+	check_tree(t, ref);
+}
+
+int main()
+{
+	const size_t sizes[] = { 0, 1, 2, 5, 40, 300, 5000 };
+	const int ns = sizeof(sizes) / sizeof(sizes[0]);
+	int cases = 0;
+
+	for (int round = 0; round < 3; ++round)
+	for (int i = 0; i < ns; ++i)
+	for (int j = 0; j < ns; ++j) {
+		long keys = round == 0 ? 100000 : (round == 1 ? 1000 : 30);
+		tree a, b;
+		std::vector<value> ra, rb;
+
+		/* merge_equal: ours first among equal keys, each side in order */
+		fill(a, ra, sizes[i], keys, false);
+		fill(b, rb, sizes[j], keys, false);
+		std::vector<value> expect(ra);
+		expect.insert(expect.end(), rb.begin(), rb.end());
+		std::stable_sort(expect.begin(), expect.end(), key_less);
+		a.merge_equal(b);
+		check_tree(a, expect);
+		check_tree(b, std::vector<value>());
+
+		/* merge_unique: x keeps the keys we already had */
+		fill(a, ra, sizes[i], keys, true);
+		fill(b, rb, sizes[j], keys, true);
+		std::map<long, value> ours;
+		for (size_t k = 0; k < ra.size(); ++k)
+			ours[ra[k].first] = ra[k];
+		std::vector<value> left_in_b;
+		for (size_t k = 0; k < rb.size(); ++k) {
+			if (ours.count(rb[k].first))
+				left_in_b.push_back(rb[k]);
+			else
+				ours[rb[k].first] = rb[k];
+		}
+		expect.clear();
+		for (std::map<long, value>::iterator it = ours.begin(); it != ours.end(); ++it)
+			expect.push_back(it->second);
+		a.merge_unique(b);
+		check_tree(a, expect);
+		check_tree(b, left_in_b);
+		++cases;
+	}
+	printf("bulk load and merge: ok (%d size pairs)\n", cases);
+}
@@ -0,0 +1,33 @@
+#include "test_env.h"
+#include <functional>
+
+int test_threads = 1;
+#define __STL_RB_TREE_THREADS test_threads
+
+#include "../rb_tree_impl.h"
+
+/*
+ * time to copy and to clear a tree of n random longs on 1 to 16 threads.
+ * the speedup is bounded by the cores the machine has: on one core more
+ * threads only add their start cost. build with -O2.
+ */
+typedef rb_tree<long, long, test_identity, std::less<long> > tree;
+
+int main()
+{
+	printf("%u hardware threads\n", thread::hardware_concurrency());
+	for (long n = 1 << 17; n <= 1 << 22; n <<= 2) {
+		tree t;
+		for (long i = 0; i < n; ++i)
+			t.insert_equal(long(test_rand() >> 1));
+		for (test_threads = 1; test_threads <= 16; test_threads *= 2) {
+			double t0 = test_seconds();
+			tree c(t);
+			double t1 = test_seconds();
+			c.clear();
+			double t2 = test_seconds();
+			printf("n=%-8ld threads=%-2d  copy %7.2f ms  clear %7.2f ms\n",
+			       n, test_threads, (t1 - t0) * 1e3, (t2 - t1) * 1e3);
+		}
+	}
+}
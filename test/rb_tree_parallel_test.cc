@@ -0,0 +1,114 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include <cerrno>
+#include <dlfcn.h>
+#include <pthread.h>
+
+int test_threads = 1;
+#define __STL_RB_TREE_THREADS test_threads
+
+#include "../rb_tree_impl.h"
+#include "rb_tree_check.h"
+
+/*
+ * copy, assignment and clear of trees big enough to go parallel, on 1 to
+ * 16 threads set through __STL_RB_TREE_THREADS (the machine may have a
+ * single core), checked against multiset. a value whose copy throws
+ * after a set number of copies checks that a failed parallel copy frees
+ * everything and rethrows. with thread starts made to fail, copy and
+ * clear finish on the calling thread. build with -fsanitize=thread too.
+ */
+atomic<bool> fail_threads(false);
+
+/* std::thread starts threads through here, refuse while fail_threads is set */
+extern "C" int pthread_create(pthread_t* t, const pthread_attr_t* a,
+                              void* (*f)(void*), void* arg)
+{
+	typedef int (*create_fn)(pthread_t*, const pthread_attr_t*,
+	                         void* (*)(void*), void*);
+	static create_fn real = (create_fn) dlsym(RTLD_NEXT, "pthread_create");
+	if (fail_threads.load())
+		return EAGAIN;
+	return real(t, a, f, arg);
+}
+
+struct counted {
+	long v;
+	static atomic<long> live;
+	static atomic<long> budget;  /* copies left before one throws */
+
+	counted(long x) : v(x) { live.fetch_add(1); }
+	counted(const counted& x) : v(x.v)
+	{
+		if (budget.fetch_sub(1) == 0)
+			throw 1;
+		live.fetch_add(1);
+	}
+	~counted() { live.fetch_sub(1); }
+};
+
+atomic<long> counted::live(0);
+atomic<long> counted::budget(-1);
+
+bool operator==(const counted& x, long y) { return x.v == y; }
+
+struct counted_key {
+	const long& operator()(const counted& x) const { return x.v; }
+};
+
+template <typename NodeBase>
+void check(const char* name)
+{
+	typedef rb_tree<long, counted, counted_key, std::less<long>, alloc,
+			NodeBase> tree;
+	tree t;
+	std::multiset<long> ref;
+	for (long i = 0; i < 100000; ++i) {
+		long k = long(test_rand() % 50000);
+		t.insert_equal(counted(k));
+		ref.insert(k);
+	}
+
+	for (test_threads = 1; test_threads <= 16; test_threads *= 2) {
+		tree c(t), d;
+		check_rb_tree<NodeBase>(c, ref);
+		d = c;
+		check_rb_tree<NodeBase>(d, ref);
+		c.clear();
+		check_rb_tree<NodeBase>(c, std::multiset<long>());
+
+		/* a copy that fails part way leaves nothing behind */
+		long before = counted::live.load();
+		counted::budget.store(long(test_rand() % ref.size()));
+		bool thrown = false;
+		try {
+			tree e(t);
+		} catch (int) {
+			thrown = true;
+		}
+		counted::budget.store(-1);
+		assert(thrown && counted::live.load() == before);
+
+		/* no thread can be started: copy and clear finish here */
+		fail_threads.store(true);
+		{
+			tree f(t), g;
+			check_rb_tree<NodeBase>(f, ref);
+			g = f;
+			check_rb_tree<NodeBase>(g, ref);
+			f.clear();
+			assert(f.size() == 0);
+		}
+		fail_threads.store(false);
+		assert(counted::live.load() == before);
+	}
+	printf("%s: ok\n", name);
+}
+
+int main()
+{
+	check<__rb_tree_node_base>("parallel copy and clear");
+	check<__rb_tree_os_node_base>("parallel copy and clear with subtree sizes");
+	assert(counted::live.load() == 0);
+}
@@ -0,0 +1,69 @@
+#include "test_env.h"
+#include <functional>
+#include <set>
+#include "../rb_tree_impl.h"
+
+/*
+ * select, rank and distance on a tree with subtree sizes, through random
+ * inserts and erases, checked against multiset. built with
+ * -DCHECK_PLAIN_SELECT it must fail to compile: a tree of plain nodes has
+ * no subtree sizes to select with.
+ */
+typedef rb_tree<long, long, test_identity, std::less<long>, alloc,
+		__rb_tree_os_node_base> tree;
+
+int main()
+{
+	tree t;
+	std::multiset<long> ref;
+
+	for (int i = 0; i < 40000; ++i) {
+		long k = long(test_rand() % 3000);
+		switch (test_rand() % 5) {
+		case 0:
+			t.insert_equal(k);
+			ref.insert(k);
+			break;
+		case 1:
+			t.insert_unique(k);
+			if (ref.count(k) == 0)
+				ref.insert(k);
+			break;
+		case 2:
+			assert(t.erase(k) == ref.erase(k));
+			break;
+		case 3:
+			if (!ref.empty()) {
+				std::multiset<long>::iterator r = ref.lower_bound(k);
+				if (r == ref.end())
+					r = ref.begin();
+				tree::iterator it = t.find(*r);
+				assert(it != t.end());
+				t.erase(it);
+				ref.erase(ref.find(*r));
+			}
+			break;
+		default: {
+			size_t rank = std::distance(ref.begin(), ref.lower_bound(k));
+			assert(t.rank(k) == rank);
+			tree::iterator s = t.select(rank);
+			assert(s == t.lower_bound(k));
+			assert(t.distance(t.begin(), s) == tree::difference_type(rank));
+			assert(t.distance(s, t.end()) == tree::difference_type(ref.size() - rank));
+			break;
+		}
+		}
+		assert(t.size() == ref.size());
+	}
+
+	size_t k = 0;
+	for (std::multiset<long>::iterator r = ref.begin(); r != ref.end(); ++r, ++k)
+		assert(*t.select(k) == *r);
+	assert(t.select(k) == t.end());
+
+#ifdef CHECK_PLAIN_SELECT
+	rb_tree<long, long, test_identity, std::less<long> > plain;
+	plain.select(0);
+#endif
+	printf("order statistics: ok\n");
+}
@@ -0,0 +1,128 @@
+#include "test_env.h"
+#include "../ring_queue_impl.h"
+
+/*
+ * values per second through spsc_queue and mpmc_queue, one at a time and
+ * in batches of 32, with p producers and as many consumers. a thread that
+ * finds the queue full or empty yields, which on a machine with fewer
+ * cores than threads is what lets the other side run. then latency: a
+ * value sent through one queue and answered through another, the round
+ * trip timed per message, with its percentiles. on one core a round trip
+ * is two thread switches. build with -O2.
+ */
+const long total = 4000000;
+
+template <typename Queue>
+void produce(Queue* q, long n, size_t batch)
+{
+	long v[32];
+	for (long i = 0; i < n; ) {
+		size_t done;
+		if (batch == 1) {
+			done = q->push(i) ? 1 : 0;
+		} else {
+			long m = min(long(batch), n - i);
+			for (long j = 0; j < m; ++j)
+				v[j] = i + j;
+			done = q->push(v, v + m);
+		}
+		i += long(done);
+		if (done == 0)
+			std::this_thread::yield();
+	}
+}
+
+template <typename Queue>
+void consume(Queue* q, atomic<long>* left, size_t batch, long* sum)
+{
+	long v[32], s = 0;
+	while (left->load(memory_order_relaxed) > 0) {
+		size_t n;
+		if (batch == 1)
+			n = q->pop(v[0]) ? 1 : 0;
+		else
+			n = q->pop(v, batch);
+		for (size_t j = 0; j < n; ++j)
+			s += v[j];
+		if (n == 0)
+			std::this_thread::yield();
+		else
+			left->fetch_sub(long(n), memory_order_relaxed);
+	}
+	*sum += s;
+}
+
+template <typename Queue>
+void run(const char* name, int threads, size_t batch)
+{
+	Queue q(1024);
+	atomic<long> left(total);
+	long sums[16] = { 0 };
+	std::vector<thread> ts;
+	double t0 = test_seconds();
+	for (int i = 0; i < threads; ++i)
+		ts.push_back(thread(produce<Queue>, &q, total / threads, batch));
+	for (int i = 0; i < threads; ++i)
+		ts.push_back(thread(consume<Queue>, &q, &left, batch, &sums[i]));
+	for (size_t i = 0; i < ts.size(); ++i)
+		ts[i].join();
+	double t = test_seconds() - t0;
+	printf("%-5s %d+%d threads  batch %-2lu  %6.1f M values/s\n", name, threads,
+	       threads, (unsigned long) batch, total / t / 1e6);
+}
+
+const long round_trips = 100000;
+
+/* answers every value, -1 ends it */
+template <typename Queue>
+void pong(Queue* in, Queue* out)
+{
+	for (;;) {
+		long x;
+		while (!in->pop(x))
+			std::this_thread::yield();
+		while (!out->push(x))
+			std::this_thread::yield();
+		if (x < 0)
+			return;
+	}
+}
+
+template <typename Queue>
+void latency(const char* name)
+{
+	Queue ping(64), reply(64);
+	thread t(pong<Queue>, &ping, &reply);
+	std::vector<double> ns(round_trips);
+	for (long i = 0; i < round_trips; ++i) {
+		double t0 = test_seconds();
+		while (!ping.push(i))
+			std::this_thread::yield();
+		long x;
+		while (!reply.pop(x))
+			std::this_thread::yield();
+		ns[i] = (test_seconds() - t0) * 1e9;
+		assert(x == i);
+	}
+	while (!ping.push(-1))
+		std::this_thread::yield();
+	t.join();
+	std::sort(ns.begin(), ns.end());
+	printf("%-5s round trip  p50 %7.0f  p90 %7.0f  p99 %7.0f  p99.9 %7.0f  max %8.0f ns\n",
+	       name, ns[round_trips / 2], ns[round_trips * 9 / 10],
+	       ns[round_trips * 99 / 100], ns[round_trips * 999 / 1000],
+	       ns[round_trips - 1]);
+}
+
+int main()
+{
+	printf("%u hardware threads\n", thread::hardware_concurrency());
+	run<spsc_queue<long> >("spsc", 1, 1);
+	run<spsc_queue<long> >("spsc", 1, 32);
+	for (int p = 1; p <= 4; p *= 2) {
+		run<mpmc_queue<long> >("mpmc", p, 1);
+		run<mpmc_queue<long> >("mpmc", p, 32);
+	}
+	latency<spsc_queue<long> >("spsc");
+	latency<mpmc_queue<long> >("mpmc");
+}
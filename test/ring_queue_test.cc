@@ -0,0 +1,190 @@
+#include "test_env.h"
+#include <deque>
+#include <functional>
+#include "../concurrent_hashtable_impl.h"
+#include "../ring_queue_impl.h"
+
+/*
+ * spsc_queue and mpmc_queue against std::deque on one thread, through
+ * wrap-around, full and empty, single and batch calls (batches of 0
+ * too), then with threads: one producer and one consumer for spsc, four
+ * of each for mpmc, every value seen once and each producer's values in
+ * order. concurrent_hashtable_impl.h is included too, both headers share
+ * __cache_line_size. build with -fsanitize=thread as well.
+ */
+template <typename Queue>
+void check_one(Queue& q, std::deque<test_string>& ref, long& next)
+{
+	switch (test_rand() % 6) {
+	case 0: {
+		bool full = ref.size() == q.capacity();
+		assert(q.push(test_string(next)) == !full);
+		if (!full)
+			ref.push_back(test_string(next));
+		++next;
+		break;
+	}
+	case 1: {
+		std::vector<test_string> v;
+		for (int j = int(test_rand() % 12); j > 0; --j)
+			v.push_back(test_string(next++));
+		size_t n = q.push(v.begin(), v.end());
+		assert(n == min(v.size(), q.capacity() - ref.size()));
+		ref.insert(ref.end(), v.begin(), v.begin() + n);
+		break;
+	}
+	case 2: {
+		test_string x(-1);
+		assert(q.pop(x) == !ref.empty());
+		if (!ref.empty()) {
+			assert(x == ref.front());
+			ref.pop_front();
+		}
+		break;
+	}
+	default: {
+		std::vector<test_string> out(12, test_string(-1));
+		size_t want = size_t(test_rand() % 12);
+		size_t n = q.pop(out.begin(), want);
+		assert(n == min(want, ref.size()));
+		for (size_t j = 0; j < n; ++j) {
+			assert(out[j] == ref.front());
+			ref.pop_front();
+		}
+		break;
+	}
+	}
+	assert(q.size() == ref.size() && q.empty() == ref.empty());
+}
+
+void sequential()
+{
+	spsc_queue<test_string> s(10);
+	mpmc_queue<test_string> m(5);
+	assert(s.capacity() == 16 && m.capacity() == 8);
+	std::deque<test_string> rs, rm;
+	long next = 0;
+	for (int i = 0; i < 20000; ++i) {
+		check_one(s, rs, next);
+		check_one(m, rm, next);
+		if (!rs.empty() && i % 7 == 0) {
+			assert(s.front() == rs.front());
+			s.pop();
+			rs.pop_front();
+		}
+	}
+	/* the destructors free what is left */
+	printf("ring queues: ok\n");
+}
+
+const long per_producer = 20000;
+
+void spsc_producer(spsc_queue<long>* q)
+{
+	long i = 0;
+	while (i < per_producer) {
+		if (i % 3 == 0) {
+			long v[5];
+			long n = min(5L, per_producer - i);
+			for (long j = 0; j < n; ++j)
+				v[j] = i + j;
+			i += long(q->push(v, v + n));
+		} else if (q->push(i)) {
+			++i;
+		}
+		if (i % 64 == 0)
+			std::this_thread::yield();
+	}
+}
+
+void spsc_consumer(spsc_queue<long>* q)
+{
+	long expect = 0;
+	while (expect < per_producer) {
+		long v[7];
+		size_t n = q->pop(v, 7);
+		for (size_t j = 0; j < n; ++j)
+			assert(v[j] == expect++);
+		long x;
+		if (q->pop(x))
+			assert(x == expect++);
+		if (n == 0)
+			std::this_thread::yield();
+	}
+}
+
+const int producers = 4;
+const int consumers = 4;
+atomic<long> consumed(0);
+atomic<int> seen[producers * per_producer];
+
+/* a value is producer * per_producer + i */
+void mpmc_producer(mpmc_queue<long>* q, int id)
+{
+	long i = 0;
+	while (i < per_producer) {
+		long base = id * per_producer;
+		if (i % 2 == 0) {
+			long v[4];
+			long n = min(4L, per_producer - i);
+			for (long j = 0; j < n; ++j)
+				v[j] = base + i + j;
+			i += long(q->push(v, v + n));
+		} else if (q->push(base + i)) {
+			++i;
+		}
+		if (i % 64 == 0)
+			std::this_thread::yield();
+	}
+}
+
+void mpmc_consumer(mpmc_queue<long>* q)
+{
+	long last[producers];
+	for (int p = 0; p < producers; ++p)
+		last[p] = -1;
+	const long total = producers * per_producer;
+	while (consumed.load(memory_order_relaxed) < total) {
+		long v[7];  /* a batch of 6 and one single pop */
+		size_t n = q->pop(v, test_rand() % 2 ? 6 : 0);
+		long x;
+		if (q->pop(x))
+			v[n++] = x;
+		for (size_t j = 0; j < n; ++j) {
+			int p = int(v[j] / per_producer);
+			assert(v[j] % per_producer > last[p]);  /* one consumer sees order */
+			last[p] = v[j] % per_producer;
+			seen[v[j]].fetch_add(1, memory_order_relaxed);
+		}
+		consumed.fetch_add(long(n), memory_order_relaxed);
+		if (n == 0)
+			std::this_thread::yield();
+	}
+}
+
+int main()
+{
+	sequential();
+
+	spsc_queue<long> s(64);
+	thread sp(spsc_producer, &s), sc(spsc_consumer, &s);
+	sp.join();
+	sc.join();
+	assert(s.empty());
+	printf("threaded spsc_queue: ok\n");
+
+	mpmc_queue<long> m(64);
+	thread p[producers], c[consumers];
+	for (int i = 0; i < producers; ++i)
+		p[i] = thread(mpmc_producer, &m, i);
+	for (int i = 0; i < consumers; ++i)
+		c[i] = thread(mpmc_consumer, &m);
+	for (int i = 0; i < producers; ++i)
+		p[i].join();
+	for (int i = 0; i < consumers; ++i)
+		c[i].join();
+	assert(m.empty());
+	for (long v = 0; v < producers * per_producer; ++v)
+		assert(seen[v].load() == 1);
+	printf("threaded mpmc_queue: ok\n");
+}
@@ -0,0 +1,98 @@
+#define TEST_WITH_ALGO
+#include "test_env.h"
+#include "../deque_impl.h"
+
+/*
+ * copy, fill, find, accumulate and for_each over a deque of longs, per
+ * buffer (what the algorithms pick for a deque) against the same call
+ * forced down its element by element path with __false_type, and the
+ * same five over a std::vector of the same size, through plain pointers:
+ * the throughput the per buffer path is after. build with -O2.
+ */
+typedef deque<long> seq;
+
+struct adder {
+	long sum;
+	adder() : sum(0) {}
+	void operator()(long x) { sum += x; }
+};
+
+const char* names[] = { "copy", "fill", "find", "accumulate", "for_each" };
+
+/* ns per element of op over the whole deque, reps times */
+template <typename Tag>
+double time_op(int op, seq& d, std::vector<long>& out, long& sink, int reps)
+{
+	double t0 = test_seconds();
+	for (int r = 0; r < reps; ++r) {
+		switch (op) {
+		case 0:
+			__copy_segmented(d.begin(), d.end(), &out[0], Tag());
+			break;
+		case 1:
+			__fill(d.begin(), d.end(), long(r), Tag());
+			break;
+		case 2:
+			sink += __find(d.begin(), d.end(), -1L, Tag()) - d.begin();
+			break;
+		case 3:
+			sink += __accumulate(d.begin(), d.end(), 0L, Tag());
+			break;
+		default:
+			sink += __for_each(d.begin(), d.end(), adder(), Tag()).sum;
+			break;
+		}
+	}
+	return (test_seconds() - t0) * 1e9 / (double(reps) * d.size());
+}
+
+/* the same over [first, last) of a vector, the baseline */
+double time_vector(int op, std::vector<long>& v, std::vector<long>& out,
+                   long& sink, int reps)
+{
+	long* first = &v[0];
+	long* last = first + v.size();
+	double t0 = test_seconds();
+	for (int r = 0; r < reps; ++r) {
+		switch (op) {
+		case 0:
+			copy(first, last, &out[0]);
+			break;
+		case 1:
+			fill(first, last, long(r));
+			break;
+		case 2:
+			sink += find(first, last, -1L) - first;
+			break;
+		case 3:
+			sink += accumulate(first, last, 0L);
+			break;
+		default:
+			sink += for_each(first, last, adder()).sum;
+			break;
+		}
+	}
+	return (test_seconds() - t0) * 1e9 / (double(reps) * v.size());
+}
+
+int main()
+{
+	long sink = 0;
+	for (long n = 1000; n <= 8000000; n *= 20) {
+		seq d;
+		for (long i = 0; i < n; ++i)
+			d.push_back(i);
+		std::vector<long> out(n), v(d.begin(), d.end());
+		int reps = int(40000000 / n) + 1;
+		for (int op = 0; op < 5; ++op) {
+			time_op<__true_type>(op, d, out, sink, 1);  /* warm up */
+			double seg = time_op<__true_type>(op, d, out, sink, reps);
+			double elem = time_op<__false_type>(op, d, out, sink, reps);
+			time_vector(op, v, out, sink, 1);
+			double vec = time_vector(op, v, out, sink, reps);
+			printf("n=%-8ld %-10s per buffer %5.2f  per element %5.2f"
+			       "  vector %5.2f ns/elem\n", n, names[op], seg, elem, vec);
+		}
+	}
+	printf("(%ld)\n", sink);
+}
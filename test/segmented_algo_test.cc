@@ -0,0 +1,118 @@
+#define TEST_WITH_ALGO
+#include "test_env.h"
+#include "../deque_impl.h"
+
+/*
+ * copy, fill, find, accumulate and for_each from algo.h on random
+ * subranges of deques, which take the per-buffer paths, against the std
+ * algorithms on a vector holding the same values. subranges start and
+ * end inside one buffer, at buffer edges and across many buffers.
+ */
+struct sum_in_order {
+	long sum;
+	long prev;
+	bool sorted;
+
+	sum_in_order() : sum(0), prev(-1000000), sorted(true) {}
+	void operator()(long x)
+	{
+		sorted = sorted && x > prev;
+		prev = x;
+		sum += x;
+	}
+};
+
+template <size_t BufSize>
+void run(const char* name)
+{
+	typedef deque<long, alloc, BufSize> seq;
+	typedef typename seq::iterator iterator;
+	typedef typename seq::difference_type difference_type;
+	seq d;
+	std::vector<long> ref;
+	for (long i = 0; i < 3000; ++i) {
+		d.push_back(i * 2);
+		ref.push_back(i * 2);
+	}
+	/* start the data part way into a buffer */
+	for (long i = 1; i <= 5; ++i) {
+		d.push_front(-i * 2);
+		ref.insert(ref.begin(), -i * 2);
+	}
+	const size_t n = ref.size();
+
+	for (int round = 0; round < 2000; ++round) {
+		size_t i = size_t(test_rand() % (n + 1));
+		size_t j = i + size_t(test_rand() % (n + 1 - i));
+		if (round % 10 == 0)
+			j = i;
+		iterator first = d.begin() + difference_type(i);
+		iterator last = d.begin() + difference_type(j);
+		typedef std::vector<long>::iterator viterator;
+		viterator rfirst = ref.begin() + i, rlast = ref.begin() + j;
+
+		/* copy out to a plain array and into another deque */
+		std::vector<long> out(j - i + 1, -7);
+		long* e = copy(first, last, &out[0]);
+		assert(e == &out[0] + (j - i) && out[j - i] == -7);
+		assert(std::equal(rfirst, rlast, out.begin()));
+		seq other(d);
+		iterator oe = copy(first, last, other.begin());
+		assert(oe - other.begin() == difference_type(j - i));
+		assert(std::equal(rfirst, rlast, other.begin()));
+
+		/* find a value inside, one outside the range, and an odd one */
+		if (j > i) {
+			long v = ref[i + size_t(test_rand() % (j - i))];
+			assert(find(first, last, v) - d.begin() ==
+			       std::find(rfirst, rlast, v) - ref.begin());
+		}
+		if (j < n)
+			assert(find(first, last, ref[j]) == last);
+		assert(find(first, last, 1L) == last);
+
+		assert(accumulate(first, last, 0L) == std::accumulate(rfirst, rlast, 0L));
+		sum_in_order f = for_each(first, last, sum_in_order());
+		assert(f.sorted && f.sum == std::accumulate(rfirst, rlast, 0L));
+	}
+
+	/* fill a subrange of a copy, then check it and both sides */
+	for (int round = 0; round < 500; ++round) {
+		size_t i = size_t(test_rand() % (n + 1));
+		size_t j = i + size_t(test_rand() % (n + 1 - i));
+		seq c(d);
+		std::vector<long> r(ref);
+		fill(c.begin() + difference_type(i), c.begin() + difference_type(j), 99L);
+		std::fill(r.begin() + i, r.begin() + j, 99L);
+		assert(std::equal(r.begin(), r.end(), c.begin()));
+	}
+	printf("%s: ok\n", name);
+}
+
+/* a value with a real copy goes through the same per-buffer loops */
+void strings()
+{
+	deque<test_string, alloc, 3> d;
+	std::vector<test_string> ref;
+	for (long i = 0; i < 200; ++i) {
+		d.push_back(test_string(i));
+		ref.push_back(test_string(i));
+	}
+	std::vector<test_string> out(ref.size(), test_string(-1));
+	copy(d.begin() + 7, d.end() - 5, &out[0]);
+	assert(std::equal(ref.begin() + 7, ref.end() - 5, out.begin()));
+	assert(find(d.begin(), d.end(), test_string(150)) - d.begin() == 150);
+	fill(d.begin() + 1, d.begin() + 9, test_string(-2));
+	for (long i = 1; i < 9; ++i)
+		assert(d[i] == test_string(-2));
+	assert(d[0] == test_string(0) && d[9] == test_string(9));
+	printf("segmented algorithms on strings: ok\n");
+}
+
+int main()
+{
+	run<1>("segmented algorithms, 1 per buffer");
+	run<7>("segmented algorithms, 7 per buffer");
+	run<0>("segmented algorithms, default buffer");
+	strings();
+}
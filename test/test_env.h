@@ -0,0 +1,185 @@
+#ifndef _TEST_ENV_H_
+#define _TEST_ENV_H_
+
+/*
+ * the *_impl.h headers are the container part of an SGI style STL and
+ * lean on the rest of it: iterator tags, construct/destroy, the
+ * uninitialized algorithms, __type_traits and the exception macros. this
+ * header supplies them from the standard library, so that a test can
+ * include the containers directly. build a test from this directory with
+ *
+ *   g++ -std=c++17 -O2 -pthread -I.. xxx_test.cc -o xxx_test
+ *
+ * tests of algo.h define TEST_WITH_ALGO first, it then replaces the
+ * standard copy, fill and find.
+ */
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <memory>
+#include <iterator>
+#include <utility>
+#include <algorithm>
+#include <numeric>
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include <shared_mutex>
+#include <thread>
+#include <exception>
+#include <type_traits>
+
+using std::size_t;
+using std::ptrdiff_t;
+using std::uintptr_t;
+using std::malloc;
+using std::free;
+using std::memmove;
+using std::memcpy;
+using std::bad_alloc;
+using std::pair;
+using std::less;
+using std::max;
+using std::min;
+using std::swap;
+using std::advance;
+using std::lower_bound;
+using std::iterator_traits;
+using std::input_iterator_tag;
+using std::output_iterator_tag;
+using std::forward_iterator_tag;
+using std::bidirectional_iterator_tag;
+using std::random_access_iterator_tag;
+using std::uninitialized_copy;
+using std::uninitialized_fill;
+using std::copy_backward;
+using std::atomic;
+using std::memory_order_relaxed;
+using std::memory_order_acquire;
+using std::memory_order_release;
+using std::memory_order_acq_rel;
+using std::memory_order_seq_cst;
+using std::mutex;
+using std::shared_mutex;
+using std::shared_lock;
+using std::unique_lock;
+using std::thread;
+using std::exception_ptr;
+using std::current_exception;
+using std::rethrow_exception;
+
+#define __STL_TRY try
+#define __STL_CATCH_ALL catch (...)
+#define __STL_UNWIND(action) catch (...) { action; throw; }
+#define __STL_NULL_TMPL_ARGS <>
+
+struct __true_type {};
+struct __false_type {};
+
+template <typename T>
+struct __type_traits {
+	typedef typename std::conditional<std::is_trivially_copyable<T>::value,
+			__true_type, __false_type>::type has_trivial_assignment_operator;
+	typedef has_trivial_assignment_operator has_trivial_copy_constructor;
+	typedef typename std::conditional<std::is_trivially_destructible<T>::value,
+			__true_type, __false_type>::type has_trivial_destructor;
+	typedef has_trivial_assignment_operator is_POD_type;
+};
+
+template <typename T1, typename T2>
+inline void construct(T1* p, const T2& value) { new (p) T1(value); }
+
+template <typename T>
+inline void destroy(T* p) { p->~T(); }
+
+template <typename T>
+inline void destroy(T* first, T* last)
+{
+	for (; first != last; ++first)
+		first->~T();
+}
+
+template <typename ForwardIterator>
+inline void destroy(ForwardIterator first, ForwardIterator last)
+{
+	for (; first != last; ++first)
+		destroy(&*first);
+}
+
+template <typename InputIterator, typename Distance>
+inline void distance(InputIterator first, InputIterator last, Distance& n)
+{ n += std::distance(first, last); }
+
+template <typename Iterator>
+inline typename iterator_traits<Iterator>::iterator_category
+iterator_category(const Iterator&)
+{ return typename iterator_traits<Iterator>::iterator_category(); }
+
+template <typename Iterator>
+inline typename iterator_traits<Iterator>::difference_type*
+distance_type(const Iterator&)
+{ return 0; }
+
+template <typename Iterator>
+inline typename iterator_traits<Iterator>::value_type*
+value_type(const Iterator&)
+{ return 0; }
+
+#include "../alloc_impl.h"
+
+template <typename T, typename Alloc = alloc>
+class vector : public std::vector<T> {
+public:
+	using std::vector<T>::vector;
+};
+
+#ifdef TEST_WITH_ALGO
+using std::reverse_iterator;
+#include "../algo.h"
+#else
+using std::copy;
+using std::fill;
+using std::find;
+using std::accumulate;
+using std::for_each;
+#endif
+
+#include <cstdio>
+#include <cassert>
+#include <chrono>
+
+/* deterministic test data, the same on every run and in every thread */
+inline unsigned long test_rand()
+{
+	static thread_local unsigned long long s = 88172645463325252ULL;
+	s ^= s << 13;
+	s ^= s >> 7;
+	s ^= s << 17;
+	return (unsigned long) s;
+}
+
+/* a value whose copy allocates, in the global namespace for ADL */
+struct test_string {
+	std::string s;
+	test_string() {}
+	test_string(long i) : s(std::to_string(i) + "-padding-so-it-allocates") {}
+	bool operator==(const test_string& x) const { return s == x.s; }
+	bool operator!=(const test_string& x) const { return s != x.s; }
+	bool operator<(const test_string& x) const { return s < x.s; }
+};
+
+/* wall clock for the *_bench.cc programs */
+inline double test_seconds()
+{
+	return std::chrono::duration<double>(
+			std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+struct test_identity {
+	template <typename T>
+	const T& operator()(const T& x) const { return x; }
+};
+
+#endif
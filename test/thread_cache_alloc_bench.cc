@@ -0,0 +1,46 @@
+#include "test_env.h"
+#include "../list_impl.h"
+
+/*
+ * list churn on t threads at once, each pushing and popping nodes of its
+ * own list, with nodes from the locked central pool and from the thread
+ * cache in front of it. total node operations per second; on a machine
+ * with fewer cores than threads this shows the lock's cost, not scaling.
+ * build with -O2.
+ */
+const long per_thread = 4000000;
+
+template <typename Alloc>
+void churn()
+{
+	list<long, Alloc> l;
+	for (long i = 0; i < per_thread; ++i) {
+		l.push_back(i);
+		if (i % 64 == 63)
+			for (int j = 0; j < 64; ++j)
+				l.pop_front();
+	}
+}
+
+template <typename Alloc>
+void run(const char* name, int threads)
+{
+	std::vector<thread> ts;
+	double t0 = test_seconds();
+	for (int i = 0; i < threads; ++i)
+		ts.push_back(thread(churn<Alloc>));
+	for (int i = 0; i < threads; ++i)
+		ts[i].join();
+	double t = test_seconds() - t0;
+	printf("%-12s %d threads  %6.1f M nodes/s\n", name, threads,
+	       2.0 * per_thread * threads / t / 1e6);
+}
+
+int main()
+{
+	printf("%u hardware threads\n", thread::hardware_concurrency());
+	for (int t = 1; t <= 4; t *= 2) {
+		run<__pool_alloc<true, 3> >("locked pool", t);
+		run<__thread_cache_alloc<4> >("thread cache", t);
+	}
+}
@@ -0,0 +1,157 @@
+#include "test_env.h"
+#include <functional>
+#include <list>
+#include <set>
+#include "../hashtable_impl.h"
+#include "../list_impl.h"
+
+/*
+ * nodes handed between threads, freed after the freeing thread's cache
+ * is gone, and freed by a static container at exit. hashtables and lists
+ * built on several threads at once, and lists built on one thread and
+ * destroyed on another. build with -fsanitize=address and with
+ * -fsanitize=thread.
+ */
+typedef __thread_cache_alloc<5> cache_alloc;
+typedef hashtable<long, long, std::hash<long>, test_identity,
+		std::equal_to<long>, cache_alloc> table;
+
+/* destroyed after main's thread cache, so its nodes go to the central pool */
+table static_table(10, std::hash<long>(), std::equal_to<long>());
+
+/* a thread_local built before the thread's cache is destroyed after it */
+struct late_user {
+	std::vector<void*> held;
+	~late_user()
+	{
+		for (size_t i = 0; i < held.size(); ++i)
+			cache_alloc::deallocate(held[i], 24);
+		for (int i = 0; i < 1000; ++i)
+			cache_alloc::deallocate(cache_alloc::allocate(40), 40);
+	}
+};
+
+void exiting_thread()
+{
+	static thread_local late_user u;
+	for (int i = 0; i < 500; ++i)
+		u.held.push_back(cache_alloc::allocate(24));
+}
+
+/* every node a producer allocates is freed by a consumer */
+void producer(std::vector<void*>* out, int n)
+{
+	for (int i = 0; i < n; ++i) {
+		long* p = (long*) cache_alloc::allocate(sizeof(long) * (1 + i % 8));
+		*p = i;
+		out->push_back(p);
+	}
+}
+
+void consumer(std::vector<void*>* in)
+{
+	for (size_t i = 0; i < in->size(); ++i) {
+		long* p = (long*) (*in)[i];
+		assert(*p == long(i));
+		cache_alloc::deallocate(p, sizeof(long) * (1 + i % 8));
+	}
+}
+
+/* threads that each build and drop their own tables */
+void table_user(int id)
+{
+	for (int round = 0; round < 20; ++round) {
+		table t(10, std::hash<long>(), std::equal_to<long>());
+		std::set<long> ref;
+		for (int i = 0; i < 2000; ++i) {
+			long k = id * 100000 + long(test_rand() % 3000);
+			if (i % 3)
+				assert(t.insert_unique(k).second == ref.insert(k).second);
+			else
+				assert(t.erase(k) == ref.erase(k));
+		}
+		assert(t.size() == ref.size());
+	}
+}
+
+typedef list<long, cache_alloc> node_list;
+
+/* lists churned against std::list, one of them left in out for another thread */
+void list_user(int id, node_list* out)
+{
+	for (int round = 0; round < 20; ++round) {
+		node_list l;
+		std::list<long> ref;
+		for (int i = 0; i < 2000; ++i) {
+			long k = id * 100000 + long(test_rand() % 3000);
+			switch (i % 4) {
+			case 0:
+			case 1:
+				l.push_back(k);
+				ref.push_back(k);
+				break;
+			case 2:
+				l.push_front(k);
+				ref.push_front(k);
+				break;
+			default:
+				l.pop_front();
+				ref.pop_front();
+				break;
+			}
+		}
+		assert(l.size() == ref.size());
+		assert(std::equal(l.begin(), l.end(), ref.begin()));
+		if (round == 0)
+			out->swap(l);
+	}
+}
+
+/* frees the nodes of a list another thread built */
+void list_dropper(node_list* in, size_t n)
+{
+	assert(in->size() == n);
+	in->clear();
+}
+
+int main()
+{
+	for (long i = 0; i < 10000; ++i)
+		static_table.insert_unique(i);
+
+	for (int i = 0; i < 4; ++i)
+		std::thread(exiting_thread).join();
+
+	std::vector<void*> handoff[4];
+	std::vector<std::thread> t;
+	for (int i = 0; i < 4; ++i)
+		t.push_back(std::thread(producer, &handoff[i], 20000));
+	for (int i = 0; i < 4; ++i)
+		t[i].join();
+	t.clear();
+	for (int i = 0; i < 4; ++i)
+		t.push_back(std::thread(consumer, &handoff[i]));
+	for (int i = 0; i < 4; ++i)
+		t.push_back(std::thread(table_user, i));
+	for (size_t i = 0; i < t.size(); ++i)
+		t[i].join();
+
+	node_list lists[4];
+	t.clear();
+	for (int i = 0; i < 4; ++i)
+		t.push_back(std::thread(list_user, i, &lists[i]));
+	for (int i = 0; i < 4; ++i)
+		t[i].join();
+	t.clear();
+	for (int i = 0; i < 4; ++i)
+		t.push_back(std::thread(list_dropper, &lists[i], lists[i].size()));
+	for (int i = 0; i < 4; ++i)
+		t[i].join();
+
+	/* every exited thread gave its cache back */
+	__alloc_stats s = cache_alloc::stats();
+	assert(s.refills > 0 && s.returns > 0);
+	printf("thread cache: ok (%lu hits, %lu refills, %lu returns)\n",
+	       (unsigned long) s.hits, (unsigned long) s.refills,
+	       (unsigned long) s.returns);
+}